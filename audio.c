@@ -6,6 +6,7 @@
 
 #include "buffer/buffer_circular.h"
 #include "timing.h"
+#include "audio.h"
 
 #define PCM_DEVICE "default"
 #define SAMPLERATE  10240 //10549 //5800 //5439
@@ -15,6 +16,36 @@
  in csdr example: 2.4Ms/s / 50 = 48000 sps
 */
 
+/* Further S16 sources summed into the main audio, e.g. channelizer monitors */
+static buffer_circular_t *audio_mix[AUDIO_MIX_MAX];
+static int audio_mix_count = 0;
+
+/* Must be called before the audio thread is started */
+void audio_mix_add(buffer_circular_t *buffer_ptr)
+{
+    if(audio_mix_count < AUDIO_MIX_MAX)
+    {
+        audio_mix[audio_mix_count++] = buffer_ptr;
+    }
+}
+
+/* Sums in as much of each mix source as is there, saturating */
+static void audio_mix_period(int16_t *output, int16_t *mix_buffer, uint32_t length)
+{
+    uint32_t mixed_samples;
+    int32_t sum;
+
+    for(int m = 0; m < audio_mix_count; m++)
+    {
+        buffer_circular_pop(audio_mix[m], length, mix_buffer, &mixed_samples);
+        for(uint32_t i = 0; i < mixed_samples; i++)
+        {
+            sum = (int32_t)output[i] + mix_buffer[i];
+            output[i] = (sum > INT16_MAX) ? INT16_MAX : ((sum < INT16_MIN) ? INT16_MIN : sum);
+        }
+    }
+}
+
 /* Audio Playback Thread */
 void *audio_playback_thread(void *arg)
 {
@@ -124,6 +155,7 @@ void *audio_playback_thread(void *arg)
 
     buff_size = periodsize * CHANNELS * sizeof(int16_t);
     buff = (char *) malloc(buff_size);
+    int16_t *mix_buff = (int16_t *) malloc(buff_size);
 
     snd_pcm_sframes_t avail;
     uint32_t retrieved_samples;
@@ -145,6 +177,7 @@ void *audio_playback_thread(void *arg)
         while (avail >= (snd_pcm_sframes_t)periodsize)
         {
             buffer_circular_thresholdPop(&buffer_circular_audio, periodsize, periodsize, buff, &retrieved_samples);
+            audio_mix_period((int16_t *)buff, mix_buff, retrieved_samples);
             written_samples = 0;
             r = snd_pcm_writei(pcm_handle, buff, retrieved_samples);
             while(r > 0 && (written_samples + r) < retrieved_samples)
@@ -176,11 +209,20 @@ void *audio_playback_thread(void *arg)
             printf("Audio: flushing input buffer\n");
             buffer_circular_flush(&buffer_circular_audio);
         }
+        for(int m = 0; m < audio_mix_count; m++)
+        {
+            buffer_circular_stats(audio_mix[m], NULL, NULL, NULL, &occupied);
+            if(occupied > 1024)
+            {
+                buffer_circular_flush(audio_mix[m]);
+            }
+        }
     }
 
     snd_pcm_drain(pcm_handle);
     snd_pcm_close(pcm_handle);
     free(buff);
+    free(mix_buff);
 
     return 0;
 }
\ No newline at end of file
@@ -1,6 +1,11 @@
 #ifndef __AUDIO_H__
 #define __AUDIO_H__
 
+#include "buffer/buffer_circular.h"
+
+#define AUDIO_MIX_MAX   4
+
+void audio_mix_add(buffer_circular_t *buffer_ptr);
 void *audio_playback_thread(void *arg);
 
 #endif /* __AUDIO_H__ */
\ No newline at end of file
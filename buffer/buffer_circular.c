@@ -7,6 +7,11 @@
 #include <unistd.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
 
 #include <pthread.h>
 
@@ -21,375 +26,754 @@ buffer_circular_t buffer_circular_audio;
 
 #define NEON_ALIGNMENT (4*4*2) // From libcsdr
 
-bool buffer_circular_init(buffer_circular_t *buffer_ptr, uint32_t unit_size, uint32_t buffer_capacity)
-{    
-    pthread_mutex_init(&buffer_ptr->Mutex, NULL);
-    pthread_cond_init(&buffer_ptr->Signal, NULL);
-    
-    pthread_mutex_lock(&buffer_ptr->Mutex);
+/*
+    All buffers have a single producer, and one or more readers that each run in a single thread, so no lock is taken:
+     - Head is only written by the producer, and published with release ordering after the data is copied in.
+     - Each reader's Tail is only written by that reader, and published with release ordering after the data is copied out.
+    Head and Tail are free-running unit counters, (Head - Tail) is the occupancy and the
+     Capacity is rounded up to a power of two so that indexes can simply be masked.
 
-    buffer_ptr->Head = 0;
-    buffer_ptr->Tail = 0;
+    Only Lossless readers limit the space available to the producer. A Latest reader may be overwritten,
+     so it checks the producer's Reserved index after reading and discards the data if it was overrun.
 
-    /* Allocate extra memory and then align the pointer */
-    buffer_ptr->Data = NULL;
-    buffer_ptr->Data = malloc((buffer_capacity * unit_size) + (NEON_ALIGNMENT-1));
-    buffer_ptr->Data = (void *)(((uintptr_t)buffer_ptr->Data + (NEON_ALIGNMENT-1)) & ~((uintptr_t)0x1F));
+    A Mirrored buffer maps the same memfd pages twice back-to-back, so Data[Capacity + n] is Data[n]
+     and a span starting anywhere in the first mapping never needs to be split at the wraparound.
+*/
 
-    buffer_ptr->Unitsize = unit_size;
+#define BUFFER_CIRCULAR_DEFAULT_READER(buffer_ptr)  (&(buffer_ptr)->Readers[0])
 
-    buffer_ptr->Capacity = buffer_capacity * unit_size;
+/* deadline is absolute on CLOCK_MONOTONIC, NULL waits forever */
+static inline void buffer_circular_futex_wait(_Atomic uint32_t *futex_ptr, uint32_t value, const struct timespec *deadline)
+{
+    syscall(SYS_futex, (uint32_t *)futex_ptr, FUTEX_WAIT_BITSET_PRIVATE, value, deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+}
 
-    pthread_mutex_unlock(&buffer_ptr->Mutex);
+static inline void buffer_circular_futex_wakeAll(_Atomic uint32_t *futex_ptr)
+{
+    syscall(SYS_futex, (uint32_t *)futex_ptr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
 
-    return (buffer_ptr->Data != NULL);
+/* Called by the producer after Head has been published */
+static inline void buffer_circular_signal(buffer_circular_t *buffer_ptr)
+{
+    atomic_fetch_add(&buffer_ptr->Sequence, 1);
+
+    if(atomic_load(&buffer_ptr->Waiters) > 0)
+    {
+        buffer_circular_futex_wakeAll(&buffer_ptr->Sequence);
+    }
 }
 
-uint32_t buffer_circular_notEmpty(buffer_circular_t *buffer_ptr)
+static inline uint64_t buffer_circular_monotonic_us(void)
 {
-    uint32_t result;
-    
-    pthread_mutex_lock(&buffer_ptr->Mutex);
-    result = (buffer_ptr->Head!=buffer_ptr->Tail);
-    pthread_mutex_unlock(&buffer_ptr->Mutex);
-    
-    return result;
+    struct timespec tp;
+
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+
+    return ((uint64_t)tp.tv_sec * 1000000) + (tp.tv_nsec / 1000);
 }
 
-uint32_t buffer_circular_head(buffer_circular_t *buffer_ptr)
-{    
-    uint32_t result;
-    
-    pthread_mutex_lock(&buffer_ptr->Mutex);
-    result = (buffer_ptr->Head / buffer_ptr->Unitsize);
-    pthread_mutex_unlock(&buffer_ptr->Mutex);
-    
-    return result;
+/* Counters have a single writer, so a plain load and store is enough */
+static inline void buffer_circular_count(_Atomic uint64_t *counter_ptr, uint64_t value)
+{
+    atomic_store_explicit(counter_ptr, atomic_load_explicit(counter_ptr, memory_order_relaxed) + value, memory_order_relaxed);
 }
 
-uint32_t buffer_circular_tail(buffer_circular_t *buffer_ptr)
+static inline void buffer_circular_histogram(_Atomic uint32_t *histogram, uint64_t duration_us)
 {
-    uint32_t result;
-    
-    pthread_mutex_lock(&buffer_ptr->Mutex);
-    result = (buffer_ptr->Tail / buffer_ptr->Unitsize);
-    pthread_mutex_unlock(&buffer_ptr->Mutex);
-    
-    return result;
+    uint32_t bucket = 0;
+
+    if(duration_us > 0)
+    {
+        bucket = MIN(64 - (uint32_t)__builtin_clzll(duration_us), BUFFER_CIRCULAR_HISTOGRAM_BUCKETS - 1);
+    }
+
+    atomic_store_explicit(&histogram[bucket], atomic_load_explicit(&histogram[bucket], memory_order_relaxed) + 1, memory_order_relaxed);
 }
 
-void buffer_circular_stats(buffer_circular_t *buffer_ptr, uint32_t *head, uint32_t *tail, uint32_t *capacity, uint32_t *occupied)
+/* Called by the producer whenever it asks for space, a stall lasts until it next gets all it asked for */
+static inline void buffer_circular_stall(buffer_circular_t *buffer_ptr, bool stalled)
 {
-    if(capacity != NULL)
+    if(stalled)
     {
-        *capacity = (buffer_ptr->Capacity / buffer_ptr->Unitsize);
+        buffer_circular_count(&buffer_ptr->LossyEvents, 1);
+        if(buffer_ptr->StallStart == 0)
+        {
+            buffer_ptr->StallStart = buffer_circular_monotonic_us();
+        }
     }
+    else if(buffer_ptr->StallStart != 0)
+    {
+        buffer_circular_histogram(buffer_ptr->ProducerWaits, buffer_circular_monotonic_us() - buffer_ptr->StallStart);
+        buffer_ptr->StallStart = 0;
+    }
+}
 
-    pthread_mutex_lock(&buffer_ptr->Mutex);
+/* Called by the producer after publishing length units, occupancy is as seen by the slowest Lossless reader */
+static inline void buffer_circular_committed(buffer_circular_t *buffer_ptr, uint32_t length, uint32_t occupied)
+{
+    buffer_circular_count(&buffer_ptr->UnitsIn, length);
 
-    if(head != NULL)
+    if(occupied > atomic_load_explicit(&buffer_ptr->PeakOccupancy, memory_order_relaxed))
     {
-        *head = (buffer_ptr->Head / buffer_ptr->Unitsize);
+        atomic_store_explicit(&buffer_ptr->PeakOccupancy, occupied, memory_order_relaxed);
     }
+}
 
-    if(tail != NULL)
+/* Called by a reader after advancing its Tail, only the default reader is counted */
+static inline void buffer_circular_consumed(buffer_circular_t *buffer_ptr, buffer_circular_reader_t *reader_ptr, uint32_t length)
+{
+    if(reader_ptr == BUFFER_CIRCULAR_DEFAULT_READER(buffer_ptr))
     {
-        *tail = (buffer_ptr->Tail / buffer_ptr->Unitsize);
+        buffer_circular_count(&buffer_ptr->UnitsOut, length);
     }
+}
 
-    if(occupied != NULL)
+/* Called by the producer, free space is limited by the slowest Lossless reader */
+static inline uint32_t buffer_circular_space(buffer_circular_t *buffer_ptr, uint32_t head)
+{
+    uint32_t occupied, max_occupied = 0;
+    uint32_t reader_count = atomic_load_explicit(&buffer_ptr->ReaderCount, memory_order_acquire);
+
+    for(uint32_t i = 0; i < reader_count; i++)
     {
-        if(buffer_ptr->Head >= buffer_ptr->Tail)
+        if(buffer_ptr->Readers[i].Policy == BUFFER_CIRCULAR_READER_LOSSLESS)
         {
-            *occupied = (buffer_ptr->Head - buffer_ptr->Tail) / buffer_ptr->Unitsize;
-        }
-        else
-        {
-            *occupied = (buffer_ptr->Head + (buffer_ptr->Capacity - buffer_ptr->Tail)) / buffer_ptr->Unitsize;
+            occupied = head - atomic_load_explicit(&buffer_ptr->Readers[i].Tail, memory_order_acquire);
+            max_occupied = MAX(occupied, max_occupied);
         }
     }
-    
-    pthread_mutex_unlock(&buffer_ptr->Mutex);
+
+    return buffer_ptr->Capacity - max_occupied;
 }
 
-void buffer_circular_flush(buffer_circular_t *buffer_ptr)
+/* Called by the producer before writing up to (but not including) position end */
+static inline void buffer_circular_reserved(buffer_circular_t *buffer_ptr, uint32_t end)
 {
-    pthread_mutex_lock(&buffer_ptr->Mutex);
-
-    buffer_ptr->Tail = buffer_ptr->Head;
-
-    pthread_mutex_unlock(&buffer_ptr->Mutex);
+    if(atomic_load_explicit(&buffer_ptr->LatestReaderCount, memory_order_relaxed) > 0)
+    {
+        atomic_store_explicit(&buffer_ptr->Reserved, end, memory_order_relaxed);
+        /* Reserved must be visible before any of the data writes */
+        atomic_thread_fence(memory_order_seq_cst);
+    }
 }
 
-/* Lossy when buffer is full */
-void buffer_circular_push(buffer_circular_t *buffer_ptr, void *data, uint32_t *length)
+/* Called by a reader, returns true once at least minLength units are available,
+    or false if the buffer is closed or timeout_ms passes first */
+static bool buffer_circular_wait(buffer_circular_t *buffer_ptr, buffer_circular_reader_t *reader_ptr, uint32_t minLength, uint32_t timeout_ms)
 {
-    uint32_t copy_length;
+    uint32_t sequence;
+    uint32_t tail = atomic_load_explicit(&reader_ptr->Tail, memory_order_relaxed);
+    uint64_t wait_start;
+    struct timespec deadline;
+    bool available;
 
-    pthread_mutex_lock(&buffer_ptr->Mutex);
+    if((atomic_load_explicit(&buffer_ptr->Head, memory_order_acquire) - tail) >= minLength)
+    {
+        return true;
+    }
+
+    wait_start = buffer_circular_monotonic_us();
 
-    if(buffer_ptr->Head >= buffer_ptr->Tail)
+    if(timeout_ms != BUFFER_CIRCULAR_WAIT_FOREVER)
     {
-        if(*length > ((buffer_ptr->Capacity - buffer_ptr->Head) / buffer_ptr->Unitsize))
+        deadline.tv_sec = (wait_start / 1000000) + (timeout_ms / 1000);
+        deadline.tv_nsec = ((wait_start % 1000000) * 1000) + ((timeout_ms % 1000) * 1000000);
+        if(deadline.tv_nsec >= 1000000000)
         {
-            if(buffer_ptr->Tail == 0)
-            {
-                /* Cannot wrap around. */
-                copy_length = buffer_ptr->Capacity - buffer_ptr->Head - 1;
-                memcpy(&((uint8_t *)buffer_ptr->Data)[buffer_ptr->Head], data, copy_length);
-
-                buffer_ptr->Head += copy_length;
-                *length -= (copy_length / buffer_ptr->Unitsize);
-            }
-            else
-            {
-                /* Will need to wrap around to save data */
-                copy_length = buffer_ptr->Capacity - buffer_ptr->Head;
-                memcpy(&((uint8_t *)buffer_ptr->Data)[buffer_ptr->Head], data, copy_length);
-
-                buffer_ptr->Head = 0;
-                *length -= (copy_length / buffer_ptr->Unitsize);
-
-                if(buffer_ptr->Tail > (1 * buffer_ptr->Unitsize))
-                {
-                    copy_length = MIN(buffer_ptr->Tail - (1 * buffer_ptr->Unitsize), (*length * buffer_ptr->Unitsize));
-
-                    memcpy(&((uint8_t *)buffer_ptr->Data)[buffer_ptr->Head], data, copy_length);
-
-                    buffer_ptr->Head += copy_length;
-
-                    *length -= (copy_length / buffer_ptr->Unitsize);
-                }
-            }
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
         }
-        else
+    }
+
+    while(!(available = ((atomic_load_explicit(&buffer_ptr->Head, memory_order_acquire) - tail) >= minLength))
+        && !atomic_load_explicit(&buffer_ptr->Closed, memory_order_acquire))
+    {
+        if(timeout_ms != BUFFER_CIRCULAR_WAIT_FOREVER
+            && buffer_circular_monotonic_us() >= ((uint64_t)deadline.tv_sec * 1000000) + (deadline.tv_nsec / 1000))
         {
-            memcpy(&((uint8_t *)buffer_ptr->Data)[buffer_ptr->Head], data, (*length * buffer_ptr->Unitsize));
+            break;
+        }
 
-            buffer_ptr->Head += (*length * buffer_ptr->Unitsize);
-            if(buffer_ptr->Head == buffer_ptr->Capacity)
-                buffer_ptr->Head = 0;
+        atomic_fetch_add(&buffer_ptr->Waiters, 1);
 
-            *length  = 0;
+        /* Re-check after sampling the sequence, so that a push or close in between can't be missed */
+        sequence = atomic_load(&buffer_ptr->Sequence);
+        if((atomic_load_explicit(&buffer_ptr->Head, memory_order_acquire) - tail) < minLength
+            && !atomic_load_explicit(&buffer_ptr->Closed, memory_order_acquire))
+        {
+            /* Returns immediately if Sequence has moved on since it was sampled */
+            buffer_circular_futex_wait(&buffer_ptr->Sequence, sequence, (timeout_ms != BUFFER_CIRCULAR_WAIT_FOREVER) ? &deadline : NULL);
         }
 
-        pthread_cond_signal(&buffer_ptr->Signal);
+        atomic_fetch_sub(&buffer_ptr->Waiters, 1);
     }
-    else if(buffer_ptr->Head < (buffer_ptr->Tail - (1 * buffer_ptr->Unitsize)))
+
+    if(reader_ptr == BUFFER_CIRCULAR_DEFAULT_READER(buffer_ptr))
     {
-        copy_length = MIN((buffer_ptr->Tail - (1 * buffer_ptr->Unitsize)) - buffer_ptr->Head, (*length * buffer_ptr->Unitsize));
+        buffer_circular_histogram(buffer_ptr->ConsumerWaits, buffer_circular_monotonic_us() - wait_start);
+    }
 
-        memcpy(&((uint8_t *)buffer_ptr->Data)[buffer_ptr->Head], data, copy_length);
+    return available;
+}
 
-        buffer_ptr->Head += copy_length;
+/* Copy into the ring at free-running position, splitting across the wraparound if needed */
+static inline void buffer_circular_copyIn(buffer_circular_t *buffer_ptr, uint32_t position, const void *data, uint32_t length)
+{
+    uint32_t index = position & buffer_ptr->Mask;
+    uint32_t first_length = buffer_ptr->Mirrored ? length : MIN(length, buffer_ptr->Capacity - index);
+
+    memcpy(&((uint8_t *)buffer_ptr->Data)[index * buffer_ptr->Unitsize], data, (first_length * buffer_ptr->Unitsize));
+    if(first_length < length)
+    {
+        /* Wraparound */
+        memcpy(buffer_ptr->Data, &((const uint8_t *)data)[first_length * buffer_ptr->Unitsize], ((length - first_length) * buffer_ptr->Unitsize));
+    }
+}
 
-        *length -= (copy_length / buffer_ptr->Unitsize);
+/* Copy out of the ring from free-running position, splitting across the wraparound if needed */
+static inline void buffer_circular_copyOut(buffer_circular_t *buffer_ptr, uint32_t position, void *data, uint32_t length)
+{
+    uint32_t index = position & buffer_ptr->Mask;
+    uint32_t first_length = buffer_ptr->Mirrored ? length : MIN(length, buffer_ptr->Capacity - index);
 
-        pthread_cond_signal(&buffer_ptr->Signal);
+    memcpy(data, &((uint8_t *)buffer_ptr->Data)[index * buffer_ptr->Unitsize], (first_length * buffer_ptr->Unitsize));
+    if(first_length < length)
+    {
+        /* Wraparound */
+        memcpy(&((uint8_t *)data)[first_length * buffer_ptr->Unitsize], buffer_ptr->Data, ((length - first_length) * buffer_ptr->Unitsize));
     }
+}
+
+/* Describe length units from free-running position as up to two contiguous spans */
+static inline void buffer_circular_spans(buffer_circular_t *buffer_ptr, uint32_t position, uint32_t length, buffer_circular_span_t spans[2])
+{
+    uint32_t index = position & buffer_ptr->Mask;
+    uint32_t first_length = buffer_ptr->Mirrored ? length : MIN(length, buffer_ptr->Capacity - index);
+
+    spans[0].Data = &((uint8_t *)buffer_ptr->Data)[index * buffer_ptr->Unitsize];
+    spans[0].Length = first_length;
 
-    pthread_mutex_unlock(&buffer_ptr->Mutex);
+    /* Wraparound */
+    spans[1].Data = buffer_ptr->Data;
+    spans[1].Length = length - first_length;
 }
 
-void buffer_circular_pop(buffer_circular_t *buffer_ptr, uint32_t maxLength, void *data, uint32_t *length)
+/* Called by a reader, returns the Tail to read from and the units available.
+    A Latest reader that has fallen too far behind skips ahead to the newest maxLength units. */
+static inline uint32_t buffer_circular_available(buffer_circular_t *buffer_ptr, buffer_circular_reader_t *reader_ptr, uint32_t maxLength, uint32_t *tail)
 {
-    *length = 0;
+    uint32_t head = atomic_load_explicit(&buffer_ptr->Head, memory_order_acquire);
+    uint32_t occupied;
 
-    pthread_mutex_lock(&buffer_ptr->Mutex);
+    *tail = atomic_load_explicit(&reader_ptr->Tail, memory_order_relaxed);
+    occupied = head - *tail;
 
-    if(buffer_ptr->Head!=buffer_ptr->Tail)
+    if(reader_ptr->Policy == BUFFER_CIRCULAR_READER_LATEST && occupied > reader_ptr->MaxBacklog)
     {
-        /* Data in the buffer */
-        if(buffer_ptr->Head > buffer_ptr->Tail)
-        {
-            /* Normal */
-            *length = MIN((buffer_ptr->Head - buffer_ptr->Tail) / buffer_ptr->Unitsize, maxLength);
-            memcpy(data, &((uint8_t *)buffer_ptr->Data)[buffer_ptr->Tail], (*length * buffer_ptr->Unitsize));
-            buffer_ptr->Tail += (*length * buffer_ptr->Unitsize);
-        }
-        else
-        {
-            /* Wraparound */
-            if(maxLength > ((buffer_ptr->Capacity - buffer_ptr->Tail) / buffer_ptr->Unitsize))
-            {
-                /* Data requested is over wraparound boundary */
-                uint32_t remaining_length;
-
-                *length = (buffer_ptr->Capacity - buffer_ptr->Tail) / buffer_ptr->Unitsize;
-                memcpy(data, &((uint8_t *)buffer_ptr->Data)[buffer_ptr->Tail], (*length * buffer_ptr->Unitsize));
-                buffer_ptr->Tail = 0;
-
-                remaining_length = MIN((buffer_ptr->Head / buffer_ptr->Unitsize), maxLength - *length);
-                memcpy(&((uint8_t *)data)[*length], &((uint8_t *)buffer_ptr->Data)[buffer_ptr->Tail], (remaining_length * buffer_ptr->Unitsize));
-                buffer_ptr->Tail += (remaining_length * buffer_ptr->Unitsize);
-                *length += remaining_length;
-            }
-            else
-            {
-                /* Data copy doesn't need to cross wraparound */
-                /*  - implicitly maxLength < data_available */
-                *length = maxLength;
-                memcpy(data, &((uint8_t *)buffer_ptr->Data)[buffer_ptr->Tail], (*length * buffer_ptr->Unitsize));
-                buffer_ptr->Tail += (*length * buffer_ptr->Unitsize);
-            }
-
-        }
+        occupied = MIN(occupied, maxLength);
+        *tail = head - occupied;
+        atomic_store_explicit(&reader_ptr->Tail, *tail, memory_order_release);
     }
 
-    pthread_mutex_unlock(&buffer_ptr->Mutex);
+    return occupied;
 }
 
-void buffer_circular_thresholdPop(buffer_circular_t *buffer_ptr, uint32_t minLength, uint32_t maxLength, void *data, uint32_t *length)
+/* Called by a Latest reader after it has finished with the data from tail, true if it wasn't overwritten meanwhile */
+static inline bool buffer_circular_unmodified(buffer_circular_t *buffer_ptr, uint32_t tail)
+{
+    /* Order the data reads before the check */
+    atomic_thread_fence(memory_order_acquire);
+
+    return ((atomic_load_explicit(&buffer_ptr->Reserved, memory_order_relaxed) - tail) <= buffer_ptr->Capacity);
+}
+
+/* Copies out up to maxLength units if at least minLength units are available */
+static void buffer_circular_read(buffer_circular_t *buffer_ptr, buffer_circular_reader_t *reader_ptr, uint32_t minLength, uint32_t maxLength, void *data, uint32_t *length)
 {
-    uint32_t remaining_length;
+    uint32_t tail;
+    uint32_t occupied = buffer_circular_available(buffer_ptr, reader_ptr, maxLength, &tail);
+
     *length = 0;
 
-    pthread_mutex_lock(&buffer_ptr->Mutex);
-    
-    if(buffer_ptr->Head == buffer_ptr->Tail
-        || ((buffer_ptr->Head > buffer_ptr->Tail) && (((buffer_ptr->Head - buffer_ptr->Tail) / buffer_ptr->Unitsize) < minLength))
-        || ((buffer_ptr->Head < buffer_ptr->Tail) && (((buffer_ptr->Head + (buffer_ptr->Capacity - buffer_ptr->Tail)) / buffer_ptr->Unitsize) < minLength)))
+    if(occupied == 0 || occupied < minLength)
     {
-        pthread_mutex_unlock(&buffer_ptr->Mutex);
         return;
     }
 
-    /* Data in the buffer */
-    if(buffer_ptr->Head > buffer_ptr->Tail)
+    *length = MIN(occupied, maxLength);
+    buffer_circular_copyOut(buffer_ptr, tail, data, *length);
+
+    if(reader_ptr->Policy == BUFFER_CIRCULAR_READER_LATEST && !buffer_circular_unmodified(buffer_ptr, tail))
     {
-        /* Normal */
-        *length = MIN((buffer_ptr->Head - buffer_ptr->Tail) / buffer_ptr->Unitsize, maxLength);
-        memcpy(data, &((uint8_t *)buffer_ptr->Data)[buffer_ptr->Tail], (*length * buffer_ptr->Unitsize));
-        buffer_ptr->Tail += (*length * buffer_ptr->Unitsize);
+        *length = 0;
     }
-    else
+
+    atomic_store_explicit(&reader_ptr->Tail, tail + MIN(occupied, maxLength), memory_order_release);
+
+    buffer_circular_consumed(buffer_ptr, reader_ptr, MIN(occupied, maxLength));
+}
+
+static uint32_t buffer_circular_peekReader(buffer_circular_t *buffer_ptr, buffer_circular_reader_t *reader_ptr, uint32_t maxLength, buffer_circular_span_t spans[2])
+{
+    uint32_t tail;
+    uint32_t occupied = buffer_circular_available(buffer_ptr, reader_ptr, maxLength, &tail);
+    uint32_t length = MIN(maxLength, occupied);
+
+    reader_ptr->PeekTail = tail;
+    buffer_circular_spans(buffer_ptr, tail, length, spans);
+
+    return length;
+}
+
+static bool buffer_circular_releaseReader(buffer_circular_t *buffer_ptr, buffer_circular_reader_t *reader_ptr, uint32_t length)
+{
+    bool valid = true;
+
+    if(reader_ptr->Policy == BUFFER_CIRCULAR_READER_LATEST)
     {
-        /* Wraparound */
-        if(maxLength > ((buffer_ptr->Capacity - buffer_ptr->Tail) / buffer_ptr->Unitsize))
-        {
-            /* Data requested is over wraparound boundary */
-            *length = (buffer_ptr->Capacity - buffer_ptr->Tail) / buffer_ptr->Unitsize;
-            memcpy(data, &((uint8_t *)buffer_ptr->Data)[buffer_ptr->Tail], (*length * buffer_ptr->Unitsize));
-            buffer_ptr->Tail = 0;
-
-            remaining_length = MIN((buffer_ptr->Head - buffer_ptr->Tail) / buffer_ptr->Unitsize, maxLength - *length);
-            memcpy(&((uint8_t *)data)[*length], &((uint8_t *)buffer_ptr->Data)[buffer_ptr->Tail], (remaining_length * buffer_ptr->Unitsize));
-            buffer_ptr->Tail += (remaining_length * buffer_ptr->Unitsize);
-            *length += remaining_length;
-        }
-        else
-        {
-            /* Data copy doesn't need to cross wraparound */
-            /*  - implicitly maxLength < data_available */
-            *length = maxLength;
-            memcpy(data, &((uint8_t *)buffer_ptr->Data)[buffer_ptr->Tail], (*length * buffer_ptr->Unitsize));
-            buffer_ptr->Tail += (*length * buffer_ptr->Unitsize);
-        }
+        valid = buffer_circular_unmodified(buffer_ptr, reader_ptr->PeekTail);
+    }
+
+    atomic_store_explicit(&reader_ptr->Tail, atomic_load_explicit(&reader_ptr->Tail, memory_order_relaxed) + length, memory_order_release);
 
+    buffer_circular_consumed(buffer_ptr, reader_ptr, length);
+
+    return valid;
+}
+
+/* Returns length bytes of memory mapped twice back-to-back, length must be a multiple of the page size */
+static void *buffer_circular_mapMirrored(size_t length)
+{
+    int fd;
+    uint8_t *address;
+
+    fd = memfd_create("buffer_circular", MFD_CLOEXEC);
+    if(fd < 0)
+    {
+        return NULL;
     }
 
-    pthread_mutex_unlock(&buffer_ptr->Mutex);
+    if(ftruncate(fd, length) < 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    /* Reserve address space for both mappings, then map the same pages over each half */
+    address = mmap(NULL, 2 * length, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(address == MAP_FAILED)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    if(mmap(address, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+        || mmap(address + length, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        munmap(address, 2 * length);
+        close(fd);
+        return NULL;
+    }
+
+    /* The mappings hold their own reference to the memfd */
+    close(fd);
+
+    return address;
 }
 
-void buffer_circular_waitPop(buffer_circular_t *buffer_ptr, uint32_t maxLength, void *data, uint32_t *length)
+static void buffer_circular_initCommon(buffer_circular_t *buffer_ptr, uint32_t unit_size, uint32_t capacity)
 {
-    uint32_t remaining_length;
-    *length = 0;
+    atomic_init(&buffer_ptr->Head, 0);
+    atomic_init(&buffer_ptr->Reserved, 0);
+    atomic_init(&buffer_ptr->Sequence, 0);
+    atomic_init(&buffer_ptr->Waiters, 0);
+    atomic_init(&buffer_ptr->Closed, false);
+
+    /* Default reader */
+    atomic_init(&buffer_ptr->Readers[0].Tail, 0);
+    buffer_ptr->Readers[0].PeekTail = 0;
+    buffer_ptr->Readers[0].Policy = BUFFER_CIRCULAR_READER_LOSSLESS;
+    buffer_ptr->Readers[0].MaxBacklog = capacity;
+    atomic_init(&buffer_ptr->ReaderCount, 1);
+    atomic_init(&buffer_ptr->LatestReaderCount, 0);
+
+    atomic_init(&buffer_ptr->UnitsIn, 0);
+    atomic_init(&buffer_ptr->LossyEvents, 0);
+    atomic_init(&buffer_ptr->DroppedUnits, 0);
+    atomic_init(&buffer_ptr->PeakOccupancy, 0);
+    buffer_ptr->StallStart = 0;
+    atomic_init(&buffer_ptr->UnitsOut, 0);
+    atomic_init(&buffer_ptr->FlushedUnits, 0);
+    for(uint32_t i = 0; i < BUFFER_CIRCULAR_HISTOGRAM_BUCKETS; i++)
+    {
+        atomic_init(&buffer_ptr->ProducerWaits[i], 0);
+        atomic_init(&buffer_ptr->ConsumerWaits[i], 0);
+    }
+
+    buffer_ptr->Unitsize = unit_size;
 
-    pthread_mutex_lock(&buffer_ptr->Mutex);
-    
-    while(buffer_ptr->Head==buffer_ptr->Tail) /* If buffer is empty */
+    buffer_ptr->Capacity = capacity;
+    buffer_ptr->Mask = capacity - 1;
+}
+
+bool buffer_circular_init(buffer_circular_t *buffer_ptr, uint32_t unit_size, uint32_t buffer_capacity)
+{
+    uint32_t capacity = 1;
+
+    /* Round up to a power of two so that free-running indexes can be masked */
+    while(capacity < buffer_capacity)
     {
-        /* Mutex is atomically unlocked on beginning waiting for signal */
-        pthread_cond_wait(&buffer_ptr->Signal, &buffer_ptr->Mutex);
-        /* and locked again on resumption */
+        capacity <<= 1;
     }
 
-    /* Data in the buffer */
-    if(buffer_ptr->Head > buffer_ptr->Tail)
+    buffer_circular_initCommon(buffer_ptr, unit_size, capacity);
+    buffer_ptr->Mirrored = false;
+
+    /* Allocate extra memory and then align the pointer */
+    buffer_ptr->Data = NULL;
+    buffer_ptr->Data = malloc((capacity * unit_size) + (NEON_ALIGNMENT-1));
+    buffer_ptr->Data = (void *)(((uintptr_t)buffer_ptr->Data + (NEON_ALIGNMENT-1)) & ~((uintptr_t)(NEON_ALIGNMENT-1)));
+
+    return (buffer_ptr->Data != NULL);
+}
+
+bool buffer_circular_initMirrored(buffer_circular_t *buffer_ptr, uint32_t unit_size, uint32_t buffer_capacity)
+{
+    uint32_t capacity = 1;
+    uint32_t page_size = sysconf(_SC_PAGESIZE);
+
+    /* Round up to a power of two, that is also a whole number of pages */
+    while(capacity < buffer_capacity || ((capacity * unit_size) % page_size) != 0)
     {
-        /* Normal */
-        *length = MIN((buffer_ptr->Head - buffer_ptr->Tail) / buffer_ptr->Unitsize, maxLength);
-        memcpy(data, &((uint8_t *)buffer_ptr->Data)[buffer_ptr->Tail], (*length * buffer_ptr->Unitsize));
-        buffer_ptr->Tail += (*length * buffer_ptr->Unitsize);
+        capacity <<= 1;
     }
-    else
+
+    buffer_circular_initCommon(buffer_ptr, unit_size, capacity);
+    buffer_ptr->Mirrored = true;
+
+    /* mmap() is page aligned, so always NEON aligned */
+    buffer_ptr->Data = buffer_circular_mapMirrored(capacity * unit_size);
+
+    return (buffer_ptr->Data != NULL);
+}
+
+/* Returns NULL if all readers are in use. maxBacklog is only used for Latest readers, 0 selects half the Capacity */
+buffer_circular_reader_t *buffer_circular_readerAdd(buffer_circular_t *buffer_ptr, buffer_circular_policy_t policy, uint32_t maxBacklog)
+{
+    buffer_circular_reader_t *reader_ptr;
+    uint32_t reader_count = atomic_load(&buffer_ptr->ReaderCount);
+
+    if(reader_count >= BUFFER_CIRCULAR_MAX_READERS)
     {
-        /* Wraparound */
-        if(maxLength > ((buffer_ptr->Capacity - buffer_ptr->Tail) / buffer_ptr->Unitsize))
-        {
-            /* Data requested is over wraparound boundary */
-            *length = (buffer_ptr->Capacity - buffer_ptr->Tail) / buffer_ptr->Unitsize;
-            memcpy(data, &((uint8_t *)buffer_ptr->Data)[buffer_ptr->Tail], (*length * buffer_ptr->Unitsize));
-            buffer_ptr->Tail = 0;
-
-            remaining_length = MIN((buffer_ptr->Head - buffer_ptr->Tail) / buffer_ptr->Unitsize, maxLength - *length);
-            memcpy(&((uint8_t *)data)[*length], &((uint8_t *)buffer_ptr->Data)[buffer_ptr->Tail], (remaining_length * buffer_ptr->Unitsize));
-            buffer_ptr->Tail += (remaining_length * buffer_ptr->Unitsize);
-            *length += remaining_length;
-        }
-        else
+        return NULL;
+    }
+
+    reader_ptr = &buffer_ptr->Readers[reader_count];
+
+    reader_ptr->Policy = policy;
+    reader_ptr->MaxBacklog = (maxBacklog > 0) ? MIN(maxBacklog, buffer_ptr->Capacity / 2) : (buffer_ptr->Capacity / 2);
+
+    /* Starts from the current Head, previous data is not seen */
+    atomic_store(&reader_ptr->Tail, atomic_load(&buffer_ptr->Head));
+    reader_ptr->PeekTail = atomic_load_explicit(&reader_ptr->Tail, memory_order_relaxed);
+
+    if(policy == BUFFER_CIRCULAR_READER_LATEST)
+    {
+        atomic_fetch_add(&buffer_ptr->LatestReaderCount, 1);
+    }
+
+    /* Publish the reader to the producer only once it's set up */
+    atomic_store_explicit(&buffer_ptr->ReaderCount, reader_count + 1, memory_order_release);
+
+    return reader_ptr;
+}
+
+uint32_t buffer_circular_notEmpty(buffer_circular_t *buffer_ptr)
+{
+    return (atomic_load_explicit(&buffer_ptr->Head, memory_order_acquire)
+        != atomic_load_explicit(&BUFFER_CIRCULAR_DEFAULT_READER(buffer_ptr)->Tail, memory_order_acquire));
+}
+
+uint32_t buffer_circular_head(buffer_circular_t *buffer_ptr)
+{
+    return (atomic_load_explicit(&buffer_ptr->Head, memory_order_acquire) & buffer_ptr->Mask);
+}
+
+uint32_t buffer_circular_tail(buffer_circular_t *buffer_ptr)
+{
+    return (atomic_load_explicit(&BUFFER_CIRCULAR_DEFAULT_READER(buffer_ptr)->Tail, memory_order_acquire) & buffer_ptr->Mask);
+}
+
+void buffer_circular_stats(buffer_circular_t *buffer_ptr, uint32_t *head, uint32_t *tail, uint32_t *capacity, uint32_t *occupied)
+{
+    uint32_t head_snapshot, tail_snapshot;
+
+    /* Tail first, so that the occupancy can never appear negative */
+    tail_snapshot = atomic_load_explicit(&BUFFER_CIRCULAR_DEFAULT_READER(buffer_ptr)->Tail, memory_order_acquire);
+    head_snapshot = atomic_load_explicit(&buffer_ptr->Head, memory_order_acquire);
+
+    if(capacity != NULL)
+    {
+        *capacity = buffer_ptr->Capacity;
+    }
+
+    if(head != NULL)
+    {
+        *head = (head_snapshot & buffer_ptr->Mask);
+    }
+
+    if(tail != NULL)
+    {
+        *tail = (tail_snapshot & buffer_ptr->Mask);
+    }
+
+    if(occupied != NULL)
+    {
+        *occupied = (head_snapshot - tail_snapshot);
+    }
+}
+
+/* Default reader, discards all data currently in the buffer */
+void buffer_circular_flush(buffer_circular_t *buffer_ptr)
+{
+    uint32_t head = atomic_load_explicit(&buffer_ptr->Head, memory_order_acquire);
+
+    buffer_circular_count(&buffer_ptr->FlushedUnits, head - atomic_load_explicit(&BUFFER_CIRCULAR_DEFAULT_READER(buffer_ptr)->Tail, memory_order_relaxed));
+
+    atomic_store_explicit(&BUFFER_CIRCULAR_DEFAULT_READER(buffer_ptr)->Tail, head, memory_order_release);
+}
+
+void buffer_circular_metrics(buffer_circular_t *buffer_ptr, buffer_circular_metrics_t *metrics)
+{
+    metrics->Unitsize = buffer_ptr->Unitsize;
+    metrics->Capacity = buffer_ptr->Capacity;
+
+    metrics->UnitsIn = atomic_load_explicit(&buffer_ptr->UnitsIn, memory_order_relaxed);
+    metrics->UnitsOut = atomic_load_explicit(&buffer_ptr->UnitsOut, memory_order_relaxed);
+    metrics->LossyEvents = atomic_load_explicit(&buffer_ptr->LossyEvents, memory_order_relaxed);
+    metrics->DroppedUnits = atomic_load_explicit(&buffer_ptr->DroppedUnits, memory_order_relaxed);
+    metrics->FlushedUnits = atomic_load_explicit(&buffer_ptr->FlushedUnits, memory_order_relaxed);
+    metrics->PeakOccupancy = atomic_load_explicit(&buffer_ptr->PeakOccupancy, memory_order_relaxed);
+
+    for(uint32_t i = 0; i < BUFFER_CIRCULAR_HISTOGRAM_BUCKETS; i++)
+    {
+        metrics->ProducerWaits[i] = atomic_load_explicit(&buffer_ptr->ProducerWaits[i], memory_order_relaxed);
+        metrics->ConsumerWaits[i] = atomic_load_explicit(&buffer_ptr->ConsumerWaits[i], memory_order_relaxed);
+    }
+}
+
+static void buffer_circular_histogramPrint(const char *label, uint32_t *histogram)
+{
+    printf("   %s:", label);
+    for(uint32_t i = 0; i < BUFFER_CIRCULAR_HISTOGRAM_BUCKETS; i++)
+    {
+        if(histogram[i] > 0)
         {
-            /* Data copy doesn't need to cross wraparound */
-            /*  - implicitly maxLength < data_available */
-            *length = maxLength;
-            memcpy(data, &((uint8_t *)buffer_ptr->Data)[buffer_ptr->Tail], (*length * buffer_ptr->Unitsize));
-            buffer_ptr->Tail += (*length * buffer_ptr->Unitsize);
+            printf(" <%" PRIu64 "us:%" PRIu32, ((uint64_t)1 << i), histogram[i]);
         }
+    }
+    printf("\n");
+}
 
+void buffer_circular_metricsPrint(const char *name, buffer_circular_metrics_t *metrics)
+{
+    printf(" - %s: in %" PRIu64 " B, out %" PRIu64 " B, peak %" PRIu32 " / %" PRIu32 " (%.1f%%)\n",
+        name,
+        metrics->UnitsIn * metrics->Unitsize,
+        metrics->UnitsOut * metrics->Unitsize,
+        metrics->PeakOccupancy, metrics->Capacity,
+        (100.0 * metrics->PeakOccupancy) / metrics->Capacity);
+    printf("   lossy %" PRIu64 ", dropped %" PRIu64 ", flushed %" PRIu64 " (units)\n",
+        metrics->LossyEvents, metrics->DroppedUnits, metrics->FlushedUnits);
+    buffer_circular_histogramPrint("producer stalls", metrics->ProducerWaits);
+    buffer_circular_histogramPrint("consumer waits", metrics->ConsumerWaits);
+}
+
+/* Lossy when buffer is full */
+void buffer_circular_push(buffer_circular_t *buffer_ptr, void *data, uint32_t *length)
+{
+    uint32_t head = atomic_load_explicit(&buffer_ptr->Head, memory_order_relaxed);
+    uint32_t space = buffer_circular_space(buffer_ptr, head);
+    uint32_t copy_length = MIN(*length, space);
+
+    buffer_circular_stall(buffer_ptr, copy_length < *length);
+    buffer_circular_count(&buffer_ptr->DroppedUnits, *length - copy_length);
+
+    if(copy_length == 0)
+    {
+        return;
     }
 
-    pthread_mutex_unlock(&buffer_ptr->Mutex);
+    buffer_circular_reserved(buffer_ptr, head + copy_length);
+    buffer_circular_copyIn(buffer_ptr, head, data, copy_length);
+
+    atomic_store_explicit(&buffer_ptr->Head, head + copy_length, memory_order_release);
+    *length -= copy_length;
+
+    buffer_circular_committed(buffer_ptr, copy_length, (buffer_ptr->Capacity - space) + copy_length);
+    buffer_circular_signal(buffer_ptr);
 }
 
-void buffer_circular_waitThresholdPop(buffer_circular_t *buffer_ptr, uint32_t minLength, uint32_t maxLength, void *data, uint32_t *length)
+void buffer_circular_pop(buffer_circular_t *buffer_ptr, uint32_t maxLength, void *data, uint32_t *length)
+{
+    buffer_circular_read(buffer_ptr, BUFFER_CIRCULAR_DEFAULT_READER(buffer_ptr), 0, maxLength, data, length);
+}
+
+void buffer_circular_thresholdPop(buffer_circular_t *buffer_ptr, uint32_t minLength, uint32_t maxLength, void *data, uint32_t *length)
+{
+    buffer_circular_read(buffer_ptr, BUFFER_CIRCULAR_DEFAULT_READER(buffer_ptr), minLength, maxLength, data, length);
+}
+
+bool buffer_circular_waitPop(buffer_circular_t *buffer_ptr, uint32_t maxLength, void *data, uint32_t *length)
 {
-    uint32_t remaining_length;
     *length = 0;
 
-    pthread_mutex_lock(&buffer_ptr->Mutex);
-    
-    while(buffer_ptr->Head == buffer_ptr->Tail
-        || ((buffer_ptr->Head > buffer_ptr->Tail) && (((buffer_ptr->Head - buffer_ptr->Tail) / buffer_ptr->Unitsize) < minLength))
-        || ((buffer_ptr->Head < buffer_ptr->Tail) && (((buffer_ptr->Head + (buffer_ptr->Capacity - buffer_ptr->Tail)) / buffer_ptr->Unitsize) < minLength)))
+    /* Wait until buffer is not empty */
+    if(!buffer_circular_wait(buffer_ptr, BUFFER_CIRCULAR_DEFAULT_READER(buffer_ptr), 1, BUFFER_CIRCULAR_WAIT_FOREVER))
     {
-        /* Mutex is atomically unlocked on beginning waiting for signal */
-        pthread_cond_wait(&buffer_ptr->Signal, &buffer_ptr->Mutex);
-        /* and locked again on resumption */
+        return false;
     }
 
-    /* Data in the buffer */
-    if(buffer_ptr->Head > buffer_ptr->Tail)
+    buffer_circular_read(buffer_ptr, BUFFER_CIRCULAR_DEFAULT_READER(buffer_ptr), 0, maxLength, data, length);
+
+    return true;
+}
+
+bool buffer_circular_waitThresholdPop(buffer_circular_t *buffer_ptr, uint32_t minLength, uint32_t maxLength, void *data, uint32_t *length)
+{
+    return buffer_circular_timedWaitThresholdPop(buffer_ptr, minLength, maxLength, data, length, BUFFER_CIRCULAR_WAIT_FOREVER);
+}
+
+bool buffer_circular_timedWaitThresholdPop(buffer_circular_t *buffer_ptr, uint32_t minLength, uint32_t maxLength, void *data, uint32_t *length, uint32_t timeout_ms)
+{
+    *length = 0;
+
+    if(!buffer_circular_wait(buffer_ptr, BUFFER_CIRCULAR_DEFAULT_READER(buffer_ptr), MAX(minLength, 1), timeout_ms))
     {
-        /* Normal */
-        *length = MIN((buffer_ptr->Head - buffer_ptr->Tail) / buffer_ptr->Unitsize, maxLength);
-        memcpy(data, &((uint8_t *)buffer_ptr->Data)[buffer_ptr->Tail], (*length * buffer_ptr->Unitsize));
-        buffer_ptr->Tail += (*length * buffer_ptr->Unitsize);
+        return false;
     }
-    else
+
+    buffer_circular_read(buffer_ptr, BUFFER_CIRCULAR_DEFAULT_READER(buffer_ptr), minLength, maxLength, data, length);
+
+    return true;
+}
+
+/* Copies out as many whole blocks as are available, up to maxBlocks, waiting for at least one */
+uint32_t buffer_circular_waitBlocksPop(buffer_circular_t *buffer_ptr, uint32_t blockLength, uint32_t maxBlocks, void *data, uint32_t timeout_ms)
+{
+    uint32_t tail, occupied, blocks;
+
+    if(blockLength == 0 || maxBlocks == 0
+        || !buffer_circular_wait(buffer_ptr, BUFFER_CIRCULAR_DEFAULT_READER(buffer_ptr), blockLength, timeout_ms))
     {
-        /* Wraparound */
-        if(maxLength > ((buffer_ptr->Capacity - buffer_ptr->Tail) / buffer_ptr->Unitsize))
-        {
-            /* Data requested is over wraparound boundary */
-            *length = (buffer_ptr->Capacity - buffer_ptr->Tail) / buffer_ptr->Unitsize;
-            memcpy(data, &((uint8_t *)buffer_ptr->Data)[buffer_ptr->Tail], (*length * buffer_ptr->Unitsize));
-            buffer_ptr->Tail = 0;
-
-            remaining_length = MIN((buffer_ptr->Head - buffer_ptr->Tail) / buffer_ptr->Unitsize, maxLength - *length);
-            memcpy(&((uint8_t *)data)[*length], &((uint8_t *)buffer_ptr->Data)[buffer_ptr->Tail], (remaining_length * buffer_ptr->Unitsize));
-            buffer_ptr->Tail += (remaining_length * buffer_ptr->Unitsize);
-            *length += remaining_length;
-        }
-        else
-        {
-            /* Data copy doesn't need to cross wraparound */
-            /*  - implicitly maxLength < data_available */
-            *length = maxLength;
-            memcpy(data, &((uint8_t *)buffer_ptr->Data)[buffer_ptr->Tail], (*length * buffer_ptr->Unitsize));
-            buffer_ptr->Tail += (*length * buffer_ptr->Unitsize);
-        }
+        return 0;
+    }
+
+    occupied = buffer_circular_available(buffer_ptr, BUFFER_CIRCULAR_DEFAULT_READER(buffer_ptr), blockLength * maxBlocks, &tail);
+    blocks = MIN(occupied / blockLength, maxBlocks);
+
+    buffer_circular_copyOut(buffer_ptr, tail, data, blocks * blockLength);
+
+    atomic_store_explicit(&BUFFER_CIRCULAR_DEFAULT_READER(buffer_ptr)->Tail, tail + (blocks * blockLength), memory_order_release);
+    buffer_circular_consumed(buffer_ptr, BUFFER_CIRCULAR_DEFAULT_READER(buffer_ptr), blocks * blockLength);
+
+    return blocks;
+}
+
+/* Wakes all waiting readers, which then return without data. Data already in the buffer can still be read. */
+void buffer_circular_close(buffer_circular_t *buffer_ptr)
+{
+    atomic_store_explicit(&buffer_ptr->Closed, true, memory_order_release);
+
+    buffer_circular_signal(buffer_ptr);
+}
+
+bool buffer_circular_isClosed(buffer_circular_t *buffer_ptr)
+{
+    return atomic_load_explicit(&buffer_ptr->Closed, memory_order_acquire);
+}
+
+uint32_t buffer_circular_reserve(buffer_circular_t *buffer_ptr, uint32_t maxLength, buffer_circular_span_t spans[2])
+{
+    uint32_t head = atomic_load_explicit(&buffer_ptr->Head, memory_order_relaxed);
+    uint32_t space = buffer_circular_space(buffer_ptr, head);
+    uint32_t length = MIN(maxLength, space);
+
+    buffer_circular_stall(buffer_ptr, length < maxLength);
+    buffer_circular_reserved(buffer_ptr, head + length);
+    buffer_circular_spans(buffer_ptr, head, length, spans);
+
+    return length;
+}
+
+/* Publishes length units written into previously reserved spans */
+void buffer_circular_commit(buffer_circular_t *buffer_ptr, uint32_t length)
+{
+    if(length == 0)
+    {
+        return;
+    }
+
+    uint32_t head = atomic_load_explicit(&buffer_ptr->Head, memory_order_relaxed) + length;
+
+    atomic_store_explicit(&buffer_ptr->Head, head, memory_order_release);
+
+    buffer_circular_committed(buffer_ptr, length, buffer_ptr->Capacity - buffer_circular_space(buffer_ptr, head));
+    buffer_circular_signal(buffer_ptr);
+}
+
+void buffer_circular_drop(buffer_circular_t *buffer_ptr, uint32_t length)
+{
+    buffer_circular_count(&buffer_ptr->DroppedUnits, length);
+}
+
+uint32_t buffer_circular_peek(buffer_circular_t *buffer_ptr, uint32_t maxLength, buffer_circular_span_t spans[2])
+{
+    return buffer_circular_peekReader(buffer_ptr, BUFFER_CIRCULAR_DEFAULT_READER(buffer_ptr), maxLength, spans);
+}
+
+uint32_t buffer_circular_waitThresholdPeek(buffer_circular_t *buffer_ptr, uint32_t minLength, uint32_t maxLength, buffer_circular_span_t spans[2])
+{
+    return buffer_circular_timedWaitThresholdPeek(buffer_ptr, minLength, maxLength, spans, BUFFER_CIRCULAR_WAIT_FOREVER);
+}
+
+uint32_t buffer_circular_timedWaitThresholdPeek(buffer_circular_t *buffer_ptr, uint32_t minLength, uint32_t maxLength, buffer_circular_span_t spans[2], uint32_t timeout_ms)
+{
+    if(!buffer_circular_wait(buffer_ptr, BUFFER_CIRCULAR_DEFAULT_READER(buffer_ptr), MAX(minLength, 1), timeout_ms))
+    {
+        spans[0].Length = 0;
+        spans[1].Length = 0;
+        return 0;
     }
 
-    pthread_mutex_unlock(&buffer_ptr->Mutex);
-}
\ No newline at end of file
+    return buffer_circular_peekReader(buffer_ptr, BUFFER_CIRCULAR_DEFAULT_READER(buffer_ptr), maxLength, spans);
+}
+
+/* Hands length units of previously peeked spans back to the producer */
+void buffer_circular_release(buffer_circular_t *buffer_ptr, uint32_t length)
+{
+    buffer_circular_releaseReader(buffer_ptr, BUFFER_CIRCULAR_DEFAULT_READER(buffer_ptr), length);
+}
+
+uint32_t buffer_circular_readerPeek(buffer_circular_t *buffer_ptr, buffer_circular_reader_t *reader_ptr, uint32_t maxLength, buffer_circular_span_t spans[2])
+{
+    return buffer_circular_peekReader(buffer_ptr, reader_ptr, maxLength, spans);
+}
+
+uint32_t buffer_circular_readerWaitThresholdPeek(buffer_circular_t *buffer_ptr, buffer_circular_reader_t *reader_ptr, uint32_t minLength, uint32_t maxLength, buffer_circular_span_t spans[2])
+{
+    if(!buffer_circular_wait(buffer_ptr, reader_ptr, MAX(minLength, 1), BUFFER_CIRCULAR_WAIT_FOREVER))
+    {
+        spans[0].Length = 0;
+        spans[1].Length = 0;
+        return 0;
+    }
+
+    return buffer_circular_peekReader(buffer_ptr, reader_ptr, maxLength, spans);
+}
+
+bool buffer_circular_readerRelease(buffer_circular_t *buffer_ptr, buffer_circular_reader_t *reader_ptr, uint32_t length)
+{
+    return buffer_circular_releaseReader(buffer_ptr, reader_ptr, length);
+}
@@ -1,45 +1,169 @@
 #ifndef __BUFFER_CIRCULAR_H__
 #define __BUFFER_CIRCULAR_H__
 
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/* Head and each Tail are kept on separate cache lines so producer and consumers don't false-share */
+#define BUFFER_CIRCULAR_CACHELINE   64
+
 typedef struct {
     float i;
     float q;
 } __attribute__((__packed__)) buffer_iqsample_t;
 
+/* Contiguous region of the ring, handed out for in-place access */
+typedef struct {
+    void *Data;
+    /* Length (in units) */
+    uint32_t Length;
+} buffer_circular_span_t;
+
+/* Maximum number of consumers of a single buffer, Reader 0 is the default lossless reader */
+#define BUFFER_CIRCULAR_MAX_READERS 4
+
+typedef enum {
+    /* Producer never overwrites data this reader hasn't released, pushes are lossy instead */
+    BUFFER_CIRCULAR_READER_LOSSLESS = 0,
+    /* Producer ignores this reader, it skips ahead to the newest data when it falls too far behind */
+    BUFFER_CIRCULAR_READER_LATEST
+} buffer_circular_policy_t;
+
+typedef struct
+{
+    /* Tail Index (in units, free-running), written only by this reader */
+    _Atomic uint32_t Tail __attribute__((aligned(BUFFER_CIRCULAR_CACHELINE)));
+    /* Tail at the time of the last peek, to detect being overrun (Latest only) */
+    uint32_t PeekTail;
+    buffer_circular_policy_t Policy;
+    /* Backlog (in units) beyond which a Latest reader skips ahead */
+    uint32_t MaxBacklog;
+} buffer_circular_reader_t;
+
+/* timeout_ms for the wait functions that never time out */
+#define BUFFER_CIRCULAR_WAIT_FOREVER    UINT32_MAX
+
+/* Wait time histograms: bucket 0 is under 1us, bucket n is [2^(n-1), 2^n) us, the last bucket takes everything longer */
+#define BUFFER_CIRCULAR_HISTOGRAM_BUCKETS   24
+
+/* Snapshot of a buffer's counters, all since init */
+typedef struct {
+    uint32_t Unitsize;
+    uint32_t Capacity;
+    /* Committed by the producer / released by the default reader */
+    uint64_t UnitsIn;
+    uint64_t UnitsOut;
+    /* Pushes or reserves that couldn't get all the space they asked for */
+    uint64_t LossyEvents;
+    /* Units discarded by the producer because the buffer was full */
+    uint64_t DroppedUnits;
+    /* Units discarded by buffer_circular_flush() */
+    uint64_t FlushedUnits;
+    /* Highest occupancy seen by the producer after a commit */
+    uint32_t PeakOccupancy;
+    /* Time the producer spent unable to get the space it asked for */
+    uint32_t ProducerWaits[BUFFER_CIRCULAR_HISTOGRAM_BUCKETS];
+    /* Time the default reader spent blocked waiting for data */
+    uint32_t ConsumerWaits[BUFFER_CIRCULAR_HISTOGRAM_BUCKETS];
+} buffer_circular_metrics_t;
+
+/* Single-Producer, Multiple-Reader lock-free ring */
 typedef struct
 {
-    /* Buffer Access Lock */
-    pthread_mutex_t Mutex;
-    /* New Data Signal */
-    pthread_cond_t Signal;
-    /* Head and Tail Indexes (in bytes, regardless of Unitsize) */
-    uint32_t Head, Tail;
     /* Data */
     void *Data;
     /* Size of Data unit */
     uint32_t Unitsize;
-    /* Buffer Capacity (in bytes, regardless of Unitsize) */
+    /* Buffer Capacity (in units, always a power of two) */
     uint32_t Capacity;
+    /* Capacity - 1, for index wraparound */
+    uint32_t Mask;
+    /* Data is mapped twice back-to-back, so any span up to Capacity is contiguous */
+    bool Mirrored;
+    /* Number of Readers in use, and how many of those are Latest */
+    _Atomic uint32_t ReaderCount;
+    _Atomic uint32_t LatestReaderCount;
+
+    /* Head Index (in units, free-running), written only by the producer */
+    _Atomic uint32_t Head __attribute__((aligned(BUFFER_CIRCULAR_CACHELINE)));
+    /* End of the region currently being written by the producer, Latest readers check this after reading */
+    _Atomic uint32_t Reserved;
+
+    /* Consumers, each with their own Tail */
+    buffer_circular_reader_t Readers[BUFFER_CIRCULAR_MAX_READERS];
+
+    /* New Data Signal, futex word incremented on every push */
+    _Atomic uint32_t Sequence __attribute__((aligned(BUFFER_CIRCULAR_CACHELINE)));
+    /* Number of consumers sleeping on Sequence, producer skips the wake syscall when zero */
+    _Atomic uint32_t Waiters;
+    /* Set by buffer_circular_close(), waiting readers return instead of sleeping */
+    _Atomic bool Closed;
+
+    /* Producer metrics, written only by the producer */
+    _Atomic uint64_t UnitsIn __attribute__((aligned(BUFFER_CIRCULAR_CACHELINE)));
+    _Atomic uint64_t LossyEvents;
+    _Atomic uint64_t DroppedUnits;
+    _Atomic uint32_t PeakOccupancy;
+    /* Start of the current stall (us), 0 when the producer last got all the space it asked for */
+    uint64_t StallStart;
+    _Atomic uint32_t ProducerWaits[BUFFER_CIRCULAR_HISTOGRAM_BUCKETS];
+
+    /* Default reader metrics, written only by the default reader */
+    _Atomic uint64_t UnitsOut __attribute__((aligned(BUFFER_CIRCULAR_CACHELINE)));
+    _Atomic uint64_t FlushedUnits;
+    _Atomic uint32_t ConsumerWaits[BUFFER_CIRCULAR_HISTOGRAM_BUCKETS];
 } buffer_circular_t;
 
 /** Common functions **/
 bool buffer_circular_init(buffer_circular_t *buffer_ptr, uint32_t unit_size, uint32_t buffer_capacity);
+bool buffer_circular_initMirrored(buffer_circular_t *buffer_ptr, uint32_t unit_size, uint32_t buffer_capacity);
 
 uint32_t buffer_circular_notEmpty(buffer_circular_t *buffer_ptr);
 uint32_t buffer_circular_head(buffer_circular_t *buffer_ptr);
 uint32_t buffer_circular_tail(buffer_circular_t *buffer_ptr);
 void buffer_circular_stats(buffer_circular_t *buffer_ptr, uint32_t *head, uint32_t *tail, uint32_t *capacity, uint32_t *occupied);
 void buffer_circular_flush(buffer_circular_t *buffer_ptr);
+/* Cheap enough to call from any thread at any time, counters are read individually so may be slightly out of step */
+void buffer_circular_metrics(buffer_circular_t *buffer_ptr, buffer_circular_metrics_t *metrics);
+void buffer_circular_metricsPrint(const char *name, buffer_circular_metrics_t *metrics);
 
 void buffer_circular_push(buffer_circular_t *buffer_ptr, void *data, uint32_t *length);
 void buffer_circular_pop(buffer_circular_t *buffer_ptr, uint32_t maxLength, void *data, uint32_t *length);
 void buffer_circular_thresholdPop(buffer_circular_t *buffer_ptr, uint32_t minLength, uint32_t maxLength, void *data, uint32_t *length);
-void buffer_circular_waitPop(buffer_circular_t *buffer_ptr, uint32_t maxLength, void *data, uint32_t *length);
-void buffer_circular_waitThresholdPop(buffer_circular_t *buffer_ptr, uint32_t minLength, uint32_t maxLength, void *data, uint32_t *length);
+/* Wait functions return false (and no data) if the buffer was closed, or the timeout passed, before enough data arrived */
+bool buffer_circular_waitPop(buffer_circular_t *buffer_ptr, uint32_t maxLength, void *data, uint32_t *length);
+bool buffer_circular_waitThresholdPop(buffer_circular_t *buffer_ptr, uint32_t minLength, uint32_t maxLength, void *data, uint32_t *length);
+bool buffer_circular_timedWaitThresholdPop(buffer_circular_t *buffer_ptr, uint32_t minLength, uint32_t maxLength, void *data, uint32_t *length, uint32_t timeout_ms);
+/* Returns the number of whole blockLength blocks copied into data, at most maxBlocks */
+uint32_t buffer_circular_waitBlocksPop(buffer_circular_t *buffer_ptr, uint32_t blockLength, uint32_t maxBlocks, void *data, uint32_t timeout_ms);
+
+void buffer_circular_close(buffer_circular_t *buffer_ptr);
+bool buffer_circular_isClosed(buffer_circular_t *buffer_ptr);
+
+/** Zero-copy functions **/
+/* Producer: spans[0] then spans[1] (Length 0 unless the space crosses the wraparound), returns total length */
+uint32_t buffer_circular_reserve(buffer_circular_t *buffer_ptr, uint32_t maxLength, buffer_circular_span_t spans[2]);
+void buffer_circular_commit(buffer_circular_t *buffer_ptr, uint32_t length);
+/* Producer: records length units that were discarded for lack of space, for producers that don't use push */
+void buffer_circular_drop(buffer_circular_t *buffer_ptr, uint32_t length);
+/* Consumer: as above, data stays in the buffer until released */
+uint32_t buffer_circular_peek(buffer_circular_t *buffer_ptr, uint32_t maxLength, buffer_circular_span_t spans[2]);
+uint32_t buffer_circular_waitThresholdPeek(buffer_circular_t *buffer_ptr, uint32_t minLength, uint32_t maxLength, buffer_circular_span_t spans[2]);
+uint32_t buffer_circular_timedWaitThresholdPeek(buffer_circular_t *buffer_ptr, uint32_t minLength, uint32_t maxLength, buffer_circular_span_t spans[2], uint32_t timeout_ms);
+void buffer_circular_release(buffer_circular_t *buffer_ptr, uint32_t length);
+
+/** Additional Reader functions **/
+/* The default functions above all act on the default reader, these act on an added reader */
+buffer_circular_reader_t *buffer_circular_readerAdd(buffer_circular_t *buffer_ptr, buffer_circular_policy_t policy, uint32_t maxBacklog);
+uint32_t buffer_circular_readerPeek(buffer_circular_t *buffer_ptr, buffer_circular_reader_t *reader_ptr, uint32_t maxLength, buffer_circular_span_t spans[2]);
+uint32_t buffer_circular_readerWaitThresholdPeek(buffer_circular_t *buffer_ptr, buffer_circular_reader_t *reader_ptr, uint32_t minLength, uint32_t maxLength, buffer_circular_span_t spans[2]);
+/* Returns false if a Latest reader was overrun while it was using the spans, the data is then not valid */
+bool buffer_circular_readerRelease(buffer_circular_t *buffer_ptr, buffer_circular_reader_t *reader_ptr, uint32_t length);
 
 /** Declared Buffer Objects **/
-buffer_circular_t buffer_circular_iq_main;
-buffer_circular_t buffer_circular_iq_if;
-buffer_circular_t buffer_circular_audio;
+extern buffer_circular_t buffer_circular_iq_main;
+extern buffer_circular_t buffer_circular_iq_if;
+extern buffer_circular_t buffer_circular_audio;
 
 #endif /* __BUFFER_CIRCULAR_H__ */
@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "dsp.h"
+#include "dsp_fir.h"
+#include "dsp_convert.h"
+#include "dsp_spectrum.h"
+#include "dsp_fft.h"
+
+/* Usable before dsp_init(), so callers never see a NULL kernel */
+dsp_kernels_t dsp_kernels = {
+    .Name = "Scalar",
+    .fir_decimate_cc = dsp_fir_decimate_cc_scalar,
+    .fir_decimate_cc_complex = dsp_fir_decimate_cc_complex_scalar,
+    .convert_ff_s16 = dsp_convert_ff_s16_scalar,
+    .spectrum_db_u8 = dsp_spectrum_db_u8_scalar,
+    .fft_radix4_cc = dsp_fft_radix4_cc_scalar,
+};
+
+#if defined(__ARM_NEON)
+static const dsp_kernels_t dsp_kernels_neon = {
+#if defined(__aarch64__)
+    .Name = "NEON (AArch64)",
+#else
+    .Name = "NEON (AArch32)",
+#endif
+    .fir_decimate_cc = dsp_fir_decimate_cc_neon,
+    .fir_decimate_cc_complex = dsp_fir_decimate_cc_complex_neon,
+    .convert_ff_s16 = dsp_convert_ff_s16_neon,
+    .spectrum_db_u8 = dsp_spectrum_db_u8_neon,
+    .fft_radix4_cc = dsp_fft_radix4_cc_neon,
+};
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+static const dsp_kernels_t dsp_kernels_sse = {
+    .Name = "SSE2",
+    .fir_decimate_cc = dsp_fir_decimate_cc_sse,
+    .fir_decimate_cc_complex = dsp_fir_decimate_cc_complex_sse,
+    .convert_ff_s16 = dsp_convert_ff_s16_sse,
+    .spectrum_db_u8 = dsp_spectrum_db_u8_sse,
+    .fft_radix4_cc = dsp_fft_radix4_cc_sse,
+};
+
+static const dsp_kernels_t dsp_kernels_avx2 = {
+    .Name = "AVX2+FMA",
+    .fir_decimate_cc = dsp_fir_decimate_cc_avx2,
+    .fir_decimate_cc_complex = dsp_fir_decimate_cc_complex_avx2,
+    .convert_ff_s16 = dsp_convert_ff_s16_avx2,
+    .spectrum_db_u8 = dsp_spectrum_db_u8_avx2,
+    .fft_radix4_cc = dsp_fft_radix4_cc_avx2,
+};
+#endif
+
+/* Picks the best kernels this CPU can run, must be called before the DSP threads are started */
+void dsp_init(void)
+{
+#if defined(__ARM_NEON)
+    /* NEON is part of the build target (always on AArch64, -mfpu=neon* on AArch32) */
+    dsp_kernels = dsp_kernels_neon;
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        dsp_kernels = dsp_kernels_avx2;
+    }
+    else if(__builtin_cpu_supports("sse2"))
+    {
+        dsp_kernels = dsp_kernels_sse;
+    }
+#endif
+
+    printf("DSP Kernels: %s\n", dsp_kernels.Name);
+}
@@ -0,0 +1,72 @@
+#ifndef __DSP_H__
+#define __DSP_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../buffer/buffer_circular.h"
+
+/* Tap arrays are padded with zeros to a multiple of this, so kernels never need a scalar tail */
+#define DSP_TAPS_PADDING    8
+/* Alignment of tap arrays and kernel work buffers, enough for a 256-bit vector */
+#define DSP_ALIGNMENT       32
+
+/* Set of kernels for one instruction set, chosen at runtime by dsp_init() */
+typedef struct {
+    const char *Name;
+
+    /* Real-tap FIR decimator. taps_length must be a multiple of DSP_TAPS_PADDING.
+        Returns the number of output samples, (returned * decimation) input samples have been consumed,
+        and the rest must be kept as overlap for the next call. */
+    int (*fir_decimate_cc)(const buffer_iqsample_t *input, buffer_iqsample_t *output, int input_length, int decimation, const float *taps, int taps_length);
+
+    /* As above with complex taps, given as separate real and imaginary arrays */
+    int (*fir_decimate_cc_complex)(const buffer_iqsample_t *input, buffer_iqsample_t *output, int input_length, int decimation, const float *taps_i, const float *taps_q, int taps_length);
+
+    /* Float audio (+-1.0) to S16, saturating, any length */
+    void (*convert_ff_s16)(const float *input, int16_t *output, int length);
+
+    /* Power (times scale) to dB, smoothed into staging, then to clamped display bytes gain * (dB + offset), any length */
+    void (*spectrum_db_u8)(const float *power, float *staging, uint8_t *output, int length, float scale, float smooth, float gain, float offset);
+
+    /* One radix-4 stage of dsp_fft_execute(), in place over length samples in blocks of 4 * quarter */
+    void (*fft_radix4_cc)(buffer_iqsample_t *data, int length, int quarter, const float *twiddles, bool inverse);
+} dsp_kernels_t;
+
+/* Selected kernels, valid after dsp_init() */
+extern dsp_kernels_t dsp_kernels;
+
+void dsp_init(void);
+
+/* Rounds a tap count up to a multiple of DSP_TAPS_PADDING */
+static inline int dsp_taps_padded(int taps_length)
+{
+    return (taps_length + DSP_TAPS_PADDING - 1) & ~(DSP_TAPS_PADDING - 1);
+}
+
+static inline int dsp_fir_decimate_cc(const buffer_iqsample_t *input, buffer_iqsample_t *output, int input_length, int decimation, const float *taps, int taps_length)
+{
+    return dsp_kernels.fir_decimate_cc(input, output, input_length, decimation, taps, taps_length);
+}
+
+static inline int dsp_fir_decimate_cc_complex(const buffer_iqsample_t *input, buffer_iqsample_t *output, int input_length, int decimation, const float *taps_i, const float *taps_q, int taps_length)
+{
+    return dsp_kernels.fir_decimate_cc_complex(input, output, input_length, decimation, taps_i, taps_q, taps_length);
+}
+
+static inline void dsp_convert_ff_s16(const float *input, int16_t *output, int length)
+{
+    dsp_kernels.convert_ff_s16(input, output, length);
+}
+
+static inline void dsp_spectrum_db_u8(const float *power, float *staging, uint8_t *output, int length, float scale, float smooth, float gain, float offset)
+{
+    dsp_kernels.spectrum_db_u8(power, staging, output, length, scale, smooth, gain, offset);
+}
+
+static inline void dsp_fft_radix4_cc(buffer_iqsample_t *data, int length, int quarter, const float *twiddles, bool inverse)
+{
+    dsp_kernels.fft_radix4_cc(data, length, quarter, twiddles, inverse);
+}
+
+#endif /* __DSP_H__ */
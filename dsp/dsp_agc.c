@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "dsp_agc.h"
+
+/*
+    Time constants of the presets (seconds), turned into per control step coefficients for the sample rate:
+
+                attack  decay   hang
+        slow    10ms    1s      20ms    (agc_ff with attack_rate 0.01, decay_rate 0.0001, hang_time 200 at ~10 KHz)
+        fast    10ms    100ms   -
+        hang    10ms    100ms   1s      (holds through pauses in speech, then recovers quickly)
+*/
+typedef struct {
+    const char *name;
+    float attack;
+    float decay;
+    float hang;
+} dsp_agc_preset_t;
+
+static const dsp_agc_preset_t dsp_agc_presets[] = {
+    [DSP_AGC_SLOW] = { "slow", 0.010, 1.0, 0.020 },
+    [DSP_AGC_FAST] = { "fast", 0.010, 0.100, 0.0 },
+    [DSP_AGC_HANG] = { "hang", 0.010, 0.100, 1.0 },
+    [DSP_AGC_OFF] = { "off", 0.0, 0.0, 0.0 }
+};
+
+#define DSP_AGC_PRESETS (int)(sizeof(dsp_agc_presets) / sizeof(dsp_agc_presets[0]))
+
+const char *dsp_agc_mode_name(dsp_agc_mode_t mode)
+{
+    return ((int)mode < DSP_AGC_PRESETS) ? dsp_agc_presets[mode].name : "?";
+}
+
+bool dsp_agc_mode_parse(const char *name, dsp_agc_mode_t *mode)
+{
+    for(int i = 0; i < DSP_AGC_PRESETS; i++)
+    {
+        if(strcmp(name, dsp_agc_presets[i].name) == 0)
+        {
+            *mode = (dsp_agc_mode_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void dsp_agc_init(dsp_agc_t *agc, dsp_agc_mode_t mode, float sample_rate)
+{
+    agc->Detector = DSP_AGC_DETECTOR_PEAK;
+    agc->Reference = 0.2;
+    agc->MaxGain = 65536;
+    agc->ManualGain = 1.0;
+    agc->Gain = 1.0;
+    agc->HangCounter = 0;
+
+    dsp_agc_set_mode(agc, mode, sample_rate);
+}
+
+/* Can be changed between blocks, the gain carries on from where it was */
+void dsp_agc_set_mode(dsp_agc_t *agc, dsp_agc_mode_t mode, float sample_rate)
+{
+    const dsp_agc_preset_t *preset;
+    float step = DSP_AGC_CONTROL_LENGTH / sample_rate;
+
+    if((int)mode >= DSP_AGC_PRESETS)
+    {
+        mode = DSP_AGC_SLOW;
+    }
+    preset = &dsp_agc_presets[mode];
+
+    agc->Mode = mode;
+    agc->Attack = (preset->attack > 0) ? (1.0 - exp(-step / preset->attack)) : 1.0;
+    agc->Decay = (preset->decay > 0) ? (1.0 - exp(-step / preset->decay)) : 1.0;
+    agc->HangSteps = preset->hang / step;
+    agc->HangCounter = 0;
+}
+
+static float dsp_agc_envelope(const dsp_agc_t *agc, const float *input, int length)
+{
+    float envelope;
+    float sum = 0;
+    uint32_t magnitude, peak = 0;
+
+    if(agc->Detector == DSP_AGC_DETECTOR_RMS)
+    {
+        for(int i = 0; i < length; i++)
+        {
+            sum += input[i] * input[i];
+        }
+        return sqrtf(sum / length);
+    }
+
+    /* Non-negative floats order the same as their bit patterns, and an integer max vectorizes where fmaxf() can't (NaN rules) */
+    for(int i = 0; i < length; i++)
+    {
+        memcpy(&magnitude, &input[i], sizeof(magnitude));
+        magnitude &= 0x7fffffff;
+        peak = (magnitude > peak) ? magnitude : peak;
+    }
+    memcpy(&envelope, &peak, sizeof(envelope));
+    return envelope;
+}
+
+/* In place is fine */
+void dsp_agc_execute_ff(dsp_agc_t *agc, const float *input, float *output, int length)
+{
+    float gain = agc->Gain;
+    float target, envelope, gain_step;
+    int segment;
+
+    for(int offset = 0; offset < length; offset += segment)
+    {
+        segment = length - offset;
+        if(segment > DSP_AGC_CONTROL_LENGTH) segment = DSP_AGC_CONTROL_LENGTH;
+
+        if(agc->Mode == DSP_AGC_OFF)
+        {
+            target = agc->ManualGain;
+        }
+        else
+        {
+            /* Silence (or near enough) just lets the gain rise to its limit */
+            envelope = dsp_agc_envelope(agc, &input[offset], segment);
+            target = (envelope * agc->MaxGain > agc->Reference) ? (agc->Reference / envelope) : agc->MaxGain;
+
+            if(target < gain)
+            {
+                /* Increase in signal level, pull the gain down quickly and start the hang */
+                target = gain + ((target - gain) * agc->Attack);
+                agc->HangCounter = agc->HangSteps;
+            }
+            else if(agc->HangCounter > 0)
+            {
+                agc->HangCounter--;
+                target = gain;
+            }
+            else
+            {
+                target = gain + ((target - gain) * agc->Decay);
+            }
+        }
+
+        /* Ramp from the previous gain to the new one across the segment, no steps in the output */
+        gain_step = (target - gain) / segment;
+        for(int i = 0; i < segment; i++)
+        {
+            output[offset + i] = input[offset + i] * (gain + (gain_step * (i + 1)));
+        }
+        gain = target;
+    }
+
+    agc->Gain = gain;
+}
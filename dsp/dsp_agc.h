@@ -0,0 +1,50 @@
+#ifndef __DSP_AGC_H__
+#define __DSP_AGC_H__
+
+#include <stdbool.h>
+
+/* Samples per gain update, the gain is interpolated between updates */
+#define DSP_AGC_CONTROL_LENGTH  16
+
+/* Presets, DSP_AGC_SLOW (0) is the default and matches the original csdr agc_ff settings */
+typedef enum {
+    DSP_AGC_SLOW = 0,
+    DSP_AGC_FAST,
+    DSP_AGC_HANG,
+    DSP_AGC_OFF
+} dsp_agc_mode_t;
+
+typedef enum {
+    DSP_AGC_DETECTOR_PEAK = 0,
+    DSP_AGC_DETECTOR_RMS
+} dsp_agc_detector_t;
+
+/* Block AGC for real audio.
+    Each DSP_AGC_CONTROL_LENGTH samples the envelope (peak or RMS) is measured, the gain steps towards
+    Reference / envelope (Attack when reducing, Decay when increasing after HangSteps), and is ramped
+    linearly across the samples, so there is one divide and one set of branches per control step. */
+typedef struct {
+    dsp_agc_mode_t Mode;
+    dsp_agc_detector_t Detector;
+
+    float Reference;
+    float MaxGain;
+    /* Gain held in DSP_AGC_OFF */
+    float ManualGain;
+
+    /* Per control step, 0 to 1 */
+    float Attack;
+    float Decay;
+    int HangSteps;
+
+    float Gain;
+    int HangCounter;
+} dsp_agc_t;
+
+const char *dsp_agc_mode_name(dsp_agc_mode_t mode);
+bool dsp_agc_mode_parse(const char *name, dsp_agc_mode_t *mode);
+void dsp_agc_init(dsp_agc_t *agc, dsp_agc_mode_t mode, float sample_rate);
+void dsp_agc_set_mode(dsp_agc_t *agc, dsp_agc_mode_t mode, float sample_rate);
+void dsp_agc_execute_ff(dsp_agc_t *agc, const float *input, float *output, int length);
+
+#endif /* __DSP_AGC_H__ */
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <fftw3.h>
+
+#include "dsp_channelizer.h"
+#include "dsp_firdes.h"
+
+/*
+    Channel k is the input mixed down by k * fs / M, lowpass filtered by h and decimated by D = M / 2:
+
+        y_k[n] = sum_l h[l] x[nD - l] e^(-j 2pi k (nD - l) / M)
+               = e^(-j pi k n) sum_m u[m] e^(j 2pi k m / M),    u[m] = sum_p h[m + pM] x[nD - m - pM]
+
+    so every output step is one multiply-and-fold of the last L input samples into M points, one M point
+    inverse FFT for all channels at once, and a sign flip of the odd channels on odd steps.
+    The cost is the same for 1 or M channels.
+*/
+
+_Static_assert(sizeof(buffer_iqsample_t) == sizeof(fftwf_complex), "Error: sizeof(buffer_iqsample_t) == sizeof(fftwf_complex) failed!");
+
+/* passband and stopband are relative to the input rate, the stopband edge sets how far from a channel centre aliases are rejected,
+    attenuation is how far (dB) */
+bool dsp_channelizer_init(dsp_channelizer_t *channelizer, int channels, float passband, float stopband, float attenuation)
+{
+    int length = dsp_window_kaiser_length(stopband - passband, attenuation);
+    float *prototype;
+
+    if(channels < 2 || (channels % 2) != 0)
+    {
+        return false;
+    }
+
+    channelizer->Channels = channels;
+    channelizer->Decimation = channels / 2;
+    channelizer->Step = 0;
+
+    /* Round up to whole polyphase branches, the extra taps are 0 */
+    channelizer->TapsLength = ((length + channels - 1) / channels) * channels;
+    channelizer->Taps = (float *)calloc(channelizer->TapsLength, sizeof(float));
+    prototype = (float *)calloc(channelizer->TapsLength, sizeof(float));
+
+    channelizer->Folded = fft_planner_alloc(channels * sizeof(buffer_iqsample_t));
+    channelizer->Spectrum = fft_planner_alloc(channels * sizeof(buffer_iqsample_t));
+
+    if(channelizer->Taps == NULL || prototype == NULL || channelizer->Folded == NULL || channelizer->Spectrum == NULL)
+    {
+        free(prototype);
+        return false;
+    }
+
+    dsp_firdes_lowpass_kaiser_f(prototype, length, (passband + stopband) / 2, attenuation);
+
+    /* Reversed, so it lines up with the input window oldest sample first */
+    for(int i = 0; i < channelizer->TapsLength; i++)
+    {
+        channelizer->Taps[i] = prototype[channelizer->TapsLength - 1 - i];
+    }
+    free(prototype);
+
+    /* e^(+j ...) above, so a backward transform */
+    return fft_planner_add(&channelizer->Plan, "IF Channelizer", FFT_PLANNER_BACKWARD, channels, channelizer->Folded, channelizer->Spectrum);
+}
+
+/* Input samples needed for steps output samples, the oldest (TapsLength - Decimation) of them are history for the next call */
+int dsp_channelizer_window(dsp_channelizer_t *channelizer, int steps)
+{
+    return channelizer->TapsLength + ((steps - 1) * channelizer->Decimation);
+}
+
+/* Computes steps output samples for each of the selected channels, input must be dsp_channelizer_window() long and steps * Decimation of it is consumed */
+void dsp_channelizer_execute(dsp_channelizer_t *channelizer, const buffer_iqsample_t *input, int steps, const int *channels, int channel_count, buffer_iqsample_t **outputs)
+{
+    const int M = channelizer->Channels;
+    const buffer_iqsample_t *window;
+    float acci[M], accq[M];
+    int k;
+
+    for(int s = 0; s < steps; s++)
+    {
+        window = &input[s * channelizer->Decimation];
+
+        /* Multiply with the reversed prototype and fold the branches, v[r] = sum_q (h * x)[qM + r] */
+        for(int r = 0; r < M; r++)
+        {
+            acci[r] = 0;
+            accq[r] = 0;
+        }
+        for(int q = 0; q < channelizer->TapsLength; q += M)
+        {
+            for(int r = 0; r < M; r++)
+            {
+                acci[r] += window[q + r].i * channelizer->Taps[q + r];
+                accq[r] += window[q + r].q * channelizer->Taps[q + r];
+            }
+        }
+
+        /* u[m] = v[M - 1 - m], as the newest sample is at the end of the window */
+        for(int m = 0; m < M; m++)
+        {
+            channelizer->Folded[m].i = acci[M - 1 - m];
+            channelizer->Folded[m].q = accq[M - 1 - m];
+        }
+
+        fft_planner_execute_dft(&channelizer->Plan, channelizer->Folded, channelizer->Spectrum);
+
+        for(int c = 0; c < channel_count; c++)
+        {
+            k = channels[c];
+            if((channelizer->Step & k & 1) != 0)
+            {
+                outputs[c][s].i = -channelizer->Spectrum[k].i;
+                outputs[c][s].q = -channelizer->Spectrum[k].q;
+            }
+            else
+            {
+                outputs[c][s] = channelizer->Spectrum[k];
+            }
+        }
+
+        channelizer->Step++;
+    }
+}
+
+/* Restarts the output sample count, for input that doesn't follow on from the last call */
+void dsp_channelizer_reset(dsp_channelizer_t *channelizer)
+{
+    channelizer->Step = 0;
+}
@@ -0,0 +1,35 @@
+#ifndef __DSP_CHANNELIZER_H__
+#define __DSP_CHANNELIZER_H__
+
+#include <fftw3.h>
+
+#include "dsp.h"
+#include "../fft_planner.h"
+
+/* Polyphase filterbank channelizer, 2x oversampled.
+    Splits the input into Channels channels spaced (input rate / Channels) apart, channel k centred on k * (input rate / Channels)
+    (k above Channels / 2 are the negative frequencies). Each channel comes out at (2 * input rate / Channels). */
+typedef struct {
+    int Channels;
+    /* Input samples per output sample, Channels / 2 */
+    int Decimation;
+
+    /* Prototype lowpass, a multiple of Channels long and stored reversed */
+    int TapsLength;
+    float *Taps;
+
+    /* Filtered and folded input, then the FFT of it */
+    buffer_iqsample_t *Folded;
+    buffer_iqsample_t *Spectrum;
+    fft_planner_plan_t Plan;
+
+    /* Output sample count, for the phase correction of odd channels */
+    uint32_t Step;
+} dsp_channelizer_t;
+
+bool dsp_channelizer_init(dsp_channelizer_t *channelizer, int channels, float passband, float stopband, float attenuation);
+int dsp_channelizer_window(dsp_channelizer_t *channelizer, int steps);
+void dsp_channelizer_execute(dsp_channelizer_t *channelizer, const buffer_iqsample_t *input, int steps, const int *channels, int channel_count, buffer_iqsample_t **outputs);
+void dsp_channelizer_reset(dsp_channelizer_t *channelizer);
+
+#endif /* __DSP_CHANNELIZER_H__ */
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "dsp_convert.h"
+
+/*
+    Float audio (full scale +-1.0) to S16, saturating, as csdr limit_ff followed by convert_f_s16 in one pass.
+    Scaled by 32767 and truncated towards zero, the same in every kernel.
+*/
+
+#define DSP_CONVERT_SCALE   32767.0f
+
+void dsp_dither_init(dsp_dither_t *dither, uint32_t seed)
+{
+    for(int l = 0; l < DSP_DITHER_LANES; l++)
+    {
+        /* xorshift32 must not start at 0 */
+        dither->State[l] = (seed + (0x9E3779B9u * (l + 1))) | 1;
+    }
+}
+
+/* Adds the dither in place, before the conversion */
+void dsp_dither_tpdf_ff(dsp_dither_t *dither, float *buffer, int length)
+{
+    uint32_t state[DSP_DITHER_LANES];
+    int i, l;
+
+    for(l = 0; l < DSP_DITHER_LANES; l++) state[l] = dither->State[l];
+
+    for(i = 0; i + DSP_DITHER_LANES <= length; i += DSP_DITHER_LANES)
+    {
+        for(l = 0; l < DSP_DITHER_LANES; l++)
+        {
+            state[l] ^= state[l] << 13;
+            state[l] ^= state[l] >> 17;
+            state[l] ^= state[l] << 5;
+            /* High and low halves are the two uniform values, their difference is triangular over +-1 LSB */
+            buffer[i + l] += ((float)(int32_t)((state[l] >> 16) - (state[l] & 0xffff))) * (1.0f / (65536.0f * DSP_CONVERT_SCALE));
+        }
+    }
+    for(l = 0; i < length; i++, l++)
+    {
+        state[l] ^= state[l] << 13;
+        state[l] ^= state[l] >> 17;
+        state[l] ^= state[l] << 5;
+        buffer[i] += ((float)(int32_t)((state[l] >> 16) - (state[l] & 0xffff))) * (1.0f / (65536.0f * DSP_CONVERT_SCALE));
+    }
+
+    for(l = 0; l < DSP_DITHER_LANES; l++) dither->State[l] = state[l];
+}
+
+/* Reference implementation */
+void dsp_convert_ff_s16_scalar(const float *input, int16_t *output, int length)
+{
+    float sample;
+
+    for(int i = 0; i < length; i++)
+    {
+        sample = input[i];
+        sample = (1.0f < sample) ? 1.0f : sample;
+        sample = (-1.0f > sample) ? -1.0f : sample;
+        output[i] = sample * DSP_CONVERT_SCALE;
+    }
+}
+
+#if defined(__ARM_NEON)
+
+/* vcvtq_s32_f32 already saturates (and truncates), vqmovn_s32 saturates again into 16 bits */
+void dsp_convert_ff_s16_neon(const float *input, int16_t *output, int length)
+{
+    const float32x4_t scale = vdupq_n_f32(DSP_CONVERT_SCALE);
+    int32x4_t lo, hi;
+    int i;
+
+    for(i = 0; i + 8 <= length; i += 8)
+    {
+        lo = vcvtq_s32_f32(vmulq_f32(vld1q_f32(&input[i]), scale));
+        hi = vcvtq_s32_f32(vmulq_f32(vld1q_f32(&input[i + 4]), scale));
+        vst1q_s16(&output[i], vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+    }
+
+    dsp_convert_ff_s16_scalar(&input[i], &output[i], length - i);
+}
+
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* Clamped in float first, out of range _mm_cvttps_epi32 gives 0x80000000 whatever the sign. packssdw saturates into 16 bits. */
+__attribute__((target("sse2")))
+void dsp_convert_ff_s16_sse(const float *input, int16_t *output, int length)
+{
+    const __m128 scale = _mm_set1_ps(DSP_CONVERT_SCALE);
+    const __m128 limit_high = _mm_set1_ps(DSP_CONVERT_SCALE);
+    const __m128 limit_low = _mm_set1_ps(-DSP_CONVERT_SCALE);
+    __m128i lo, hi;
+    int i;
+
+    for(i = 0; i + 8 <= length; i += 8)
+    {
+        lo = _mm_cvttps_epi32(_mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(&input[i]), scale), limit_high), limit_low));
+        hi = _mm_cvttps_epi32(_mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(&input[i + 4]), scale), limit_high), limit_low));
+        _mm_storeu_si128((__m128i *)&output[i], _mm_packs_epi32(lo, hi));
+    }
+
+    dsp_convert_ff_s16_scalar(&input[i], &output[i], length - i);
+}
+
+/* As above, 16 samples per iteration. _mm256_packs_epi32 packs within each 128-bit lane, so the result is reordered */
+__attribute__((target("avx2")))
+void dsp_convert_ff_s16_avx2(const float *input, int16_t *output, int length)
+{
+    const __m256 scale = _mm256_set1_ps(DSP_CONVERT_SCALE);
+    const __m256 limit_high = _mm256_set1_ps(DSP_CONVERT_SCALE);
+    const __m256 limit_low = _mm256_set1_ps(-DSP_CONVERT_SCALE);
+    __m256i lo, hi;
+    int i;
+
+    for(i = 0; i + 16 <= length; i += 16)
+    {
+        lo = _mm256_cvttps_epi32(_mm256_max_ps(_mm256_min_ps(_mm256_mul_ps(_mm256_loadu_ps(&input[i]), scale), limit_high), limit_low));
+        hi = _mm256_cvttps_epi32(_mm256_max_ps(_mm256_min_ps(_mm256_mul_ps(_mm256_loadu_ps(&input[i + 8]), scale), limit_high), limit_low));
+        _mm256_storeu_si256((__m256i *)&output[i], _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+
+    dsp_convert_ff_s16_sse(&input[i], &output[i], length - i);
+}
+
+#endif
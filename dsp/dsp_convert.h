@@ -0,0 +1,27 @@
+#ifndef __DSP_CONVERT_H__
+#define __DSP_CONVERT_H__
+
+#include "dsp.h"
+
+/* Independent generator lanes, so the dither loop vectorizes */
+#define DSP_DITHER_LANES    8
+
+/* TPDF dither, +-1 LSB triangular noise from two uniform values per sample (xorshift32 per lane) */
+typedef struct {
+    uint32_t State[DSP_DITHER_LANES];
+} dsp_dither_t;
+
+void dsp_dither_init(dsp_dither_t *dither, uint32_t seed);
+void dsp_dither_tpdf_ff(dsp_dither_t *dither, float *buffer, int length);
+
+/* Per instruction set implementations, only for use by dsp_init() */
+void dsp_convert_ff_s16_scalar(const float *input, int16_t *output, int length);
+#if defined(__ARM_NEON)
+void dsp_convert_ff_s16_neon(const float *input, int16_t *output, int length);
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+void dsp_convert_ff_s16_sse(const float *input, int16_t *output, int length);
+void dsp_convert_ff_s16_avx2(const float *input, int16_t *output, int length);
+#endif
+
+#endif /* __DSP_CONVERT_H__ */
@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "dsp_decimator.h"
+#include "dsp_firdes.h"
+
+/*
+    The 50:1 decimation from 512 ksps is split into stages (e.g. 5 x 5 x 2), each with an anti-alias filter
+    that only needs to protect the final passband, not its own Nyquist band:
+
+        stopband of stage = (stage output rate) - passband
+
+    which gives wide transition bands, and so short filters, in the early high rate stages.
+    Only the last stage has a narrow transition band, but it runs at a low rate.
+    Each filter is Kaiser windowed, as short as it can be for the requested stopband attenuation.
+
+    If cic_order is set, the first stage uses a CIC response instead of a windowed sinc, its nulls sit
+    exactly on the bands that alias onto the passband. It is evaluated as a polyphase FIR, see dsp_firdes_cic_f().
+
+    With dsp_decimator_set_shift() the first stage is also a frequency translating FIR (as GNU Radio's freq_xlating_fir),
+    mixing by e^(j w t) is folded into the taps:
+
+        y[n] = sum_t h[t] x[nD + t] e^(j w (nD + t)) = e^(j w nD) sum_t (h[t] e^(j w t)) x[nD + t]
+
+    so the input is only touched by the complex-tap FIR, and the remaining rotation runs at the stage output rate.
+*/
+
+static bool dsp_decimator_stageInit(dsp_decimator_stage_t *stage, int decimation, int taps_length, uint32_t max_input)
+{
+    void *taps_allocation;
+
+    stage->Decimation = decimation;
+    stage->TapsLength = dsp_taps_padded(taps_length);
+
+    /* Real taps, then the complex taps for frequency translation, each an aligned multiple of DSP_TAPS_PADDING */
+    taps_allocation = malloc((3 * stage->TapsLength * sizeof(float)) + DSP_ALIGNMENT);
+    if(taps_allocation == NULL)
+    {
+        return false;
+    }
+    stage->Taps = (float *)((((uintptr_t)taps_allocation) + DSP_ALIGNMENT - 1) & ~(uintptr_t)(DSP_ALIGNMENT - 1));
+    stage->TapsI = &stage->Taps[stage->TapsLength];
+    stage->TapsQ = &stage->Taps[2 * stage->TapsLength];
+    memset(stage->Taps, 0, 3 * stage->TapsLength * sizeof(float));
+
+    /* Overlap left by the kernel is less than TapsLength + Decimation */
+    return buffer_circular_initMirrored(&stage->Input, sizeof(buffer_iqsample_t), max_input + stage->TapsLength + decimation);
+}
+
+/* passband is relative to the input sampling rate, attenuation is the stopband in dB,
+    max_input is the largest length passed to dsp_decimator_execute() */
+bool dsp_decimator_init(dsp_decimator_t *decimator, const int *factors, int stage_count, float passband, float attenuation, int cic_order, uint32_t max_input)
+{
+    dsp_decimator_stage_t *stage;
+    float input_rate = 1.0;
+    float output_rate, stopband;
+    int taps_length;
+    uint32_t stage_input = max_input;
+
+    if(stage_count < 1 || stage_count > DSP_DECIMATOR_MAX_STAGES)
+    {
+        return false;
+    }
+
+    decimator->StageCount = stage_count;
+    decimator->Decimation = 1;
+    decimator->MaxInput = max_input;
+    decimator->Shift = false;
+
+    for(int s = 0; s < stage_count; s++)
+    {
+        stage = &decimator->Stages[s];
+        output_rate = input_rate / factors[s];
+        stopband = output_rate - passband;
+
+        if(s == 0 && cic_order > 0)
+        {
+            taps_length = dsp_firdes_cic_length(factors[s], cic_order);
+            if(!dsp_decimator_stageInit(stage, factors[s], taps_length, stage_input))
+            {
+                return false;
+            }
+            dsp_firdes_cic_f(stage->Taps, factors[s], cic_order);
+        }
+        else
+        {
+            /* Transition band relative to the stage's own rate, cutoff halfway through it */
+            taps_length = dsp_window_kaiser_length((stopband - passband) / input_rate, attenuation);
+            if(!dsp_decimator_stageInit(stage, factors[s], taps_length, stage_input))
+            {
+                return false;
+            }
+            dsp_firdes_lowpass_kaiser_f(stage->Taps, taps_length, ((passband + stopband) / 2) / input_rate, attenuation);
+        }
+
+        //printf("Decimator stage %d: /%d, %d taps (%d padded)\n", s, factors[s], taps_length, stage->TapsLength);
+
+        /* Outputs from one call, including those completed by the carried-over overlap */
+        stage_input = ((stage_input + stage->TapsLength + stage->Decimation) / stage->Decimation) + 1;
+
+        decimator->Decimation *= factors[s];
+        input_rate = output_rate;
+    }
+
+    decimator->MaxOutput = stage_input;
+    decimator->MaxWindow = max_input + decimator->Stages[0].TapsLength + decimator->Stages[0].Decimation;
+
+    return true;
+}
+
+/* Translates the input by rate (cycles per sample, -0.5 to 0.5) in the first stage, can be changed between calls */
+void dsp_decimator_set_shift(dsp_decimator_t *decimator, double rate)
+{
+    dsp_decimator_stage_t *stage = &decimator->Stages[0];
+    uint32_t increment = (uint32_t)(int64_t)llround(rate * 4294967296.0);
+    double angle;
+
+    if(decimator->Shift && increment == decimator->ShiftIncrement)
+    {
+        return;
+    }
+
+    /* h[t] e^(j w t), exact phases from the same 32-bit accumulator as the rotator */
+    for(int t = 0; t < stage->TapsLength; t++)
+    {
+        angle = (uint32_t)(t * increment) * (2.0 * M_PI / 4294967296.0);
+        stage->TapsI[t] = stage->Taps[t] * cos(angle);
+        stage->TapsQ[t] = stage->Taps[t] * sin(angle);
+    }
+
+    /* e^(j w nD), the phase carries on across rate changes */
+    if(!decimator->Shift)
+    {
+        dsp_nco_init(&decimator->ShiftRotator, 0.0);
+    }
+    dsp_nco_set_increment(&decimator->ShiftRotator, increment * stage->Decimation);
+
+    decimator->ShiftIncrement = increment;
+    decimator->Shift = true;
+}
+
+/* Space for length samples of input, contiguous, to be written before dsp_decimator_execute() */
+buffer_iqsample_t *dsp_decimator_input(dsp_decimator_t *decimator, uint32_t length)
+{
+    buffer_circular_span_t spans[2];
+
+    if(buffer_circular_reserve(&decimator->Stages[0].Input, length, spans) != length)
+    {
+        return NULL;
+    }
+
+    return (buffer_iqsample_t *)spans[0].Data;
+}
+
+/* Runs the stages, the first one from input if given, otherwise all from their own buffers. Returns the first stage's output count in first_length */
+static int dsp_decimator_run(dsp_decimator_t *decimator, const buffer_iqsample_t *input, uint32_t input_length, buffer_iqsample_t *output, int *first_length)
+{
+    dsp_decimator_stage_t *stage;
+    buffer_circular_span_t input_spans[2];
+    buffer_circular_span_t output_spans[2];
+    const buffer_iqsample_t *stage_input;
+    buffer_iqsample_t *stage_output;
+    int output_length = 0;
+
+    for(int s = 0; s < decimator->StageCount; s++)
+    {
+        stage = &decimator->Stages[s];
+
+        if(s == 0 && input != NULL)
+        {
+            stage_input = input;
+        }
+        else
+        {
+            input_length = buffer_circular_peek(&stage->Input, stage->Input.Capacity, input_spans);
+            stage_input = input_spans[0].Data;
+        }
+
+        if(s < (decimator->StageCount - 1))
+        {
+            /* Next stage is sized at init so that this always fits */
+            buffer_circular_reserve(&decimator->Stages[s + 1].Input, (input_length / stage->Decimation) + 1, output_spans);
+            stage_output = (buffer_iqsample_t *)output_spans[0].Data;
+        }
+        else
+        {
+            stage_output = output;
+        }
+
+        if(s == 0 && decimator->Shift)
+        {
+            output_length = dsp_fir_decimate_cc_complex(stage_input, stage_output, input_length, stage->Decimation, stage->TapsI, stage->TapsQ, stage->TapsLength);
+            dsp_nco_mix_cc(&decimator->ShiftRotator, stage_output, stage_output, output_length);
+        }
+        else
+        {
+            output_length = dsp_fir_decimate_cc(stage_input, stage_output, input_length, stage->Decimation, stage->Taps, stage->TapsLength);
+        }
+
+        if(s == 0)
+        {
+            *first_length = output_length;
+        }
+        if(s > 0 || input == NULL)
+        {
+            /* Leave the overlap in the buffer for the next call */
+            buffer_circular_release(&stage->Input, output_length * stage->Decimation);
+        }
+
+        if(s < (decimator->StageCount - 1))
+        {
+            buffer_circular_commit(&decimator->Stages[s + 1].Input, output_length);
+        }
+    }
+
+    return output_length;
+}
+
+/* Runs all stages over length new input samples, returns the number of samples written to output */
+int dsp_decimator_execute(dsp_decimator_t *decimator, uint32_t length, buffer_iqsample_t *output)
+{
+    int first_length;
+
+    buffer_circular_commit(&decimator->Stages[0].Input, length);
+
+    return dsp_decimator_run(decimator, NULL, 0, output, &first_length);
+}
+
+/* As dsp_decimator_execute(), but the first stage reads straight from the caller's input (at most MaxWindow long).
+    The caller keeps the overlap, *consumed is how much of input can be released. */
+int dsp_decimator_process(dsp_decimator_t *decimator, const buffer_iqsample_t *input, uint32_t input_length, buffer_iqsample_t *output, uint32_t *consumed)
+{
+    int first_length;
+    int output_length = dsp_decimator_run(decimator, input, input_length, output, &first_length);
+
+    *consumed = first_length * decimator->Stages[0].Decimation;
+
+    return output_length;
+}
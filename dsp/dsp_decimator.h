@@ -0,0 +1,48 @@
+#ifndef __DSP_DECIMATOR_H__
+#define __DSP_DECIMATOR_H__
+
+#include "dsp.h"
+#include "dsp_nco.h"
+
+#define DSP_DECIMATOR_MAX_STAGES    4
+
+typedef struct {
+    int Decimation;
+    /* Padded to DSP_TAPS_PADDING */
+    int TapsLength;
+    float *Taps;
+    /* Complex taps, only used by a frequency translating first stage */
+    float *TapsI;
+    float *TapsQ;
+
+    /* Mirrored, so the kernel always sees the input including the overlap from the last call as one window */
+    buffer_circular_t Input;
+} dsp_decimator_stage_t;
+
+/* Multistage decimator, each stage only computes the output samples it keeps.
+    The stages write straight into the input of the next one. */
+typedef struct {
+    int StageCount;
+    dsp_decimator_stage_t Stages[DSP_DECIMATOR_MAX_STAGES];
+
+    /* Overall decimation */
+    int Decimation;
+    uint32_t MaxInput;
+    /* Output buffer size needed by dsp_decimator_execute() */
+    uint32_t MaxOutput;
+    /* Largest input for dsp_decimator_process(), MaxInput plus the overlap */
+    uint32_t MaxWindow;
+
+    /* Frequency translation in the first stage */
+    bool Shift;
+    uint32_t ShiftIncrement;
+    dsp_nco_t ShiftRotator;
+} dsp_decimator_t;
+
+bool dsp_decimator_init(dsp_decimator_t *decimator, const int *factors, int stage_count, float passband, float attenuation, int cic_order, uint32_t max_input);
+buffer_iqsample_t *dsp_decimator_input(dsp_decimator_t *decimator, uint32_t length);
+void dsp_decimator_set_shift(dsp_decimator_t *decimator, double rate);
+int dsp_decimator_execute(dsp_decimator_t *decimator, uint32_t length, buffer_iqsample_t *output);
+int dsp_decimator_process(dsp_decimator_t *decimator, const buffer_iqsample_t *input, uint32_t input_length, buffer_iqsample_t *output, uint32_t *consumed);
+
+#endif /* __DSP_DECIMATOR_H__ */
@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <fftw3.h>
+
+#include "dsp_fastconv.h"
+#include "dsp_firdes.h"
+
+/*
+    Overlap-save: each block is FftSize input samples, of which the first (TapsLength - 1) are the history.
+    The filtered block is Spectrum * H, and decimating the result by D in time is the same as an inverse FFT
+    of FftSize / D points over the bins within the output band:
+
+        y[mD] = 1/N sum_k Y[k] e^(j 2pi k mD / N) = 1/N sum_k Y[k] e^(j 2pi k m / (N / D))
+
+    Picking the bins around bin k0 instead of around 0 shifts the signal by k0 bins for free,
+    as mixing by e^(-j 2pi k0 n / N) relative to the block start. Blocks start Hop apart,
+    so each block is also rotated by e^(-j 2pi k0 (block start) / N) to keep the phase continuous.
+*/
+
+_Static_assert(sizeof(buffer_iqsample_t) == sizeof(fftwf_complex), "Error: sizeof(buffer_iqsample_t) == sizeof(fftwf_complex) failed!");
+
+/* passband and stopband are relative to the input rate, attenuation is the stopband in dB, fft_size must be a multiple of decimation */
+bool dsp_fastconv_init(dsp_fastconv_t *fastconv, int decimation, int fft_size, float passband, float stopband, float attenuation)
+{
+    buffer_iqsample_t *taps, *response;
+    float *realtaps;
+    bool ok = true;
+    int j, k;
+
+    if((fft_size % decimation) != 0)
+    {
+        return false;
+    }
+
+    fastconv->FftSize = fft_size;
+    fastconv->Decimation = decimation;
+    fastconv->OutputSize = fft_size / decimation;
+    fastconv->TapsLength = dsp_window_kaiser_length(stopband - passband, attenuation);
+
+    if(fastconv->TapsLength >= (fft_size - decimation))
+    {
+        fprintf(stderr, "DSP Fastconv: Error: %d taps don't fit in a %d point FFT\n", fastconv->TapsLength, fft_size);
+        return false;
+    }
+
+    fastconv->HopOutput = (fft_size - (fastconv->TapsLength - 1)) / decimation;
+    fastconv->Hop = fastconv->HopOutput * decimation;
+    fastconv->MaxOutput = fastconv->HopOutput;
+
+    fastconv->ShiftBins = 0;
+    fastconv->BlockPhase = 0;
+    dsp_nco_init(&fastconv->Fine, 0.0);
+
+    fastconv->Response = fft_planner_alloc(fastconv->OutputSize * sizeof(buffer_iqsample_t));
+    fastconv->Input = fft_planner_alloc(fft_size * sizeof(buffer_iqsample_t));
+    fastconv->Spectrum = fft_planner_alloc(fft_size * sizeof(buffer_iqsample_t));
+    fastconv->Selected = fft_planner_alloc(fastconv->OutputSize * sizeof(buffer_iqsample_t));
+    fastconv->Output = fft_planner_alloc(fastconv->OutputSize * sizeof(buffer_iqsample_t));
+
+    /* Filter response, only needed once */
+    taps = fft_planner_alloc(fft_size * sizeof(buffer_iqsample_t));
+    response = fft_planner_alloc(fft_size * sizeof(buffer_iqsample_t));
+    realtaps = (float *)malloc(fastconv->TapsLength * sizeof(float));
+
+    /* Same transform and buffer layout as the blocks, so the taps go through the Forward plan too */
+    if(fastconv->Response == NULL || fastconv->Input == NULL || fastconv->Spectrum == NULL || fastconv->Selected == NULL
+        || fastconv->Output == NULL || taps == NULL || response == NULL || realtaps == NULL
+        || !fft_planner_add(&fastconv->Forward, "IF Fastconv Forward", FFT_PLANNER_FORWARD, fft_size, fastconv->Input, fastconv->Spectrum)
+        || !fft_planner_add(&fastconv->Inverse, "IF Fastconv Inverse", FFT_PLANNER_BACKWARD, fastconv->OutputSize, fastconv->Selected, fastconv->Output))
+    {
+        ok = false;
+    }
+    else
+    {
+        dsp_firdes_lowpass_kaiser_f(realtaps, fastconv->TapsLength, (passband + stopband) / 2, attenuation);
+        memset(taps, 0, fft_size * sizeof(buffer_iqsample_t));
+        for(int i = 0; i < fastconv->TapsLength; i++)
+        {
+            taps[i].i = realtaps[i];
+        }
+        fft_planner_execute_dft(&fastconv->Forward, taps, response);
+
+        /* Inverse FFT bin j is frequency bin k = j for the positive half, k = j - OutputSize (mod FftSize) for the negative */
+        for(j = 0; j < fastconv->OutputSize; j++)
+        {
+            k = (j < (fastconv->OutputSize / 2)) ? j : (fft_size - fastconv->OutputSize + j);
+            fastconv->Response[j].i = response[k].i / fft_size;
+            fastconv->Response[j].q = response[k].q / fft_size;
+        }
+    }
+
+    fft_planner_free(taps);
+    fft_planner_free(response);
+    free(realtaps);
+
+    if(!ok)
+    {
+        fft_planner_free(fastconv->Response);
+        fft_planner_free(fastconv->Input);
+        fft_planner_free(fastconv->Spectrum);
+        fft_planner_free(fastconv->Selected);
+        fft_planner_free(fastconv->Output);
+        fastconv->Response = fastconv->Input = fastconv->Spectrum = fastconv->Selected = fastconv->Output = NULL;
+    }
+
+    return ok;
+}
+
+/* Mixes the input by e^(j 2pi rate n) before filtering, rate in cycles per sample, -0.5 to 0.5 */
+void dsp_fastconv_set_shift(dsp_fastconv_t *fastconv, double rate)
+{
+    /* The signal brought to 0 is at -rate, nearest bin to that and the rest at the output rate */
+    fastconv->ShiftBins = (int)lround(-rate * fastconv->FftSize);
+    dsp_nco_set_rate(&fastconv->Fine, (rate + ((double)fastconv->ShiftBins / fastconv->FftSize)) * fastconv->Decimation);
+}
+
+/* Filters one block if at least FftSize input samples are given, *consumed is how much of input can be released */
+int dsp_fastconv_process(dsp_fastconv_t *fastconv, const buffer_iqsample_t *input, uint32_t input_length, buffer_iqsample_t *output, uint32_t *consumed)
+{
+    const int N = fastconv->FftSize;
+    const int M = fastconv->OutputSize;
+    const int first_valid = M - fastconv->HopOutput;
+    float block_cos, block_sin;
+    buffer_iqsample_t *bin;
+    int j, k;
+
+    *consumed = 0;
+    if(input_length < (uint32_t)N)
+    {
+        return 0;
+    }
+
+    memcpy(fastconv->Input, input, N * sizeof(buffer_iqsample_t));
+    fft_planner_execute_dft(&fastconv->Forward, fastconv->Input, fastconv->Spectrum);
+
+    /* Only the bins around the wanted frequency are filtered, the phase correction for this block start is folded in */
+    block_cos = cos(2.0 * M_PI * fastconv->BlockPhase / N);
+    block_sin = -sin(2.0 * M_PI * fastconv->BlockPhase / N);
+    for(j = 0; j < M; j++)
+    {
+        k = (j < (M / 2)) ? j : (j - M);
+        k = (k + fastconv->ShiftBins) % N;
+        if(k < 0) k += N;
+        bin = &fastconv->Spectrum[k];
+
+        float filtered_i = (bin->i * fastconv->Response[j].i) - (bin->q * fastconv->Response[j].q);
+        float filtered_q = (bin->i * fastconv->Response[j].q) + (bin->q * fastconv->Response[j].i);
+        fastconv->Selected[j].i = (filtered_i * block_cos) - (filtered_q * block_sin);
+        fastconv->Selected[j].q = (filtered_i * block_sin) + (filtered_q * block_cos);
+    }
+
+    fft_planner_execute_dft(&fastconv->Inverse, fastconv->Selected, fastconv->Output);
+
+    /* The first outputs are wrapped around by the circular convolution, the rest is this block's */
+    dsp_nco_mix_cc(&fastconv->Fine, &fastconv->Output[first_valid], output, fastconv->HopOutput);
+
+    fastconv->BlockPhase = (fastconv->BlockPhase + ((int64_t)fastconv->ShiftBins * fastconv->Hop)) % N;
+
+    *consumed = fastconv->Hop;
+    return fastconv->HopOutput;
+}
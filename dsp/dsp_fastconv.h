@@ -0,0 +1,46 @@
+#ifndef __DSP_FASTCONV_H__
+#define __DSP_FASTCONV_H__
+
+#include <fftw3.h>
+
+#include "dsp.h"
+#include "../fft_planner.h"
+#include "dsp_nco.h"
+
+/* Overlap-save fast convolution decimator.
+    Filters in the frequency domain, and only inverse transforms the OutputSize bins around the wanted frequency,
+    so the cost barely depends on the filter length. Same calling convention as dsp_decimator_process(). */
+typedef struct {
+    int FftSize;
+    int Decimation;
+    /* FftSize / Decimation, the inverse FFT size */
+    int OutputSize;
+    int TapsLength;
+    /* Input samples consumed per block, a multiple of Decimation, and the output samples it gives */
+    int Hop;
+    int HopOutput;
+
+    /* Filter response at the OutputSize bins kept, in inverse FFT order, scaled by 1 / FftSize */
+    buffer_iqsample_t *Response;
+
+    buffer_iqsample_t *Input;
+    buffer_iqsample_t *Spectrum;
+    buffer_iqsample_t *Selected;
+    buffer_iqsample_t *Output;
+    fft_planner_plan_t Forward;
+    fft_planner_plan_t Inverse;
+
+    /* Shift, whole bins in the frequency domain and the rest with an NCO at the output rate */
+    int ShiftBins;
+    /* Block start (mod FftSize) times ShiftBins, for the phase correction between blocks */
+    int64_t BlockPhase;
+    dsp_nco_t Fine;
+
+    uint32_t MaxOutput;
+} dsp_fastconv_t;
+
+bool dsp_fastconv_init(dsp_fastconv_t *fastconv, int decimation, int fft_size, float passband, float stopband, float attenuation);
+void dsp_fastconv_set_shift(dsp_fastconv_t *fastconv, double rate);
+int dsp_fastconv_process(dsp_fastconv_t *fastconv, const buffer_iqsample_t *input, uint32_t input_length, buffer_iqsample_t *output, uint32_t *consumed);
+
+#endif /* __DSP_FASTCONV_H__ */
@@ -0,0 +1,395 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "dsp_fft.h"
+
+/*
+    Two radix-2 DIT stages of half-size q and 2q, over x0..x3 = X[j], X[j + q], X[j + 2q], X[j + 3q], fused:
+
+        a = x0,  b = W(2q)^j x1,  c = W(4q)^j x2,  d = W(4q)^3j x3
+
+        Y0 = (a + b) + (c + d)          Y1 = (a - b) - j (c - d)
+        Y2 = (a + b) - (c + d)          Y3 = (a - b) + j (c - d)
+
+    with W(n) = e^(-j 2pi / n). The inverse has conjugated twiddles, and +j in Y1, so Y1 and Y3 just swap places.
+    The twiddles of a stage are stored as W(2q)^j, then W(4q)^j, then W(4q)^3j, each q long and interleaved re, im,
+    so the vector kernels load them like the data.
+*/
+
+bool dsp_fft_init(dsp_fft_t *fft, int size, bool inverse)
+{
+    const double sign = inverse ? 1.0 : -1.0;
+    float *twiddles;
+    int bits, quarter, j, r;
+
+    if(size < 2 || (size & (size - 1)) != 0)
+    {
+        return false;
+    }
+
+    for(bits = 0; (1 << bits) < size; bits++);
+
+    fft->Size = size;
+    fft->Inverse = inverse;
+    fft->Radix2 = (bits % 2) != 0;
+
+    fft->Reverse = (int *)malloc(size * sizeof(int));
+    fft->Twiddles = (float *)malloc(2 * size * sizeof(float));
+    if(fft->Reverse == NULL || fft->Twiddles == NULL)
+    {
+        dsp_fft_free(fft);
+        return false;
+    }
+
+    for(int i = 0; i < size; i++)
+    {
+        for(r = 0, j = 0; j < bits; j++)
+        {
+            r |= ((i >> j) & 1) << (bits - 1 - j);
+        }
+        fft->Reverse[i] = r;
+    }
+
+    /* Sum of 3 * quarter over the stages stays under size */
+    twiddles = fft->Twiddles;
+    for(quarter = fft->Radix2 ? 2 : 1; (4 * quarter) <= size; quarter *= 4)
+    {
+        for(j = 0; j < quarter; j++)
+        {
+            twiddles[2 * j] = cos(sign * M_PI * j / quarter);
+            twiddles[(2 * j) + 1] = sin(sign * M_PI * j / quarter);
+            twiddles[2 * (quarter + j)] = cos(sign * M_PI * j / (2 * quarter));
+            twiddles[(2 * (quarter + j)) + 1] = sin(sign * M_PI * j / (2 * quarter));
+            twiddles[2 * ((2 * quarter) + j)] = cos(sign * M_PI * 3 * j / (2 * quarter));
+            twiddles[(2 * ((2 * quarter) + j)) + 1] = sin(sign * M_PI * 3 * j / (2 * quarter));
+        }
+        twiddles += 2 * 3 * quarter;
+    }
+
+    return true;
+}
+
+/* input may be output, fft is only read so one can be shared between threads */
+void dsp_fft_execute(const dsp_fft_t *fft, const buffer_iqsample_t *input, buffer_iqsample_t *output)
+{
+    const float *twiddles = fft->Twiddles;
+    buffer_iqsample_t a, b;
+    int quarter, r;
+
+    if(input == output)
+    {
+        for(int i = 0; i < fft->Size; i++)
+        {
+            r = fft->Reverse[i];
+            if(i < r)
+            {
+                a = output[i];
+                output[i] = output[r];
+                output[r] = a;
+            }
+        }
+    }
+    else
+    {
+        for(int i = 0; i < fft->Size; i++)
+        {
+            output[fft->Reverse[i]] = input[i];
+        }
+    }
+
+    if(fft->Radix2)
+    {
+        for(int i = 0; i < fft->Size; i += 2)
+        {
+            a = output[i];
+            b = output[i + 1];
+            output[i].i = a.i + b.i;
+            output[i].q = a.q + b.q;
+            output[i + 1].i = a.i - b.i;
+            output[i + 1].q = a.q - b.q;
+        }
+    }
+
+    for(quarter = fft->Radix2 ? 2 : 1; (4 * quarter) <= fft->Size; quarter *= 4)
+    {
+        dsp_fft_radix4_cc(output, fft->Size, quarter, twiddles, fft->Inverse);
+        twiddles += 2 * 3 * quarter;
+    }
+}
+
+void dsp_fft_free(dsp_fft_t *fft)
+{
+    free(fft->Reverse);
+    free(fft->Twiddles);
+    fft->Reverse = NULL;
+    fft->Twiddles = NULL;
+}
+
+void dsp_fft_radix4_cc_scalar(buffer_iqsample_t *data, int length, int quarter, const float *twiddles, bool inverse)
+{
+    const int o1 = inverse ? (3 * quarter) : quarter;
+    const int o3 = inverse ? quarter : (3 * quarter);
+    const float *w1 = twiddles;
+    const float *w2 = &twiddles[2 * quarter];
+    const float *w3 = &twiddles[4 * quarter];
+    float ai, aq, bi, bq, ci, cq, di, dq;
+    float s0i, s0q, s1i, s1q, d0i, d0q, d1i, d1q;
+    buffer_iqsample_t *x;
+
+    for(int s = 0; s < length; s += 4 * quarter)
+    {
+        x = &data[s];
+        for(int j = 0; j < quarter; j++)
+        {
+            ai = x[j].i;
+            aq = x[j].q;
+            bi = (x[j + quarter].i * w1[2 * j]) - (x[j + quarter].q * w1[(2 * j) + 1]);
+            bq = (x[j + quarter].i * w1[(2 * j) + 1]) + (x[j + quarter].q * w1[2 * j]);
+            ci = (x[j + (2 * quarter)].i * w2[2 * j]) - (x[j + (2 * quarter)].q * w2[(2 * j) + 1]);
+            cq = (x[j + (2 * quarter)].i * w2[(2 * j) + 1]) + (x[j + (2 * quarter)].q * w2[2 * j]);
+            di = (x[j + (3 * quarter)].i * w3[2 * j]) - (x[j + (3 * quarter)].q * w3[(2 * j) + 1]);
+            dq = (x[j + (3 * quarter)].i * w3[(2 * j) + 1]) + (x[j + (3 * quarter)].q * w3[2 * j]);
+
+            s0i = ai + bi;
+            s0q = aq + bq;
+            d0i = ai - bi;
+            d0q = aq - bq;
+            s1i = ci + di;
+            s1q = cq + dq;
+            d1i = ci - di;
+            d1q = cq - dq;
+
+            x[j].i = s0i + s1i;
+            x[j].q = s0q + s1q;
+            x[j + (2 * quarter)].i = s0i - s1i;
+            x[j + (2 * quarter)].q = s0q - s1q;
+            /* -j (c - d) = (d1q, -d1i) */
+            x[j + o1].i = d0i + d1q;
+            x[j + o1].q = d0q - d1i;
+            x[j + o3].i = d0i - d1q;
+            x[j + o3].q = d0q + d1i;
+        }
+    }
+}
+
+#if defined(__ARM_NEON)
+
+/* 4 butterflies per iteration, vld2q/vst2q split the interleaved samples into real and imaginary vectors */
+void dsp_fft_radix4_cc_neon(buffer_iqsample_t *data, int length, int quarter, const float *twiddles, bool inverse)
+{
+    const int o1 = inverse ? (3 * quarter) : quarter;
+    const int o3 = inverse ? quarter : (3 * quarter);
+    float32x4x2_t x0, x1, x2, x3, w, y;
+    float32x4_t bi, bq, ci, cq, di, dq, s0i, s0q, d0i, d0q, s1i, s1q, d1i, d1q;
+    float *x;
+    int j;
+
+    if(quarter < 4)
+    {
+        dsp_fft_radix4_cc_scalar(data, length, quarter, twiddles, inverse);
+        return;
+    }
+
+    for(int s = 0; s < length; s += 4 * quarter)
+    {
+        x = (float *)&data[s];
+        for(j = 0; j < quarter; j += 4)
+        {
+            x0 = vld2q_f32(&x[2 * j]);
+            x1 = vld2q_f32(&x[2 * (j + quarter)]);
+            x2 = vld2q_f32(&x[2 * (j + (2 * quarter))]);
+            x3 = vld2q_f32(&x[2 * (j + (3 * quarter))]);
+
+            w = vld2q_f32(&twiddles[2 * j]);
+            bi = vmlsq_f32(vmulq_f32(x1.val[0], w.val[0]), x1.val[1], w.val[1]);
+            bq = vmlaq_f32(vmulq_f32(x1.val[0], w.val[1]), x1.val[1], w.val[0]);
+            w = vld2q_f32(&twiddles[2 * (quarter + j)]);
+            ci = vmlsq_f32(vmulq_f32(x2.val[0], w.val[0]), x2.val[1], w.val[1]);
+            cq = vmlaq_f32(vmulq_f32(x2.val[0], w.val[1]), x2.val[1], w.val[0]);
+            w = vld2q_f32(&twiddles[2 * ((2 * quarter) + j)]);
+            di = vmlsq_f32(vmulq_f32(x3.val[0], w.val[0]), x3.val[1], w.val[1]);
+            dq = vmlaq_f32(vmulq_f32(x3.val[0], w.val[1]), x3.val[1], w.val[0]);
+
+            s0i = vaddq_f32(x0.val[0], bi);
+            s0q = vaddq_f32(x0.val[1], bq);
+            d0i = vsubq_f32(x0.val[0], bi);
+            d0q = vsubq_f32(x0.val[1], bq);
+            s1i = vaddq_f32(ci, di);
+            s1q = vaddq_f32(cq, dq);
+            d1i = vsubq_f32(ci, di);
+            d1q = vsubq_f32(cq, dq);
+
+            y.val[0] = vaddq_f32(s0i, s1i);
+            y.val[1] = vaddq_f32(s0q, s1q);
+            vst2q_f32(&x[2 * j], y);
+            y.val[0] = vsubq_f32(s0i, s1i);
+            y.val[1] = vsubq_f32(s0q, s1q);
+            vst2q_f32(&x[2 * (j + (2 * quarter))], y);
+            y.val[0] = vaddq_f32(d0i, d1q);
+            y.val[1] = vsubq_f32(d0q, d1i);
+            vst2q_f32(&x[2 * (j + o1)], y);
+            y.val[0] = vsubq_f32(d0i, d1q);
+            y.val[1] = vaddq_f32(d0q, d1i);
+            vst2q_f32(&x[2 * (j + o3)], y);
+        }
+    }
+}
+
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* 4 samples to real and imaginary vectors, in the order [0 1 2 3]. Stored back the same way, so no lane order matters */
+__attribute__((target("sse2")))
+static inline void dsp_fft_load_sse(const float *x, __m128 *re, __m128 *im)
+{
+    __m128 lo = _mm_loadu_ps(x);
+    __m128 hi = _mm_loadu_ps(&x[4]);
+
+    *re = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+    *im = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+}
+
+__attribute__((target("sse2")))
+static inline void dsp_fft_store_sse(float *x, __m128 re, __m128 im)
+{
+    _mm_storeu_ps(x, _mm_unpacklo_ps(re, im));
+    _mm_storeu_ps(&x[4], _mm_unpackhi_ps(re, im));
+}
+
+/* 4 butterflies per iteration */
+__attribute__((target("sse2")))
+void dsp_fft_radix4_cc_sse(buffer_iqsample_t *data, int length, int quarter, const float *twiddles, bool inverse)
+{
+    const int o1 = inverse ? (3 * quarter) : quarter;
+    const int o3 = inverse ? quarter : (3 * quarter);
+    __m128 ai, aq, xi, xq, wi, wq, bi, bq, ci, cq, di, dq, s0i, s0q, d0i, d0q, s1i, s1q, d1i, d1q;
+    float *x;
+    int j;
+
+    if(quarter < 4)
+    {
+        dsp_fft_radix4_cc_scalar(data, length, quarter, twiddles, inverse);
+        return;
+    }
+
+    for(int s = 0; s < length; s += 4 * quarter)
+    {
+        x = (float *)&data[s];
+        for(j = 0; j < quarter; j += 4)
+        {
+            dsp_fft_load_sse(&x[2 * j], &ai, &aq);
+
+            dsp_fft_load_sse(&x[2 * (j + quarter)], &xi, &xq);
+            dsp_fft_load_sse(&twiddles[2 * j], &wi, &wq);
+            bi = _mm_sub_ps(_mm_mul_ps(xi, wi), _mm_mul_ps(xq, wq));
+            bq = _mm_add_ps(_mm_mul_ps(xi, wq), _mm_mul_ps(xq, wi));
+            dsp_fft_load_sse(&x[2 * (j + (2 * quarter))], &xi, &xq);
+            dsp_fft_load_sse(&twiddles[2 * (quarter + j)], &wi, &wq);
+            ci = _mm_sub_ps(_mm_mul_ps(xi, wi), _mm_mul_ps(xq, wq));
+            cq = _mm_add_ps(_mm_mul_ps(xi, wq), _mm_mul_ps(xq, wi));
+            dsp_fft_load_sse(&x[2 * (j + (3 * quarter))], &xi, &xq);
+            dsp_fft_load_sse(&twiddles[2 * ((2 * quarter) + j)], &wi, &wq);
+            di = _mm_sub_ps(_mm_mul_ps(xi, wi), _mm_mul_ps(xq, wq));
+            dq = _mm_add_ps(_mm_mul_ps(xi, wq), _mm_mul_ps(xq, wi));
+
+            s0i = _mm_add_ps(ai, bi);
+            s0q = _mm_add_ps(aq, bq);
+            d0i = _mm_sub_ps(ai, bi);
+            d0q = _mm_sub_ps(aq, bq);
+            s1i = _mm_add_ps(ci, di);
+            s1q = _mm_add_ps(cq, dq);
+            d1i = _mm_sub_ps(ci, di);
+            d1q = _mm_sub_ps(cq, dq);
+
+            dsp_fft_store_sse(&x[2 * j], _mm_add_ps(s0i, s1i), _mm_add_ps(s0q, s1q));
+            dsp_fft_store_sse(&x[2 * (j + (2 * quarter))], _mm_sub_ps(s0i, s1i), _mm_sub_ps(s0q, s1q));
+            dsp_fft_store_sse(&x[2 * (j + o1)], _mm_add_ps(d0i, d1q), _mm_sub_ps(d0q, d1i));
+            dsp_fft_store_sse(&x[2 * (j + o3)], _mm_sub_ps(d0i, d1q), _mm_add_ps(d0q, d1i));
+        }
+    }
+}
+
+/* 8 samples, the shuffles work within 128-bit lanes so the order is [0 1 4 5 | 2 3 6 7], undone by the store */
+__attribute__((target("avx2,fma")))
+static inline void dsp_fft_load_avx2(const float *x, __m256 *re, __m256 *im)
+{
+    __m256 lo = _mm256_loadu_ps(x);
+    __m256 hi = _mm256_loadu_ps(&x[8]);
+
+    *re = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+    *im = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+}
+
+__attribute__((target("avx2,fma")))
+static inline void dsp_fft_store_avx2(float *x, __m256 re, __m256 im)
+{
+    _mm256_storeu_ps(x, _mm256_unpacklo_ps(re, im));
+    _mm256_storeu_ps(&x[8], _mm256_unpackhi_ps(re, im));
+}
+
+/* 8 butterflies per iteration, smaller stages go to the SSE2 kernel */
+__attribute__((target("avx2,fma")))
+void dsp_fft_radix4_cc_avx2(buffer_iqsample_t *data, int length, int quarter, const float *twiddles, bool inverse)
+{
+    const int o1 = inverse ? (3 * quarter) : quarter;
+    const int o3 = inverse ? quarter : (3 * quarter);
+    __m256 ai, aq, xi, xq, wi, wq, bi, bq, ci, cq, di, dq, s0i, s0q, d0i, d0q, s1i, s1q, d1i, d1q;
+    float *x;
+    int j;
+
+    if(quarter < 8)
+    {
+        dsp_fft_radix4_cc_sse(data, length, quarter, twiddles, inverse);
+        return;
+    }
+
+    for(int s = 0; s < length; s += 4 * quarter)
+    {
+        x = (float *)&data[s];
+        for(j = 0; j < quarter; j += 8)
+        {
+            dsp_fft_load_avx2(&x[2 * j], &ai, &aq);
+
+            dsp_fft_load_avx2(&x[2 * (j + quarter)], &xi, &xq);
+            dsp_fft_load_avx2(&twiddles[2 * j], &wi, &wq);
+            bi = _mm256_fmsub_ps(xi, wi, _mm256_mul_ps(xq, wq));
+            bq = _mm256_fmadd_ps(xi, wq, _mm256_mul_ps(xq, wi));
+            dsp_fft_load_avx2(&x[2 * (j + (2 * quarter))], &xi, &xq);
+            dsp_fft_load_avx2(&twiddles[2 * (quarter + j)], &wi, &wq);
+            ci = _mm256_fmsub_ps(xi, wi, _mm256_mul_ps(xq, wq));
+            cq = _mm256_fmadd_ps(xi, wq, _mm256_mul_ps(xq, wi));
+            dsp_fft_load_avx2(&x[2 * (j + (3 * quarter))], &xi, &xq);
+            dsp_fft_load_avx2(&twiddles[2 * ((2 * quarter) + j)], &wi, &wq);
+            di = _mm256_fmsub_ps(xi, wi, _mm256_mul_ps(xq, wq));
+            dq = _mm256_fmadd_ps(xi, wq, _mm256_mul_ps(xq, wi));
+
+            s0i = _mm256_add_ps(ai, bi);
+            s0q = _mm256_add_ps(aq, bq);
+            d0i = _mm256_sub_ps(ai, bi);
+            d0q = _mm256_sub_ps(aq, bq);
+            s1i = _mm256_add_ps(ci, di);
+            s1q = _mm256_add_ps(cq, dq);
+            d1i = _mm256_sub_ps(ci, di);
+            d1q = _mm256_sub_ps(cq, dq);
+
+            dsp_fft_store_avx2(&x[2 * j], _mm256_add_ps(s0i, s1i), _mm256_add_ps(s0q, s1q));
+            dsp_fft_store_avx2(&x[2 * (j + (2 * quarter))], _mm256_sub_ps(s0i, s1i), _mm256_sub_ps(s0q, s1q));
+            dsp_fft_store_avx2(&x[2 * (j + o1)], _mm256_add_ps(d0i, d1q), _mm256_sub_ps(d0q, d1i));
+            dsp_fft_store_avx2(&x[2 * (j + o3)], _mm256_sub_ps(d0i, d1q), _mm256_add_ps(d0q, d1i));
+        }
+    }
+}
+
+#endif
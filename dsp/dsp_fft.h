@@ -0,0 +1,35 @@
+#ifndef __DSP_FFT_H__
+#define __DSP_FFT_H__
+
+#include <stdbool.h>
+
+#include "dsp.h"
+
+/* Built-in complex FFT for power of two sizes, unnormalized with FFTW's sign convention.
+    Bit reversal, a radix-2 stage if log2(Size) is odd, then radix-4 stages, each two radix-2 decimation in time
+    stages fused so the data is only passed over log4(Size) times. The butterflies are dsp_fft_radix4_cc(). */
+typedef struct {
+    int Size;
+    bool Inverse;
+    bool Radix2;
+    /* Output index of each input sample */
+    int *Reverse;
+    /* 3 * quarter complex (re, im) per radix-4 stage, as dsp_fft_radix4_cc() takes them */
+    float *Twiddles;
+} dsp_fft_t;
+
+bool dsp_fft_init(dsp_fft_t *fft, int size, bool inverse);
+void dsp_fft_execute(const dsp_fft_t *fft, const buffer_iqsample_t *input, buffer_iqsample_t *output);
+void dsp_fft_free(dsp_fft_t *fft);
+
+/* Per instruction set implementations, only for use by dsp_init() */
+void dsp_fft_radix4_cc_scalar(buffer_iqsample_t *data, int length, int quarter, const float *twiddles, bool inverse);
+#if defined(__ARM_NEON)
+void dsp_fft_radix4_cc_neon(buffer_iqsample_t *data, int length, int quarter, const float *twiddles, bool inverse);
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+void dsp_fft_radix4_cc_sse(buffer_iqsample_t *data, int length, int quarter, const float *twiddles, bool inverse);
+void dsp_fft_radix4_cc_avx2(buffer_iqsample_t *data, int length, int quarter, const float *twiddles, bool inverse);
+#endif
+
+#endif /* __DSP_FFT_H__ */
@@ -0,0 +1,345 @@
+/*
+    FIR decimator kernels, derived from fir_decimate_cc in libcsdr.
+
+    Copyright (c) Andras Retzler, HA7ILM <randras@sdr.hu>
+
+    libcsdr is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    libcsdr is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License
+    along with libcsdr.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "dsp_fir.h"
+
+//Theory: http://www.dspguru.com/dsp/faqs/multirate/decimation
+// Each output is the dot product of taps_length input samples with the real taps, for I and Q,
+//  then the window moves on by decimation input samples.
+
+/* Reference implementation */
+int dsp_fir_decimate_cc_scalar(const buffer_iqsample_t *input, buffer_iqsample_t *output, int input_length, int decimation, const float *taps, int taps_length)
+{
+    int oi = 0;
+    float acci, accq;
+
+    for(int i = 0; i + taps_length <= input_length; i += decimation)
+    {
+        acci = 0.0f;
+        accq = 0.0f;
+        for(int ti = 0; ti < taps_length; ti++)
+        {
+            acci += input[i + ti].i * taps[ti];
+            accq += input[i + ti].q * taps[ti];
+        }
+        output[oi].i = acci;
+        output[oi].q = accq;
+        oi++;
+    }
+
+    return oi;
+}
+
+#if defined(__ARM_NEON)
+
+static inline float dsp_fir_neon_sum(float32x4_t acc)
+{
+#if defined(__aarch64__)
+    return vaddvq_f32(acc);
+#else
+    float32x2_t sum = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    sum = vpadd_f32(sum, sum);
+    return vget_lane_f32(sum, 0);
+#endif
+}
+
+/* Fused multiply-add where available (AArch64, ARMv7 with VFPv4), otherwise separate multiply and add */
+static inline float32x4_t dsp_fir_neon_mla(float32x4_t acc, float32x4_t a, float32x4_t b)
+{
+#if defined(__ARM_FEATURE_FMA)
+    return vfmaq_f32(acc, a, b);
+#else
+    return vmlaq_f32(acc, a, b);
+#endif
+}
+
+/* AArch32 and AArch64. vld2 de-interleaves 4 samples into I and Q vectors, 8 taps per iteration over two accumulator pairs */
+int dsp_fir_decimate_cc_neon(const buffer_iqsample_t *input, buffer_iqsample_t *output, int input_length, int decimation, const float *taps, int taps_length)
+{
+    int oi = 0;
+    const float *pinput;
+    float32x4x2_t iq_0, iq_1;
+    float32x4_t taps_0, taps_1;
+    float32x4_t acci_0, accq_0, acci_1, accq_1;
+
+    for(int i = 0; i + taps_length <= input_length; i += decimation)
+    {
+        pinput = (const float *)&input[i];
+
+        acci_0 = accq_0 = acci_1 = accq_1 = vdupq_n_f32(0.0f);
+
+        for(int ti = 0; ti < taps_length; ti += 8)
+        {
+            iq_0 = vld2q_f32(&pinput[2 * ti]);
+            iq_1 = vld2q_f32(&pinput[(2 * ti) + 8]);
+            taps_0 = vld1q_f32(&taps[ti]);
+            taps_1 = vld1q_f32(&taps[ti + 4]);
+
+            acci_0 = dsp_fir_neon_mla(acci_0, iq_0.val[0], taps_0);
+            accq_0 = dsp_fir_neon_mla(accq_0, iq_0.val[1], taps_0);
+            acci_1 = dsp_fir_neon_mla(acci_1, iq_1.val[0], taps_1);
+            accq_1 = dsp_fir_neon_mla(accq_1, iq_1.val[1], taps_1);
+        }
+
+        output[oi].i = dsp_fir_neon_sum(vaddq_f32(acci_0, acci_1));
+        output[oi].q = dsp_fir_neon_sum(vaddq_f32(accq_0, accq_1));
+        oi++;
+    }
+
+    return oi;
+}
+
+#endif /* __ARM_NEON */
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* Input stays interleaved, each tap is duplicated into an I and a Q lane instead. Accumulators end up as [i q i q]. */
+__attribute__((target("sse2")))
+int dsp_fir_decimate_cc_sse(const buffer_iqsample_t *input, buffer_iqsample_t *output, int input_length, int decimation, const float *taps, int taps_length)
+{
+    int oi = 0;
+    const float *pinput;
+    __m128 taps_4, acc_0, acc_1;
+
+    for(int i = 0; i + taps_length <= input_length; i += decimation)
+    {
+        pinput = (const float *)&input[i];
+
+        acc_0 = acc_1 = _mm_setzero_ps();
+
+        for(int ti = 0; ti < taps_length; ti += 4)
+        {
+            taps_4 = _mm_loadu_ps(&taps[ti]);
+
+            /* [t0 t0 t1 t1] and [t2 t2 t3 t3] */
+            acc_0 = _mm_add_ps(acc_0, _mm_mul_ps(_mm_loadu_ps(&pinput[2 * ti]), _mm_unpacklo_ps(taps_4, taps_4)));
+            acc_1 = _mm_add_ps(acc_1, _mm_mul_ps(_mm_loadu_ps(&pinput[(2 * ti) + 4]), _mm_unpackhi_ps(taps_4, taps_4)));
+        }
+
+        acc_0 = _mm_add_ps(acc_0, acc_1);
+        acc_0 = _mm_add_ps(acc_0, _mm_movehl_ps(acc_0, acc_0));
+
+        output[oi].i = _mm_cvtss_f32(acc_0);
+        output[oi].q = _mm_cvtss_f32(_mm_shuffle_ps(acc_0, acc_0, _MM_SHUFFLE(1, 1, 1, 1)));
+        oi++;
+    }
+
+    return oi;
+}
+
+/* As above with 256-bit vectors and FMA, 8 taps per iteration */
+__attribute__((target("avx2,fma")))
+int dsp_fir_decimate_cc_avx2(const buffer_iqsample_t *input, buffer_iqsample_t *output, int input_length, int decimation, const float *taps, int taps_length)
+{
+    int oi = 0;
+    const float *pinput;
+    __m256 taps_8, acc_0, acc_1;
+    __m128 acc;
+
+    const __m256i duplicate_lo = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+    const __m256i duplicate_hi = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+
+    for(int i = 0; i + taps_length <= input_length; i += decimation)
+    {
+        pinput = (const float *)&input[i];
+
+        acc_0 = acc_1 = _mm256_setzero_ps();
+
+        for(int ti = 0; ti < taps_length; ti += 8)
+        {
+            taps_8 = _mm256_loadu_ps(&taps[ti]);
+
+            acc_0 = _mm256_fmadd_ps(_mm256_loadu_ps(&pinput[2 * ti]), _mm256_permutevar8x32_ps(taps_8, duplicate_lo), acc_0);
+            acc_1 = _mm256_fmadd_ps(_mm256_loadu_ps(&pinput[(2 * ti) + 8]), _mm256_permutevar8x32_ps(taps_8, duplicate_hi), acc_1);
+        }
+
+        acc_0 = _mm256_add_ps(acc_0, acc_1);
+        acc = _mm_add_ps(_mm256_castps256_ps128(acc_0), _mm256_extractf128_ps(acc_0, 1));
+        acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+
+        output[oi].i = _mm_cvtss_f32(acc);
+        output[oi].q = _mm_cvtss_f32(_mm_shuffle_ps(acc, acc, _MM_SHUFFLE(1, 1, 1, 1)));
+        oi++;
+    }
+
+    return oi;
+}
+
+#endif /* __x86_64__ || __i386__ */
+
+/*
+    Complex-tap decimators, for frequency translating FIRs. Taps are given as separate real and imaginary arrays,
+    which makes it two real-tap FIRs over the same input window:
+        r = sum(x * taps_i), s = sum(x * taps_q)  ->  out.i = r.i - s.q, out.q = r.q + s.i
+*/
+
+int dsp_fir_decimate_cc_complex_scalar(const buffer_iqsample_t *input, buffer_iqsample_t *output, int input_length, int decimation, const float *taps_i, const float *taps_q, int taps_length)
+{
+    int oi = 0;
+    float acc_ii, acc_qi, acc_iq, acc_qq;
+
+    for(int i = 0; i + taps_length <= input_length; i += decimation)
+    {
+        acc_ii = acc_qi = acc_iq = acc_qq = 0.0f;
+        for(int ti = 0; ti < taps_length; ti++)
+        {
+            acc_ii += input[i + ti].i * taps_i[ti];
+            acc_qi += input[i + ti].q * taps_i[ti];
+            acc_iq += input[i + ti].i * taps_q[ti];
+            acc_qq += input[i + ti].q * taps_q[ti];
+        }
+        output[oi].i = acc_ii - acc_qq;
+        output[oi].q = acc_qi + acc_iq;
+        oi++;
+    }
+
+    return oi;
+}
+
+#if defined(__ARM_NEON)
+
+int dsp_fir_decimate_cc_complex_neon(const buffer_iqsample_t *input, buffer_iqsample_t *output, int input_length, int decimation, const float *taps_i, const float *taps_q, int taps_length)
+{
+    int oi = 0;
+    const float *pinput;
+    float32x4x2_t iq;
+    float32x4_t ti, tq;
+    float32x4_t acc_ii, acc_qi, acc_iq, acc_qq;
+
+    for(int i = 0; i + taps_length <= input_length; i += decimation)
+    {
+        pinput = (const float *)&input[i];
+
+        acc_ii = acc_qi = acc_iq = acc_qq = vdupq_n_f32(0.0f);
+
+        for(int t = 0; t < taps_length; t += 4)
+        {
+            iq = vld2q_f32(&pinput[2 * t]);
+            ti = vld1q_f32(&taps_i[t]);
+            tq = vld1q_f32(&taps_q[t]);
+
+            acc_ii = dsp_fir_neon_mla(acc_ii, iq.val[0], ti);
+            acc_qi = dsp_fir_neon_mla(acc_qi, iq.val[1], ti);
+            acc_iq = dsp_fir_neon_mla(acc_iq, iq.val[0], tq);
+            acc_qq = dsp_fir_neon_mla(acc_qq, iq.val[1], tq);
+        }
+
+        output[oi].i = dsp_fir_neon_sum(vsubq_f32(acc_ii, acc_qq));
+        output[oi].q = dsp_fir_neon_sum(vaddq_f32(acc_qi, acc_iq));
+        oi++;
+    }
+
+    return oi;
+}
+
+#endif /* __ARM_NEON */
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse2")))
+int dsp_fir_decimate_cc_complex_sse(const buffer_iqsample_t *input, buffer_iqsample_t *output, int input_length, int decimation, const float *taps_i, const float *taps_q, int taps_length)
+{
+    int oi = 0;
+    const float *pinput;
+    __m128 ti, tq, in_0, in_1, acc_r, acc_s;
+
+    for(int i = 0; i + taps_length <= input_length; i += decimation)
+    {
+        pinput = (const float *)&input[i];
+
+        acc_r = acc_s = _mm_setzero_ps();
+
+        for(int t = 0; t < taps_length; t += 4)
+        {
+            ti = _mm_loadu_ps(&taps_i[t]);
+            tq = _mm_loadu_ps(&taps_q[t]);
+            in_0 = _mm_loadu_ps(&pinput[2 * t]);
+            in_1 = _mm_loadu_ps(&pinput[(2 * t) + 4]);
+
+            acc_r = _mm_add_ps(acc_r, _mm_mul_ps(in_0, _mm_unpacklo_ps(ti, ti)));
+            acc_r = _mm_add_ps(acc_r, _mm_mul_ps(in_1, _mm_unpackhi_ps(ti, ti)));
+            acc_s = _mm_add_ps(acc_s, _mm_mul_ps(in_0, _mm_unpacklo_ps(tq, tq)));
+            acc_s = _mm_add_ps(acc_s, _mm_mul_ps(in_1, _mm_unpackhi_ps(tq, tq)));
+        }
+
+        /* [r.i r.q] and [s.i s.q] in the low lanes */
+        acc_r = _mm_add_ps(acc_r, _mm_movehl_ps(acc_r, acc_r));
+        acc_s = _mm_add_ps(acc_s, _mm_movehl_ps(acc_s, acc_s));
+
+        output[oi].i = _mm_cvtss_f32(acc_r) - _mm_cvtss_f32(_mm_shuffle_ps(acc_s, acc_s, _MM_SHUFFLE(1, 1, 1, 1)));
+        output[oi].q = _mm_cvtss_f32(_mm_shuffle_ps(acc_r, acc_r, _MM_SHUFFLE(1, 1, 1, 1))) + _mm_cvtss_f32(acc_s);
+        oi++;
+    }
+
+    return oi;
+}
+
+__attribute__((target("avx2,fma")))
+int dsp_fir_decimate_cc_complex_avx2(const buffer_iqsample_t *input, buffer_iqsample_t *output, int input_length, int decimation, const float *taps_i, const float *taps_q, int taps_length)
+{
+    int oi = 0;
+    const float *pinput;
+    __m256 ti, tq, in_0, in_1, acc_r, acc_s;
+    __m128 r, s;
+
+    const __m256i duplicate_lo = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+    const __m256i duplicate_hi = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+
+    for(int i = 0; i + taps_length <= input_length; i += decimation)
+    {
+        pinput = (const float *)&input[i];
+
+        acc_r = acc_s = _mm256_setzero_ps();
+
+        for(int t = 0; t < taps_length; t += 8)
+        {
+            ti = _mm256_loadu_ps(&taps_i[t]);
+            tq = _mm256_loadu_ps(&taps_q[t]);
+            in_0 = _mm256_loadu_ps(&pinput[2 * t]);
+            in_1 = _mm256_loadu_ps(&pinput[(2 * t) + 8]);
+
+            acc_r = _mm256_fmadd_ps(in_0, _mm256_permutevar8x32_ps(ti, duplicate_lo), acc_r);
+            acc_r = _mm256_fmadd_ps(in_1, _mm256_permutevar8x32_ps(ti, duplicate_hi), acc_r);
+            acc_s = _mm256_fmadd_ps(in_0, _mm256_permutevar8x32_ps(tq, duplicate_lo), acc_s);
+            acc_s = _mm256_fmadd_ps(in_1, _mm256_permutevar8x32_ps(tq, duplicate_hi), acc_s);
+        }
+
+        r = _mm_add_ps(_mm256_castps256_ps128(acc_r), _mm256_extractf128_ps(acc_r, 1));
+        r = _mm_add_ps(r, _mm_movehl_ps(r, r));
+        s = _mm_add_ps(_mm256_castps256_ps128(acc_s), _mm256_extractf128_ps(acc_s, 1));
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+
+        output[oi].i = _mm_cvtss_f32(r) - _mm_cvtss_f32(_mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 1, 1, 1)));
+        output[oi].q = _mm_cvtss_f32(_mm_shuffle_ps(r, r, _MM_SHUFFLE(1, 1, 1, 1))) + _mm_cvtss_f32(s);
+        oi++;
+    }
+
+    return oi;
+}
+
+#endif /* __x86_64__ || __i386__ */
@@ -0,0 +1,20 @@
+#ifndef __DSP_FIR_H__
+#define __DSP_FIR_H__
+
+#include "dsp.h"
+
+/* Per instruction set implementations, only for use by dsp_init() */
+int dsp_fir_decimate_cc_scalar(const buffer_iqsample_t *input, buffer_iqsample_t *output, int input_length, int decimation, const float *taps, int taps_length);
+int dsp_fir_decimate_cc_complex_scalar(const buffer_iqsample_t *input, buffer_iqsample_t *output, int input_length, int decimation, const float *taps_i, const float *taps_q, int taps_length);
+#if defined(__ARM_NEON)
+int dsp_fir_decimate_cc_neon(const buffer_iqsample_t *input, buffer_iqsample_t *output, int input_length, int decimation, const float *taps, int taps_length);
+int dsp_fir_decimate_cc_complex_neon(const buffer_iqsample_t *input, buffer_iqsample_t *output, int input_length, int decimation, const float *taps_i, const float *taps_q, int taps_length);
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+int dsp_fir_decimate_cc_sse(const buffer_iqsample_t *input, buffer_iqsample_t *output, int input_length, int decimation, const float *taps, int taps_length);
+int dsp_fir_decimate_cc_avx2(const buffer_iqsample_t *input, buffer_iqsample_t *output, int input_length, int decimation, const float *taps, int taps_length);
+int dsp_fir_decimate_cc_complex_sse(const buffer_iqsample_t *input, buffer_iqsample_t *output, int input_length, int decimation, const float *taps_i, const float *taps_q, int taps_length);
+int dsp_fir_decimate_cc_complex_avx2(const buffer_iqsample_t *input, buffer_iqsample_t *output, int input_length, int decimation, const float *taps_i, const float *taps_q, int taps_length);
+#endif
+
+#endif /* __DSP_FIR_H__ */
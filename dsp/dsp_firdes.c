@@ -0,0 +1,123 @@
+/*
+    Several functions in this file have been heavily derived from libcsdr.
+
+    Copyright (c) Andras Retzler, HA7ILM <randras@sdr.hu>
+
+    libcsdr is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    libcsdr is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License
+    along with libcsdr.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "dsp_firdes.h"
+
+/* Number of taps for a transition band (relative to sampling frequency), always odd */
+int dsp_firdes_length(float transition_bw)
+{
+    int length = 4.0 / transition_bw;
+    if(length % 2 == 0) length++; //number of symmetric FIR filter taps should be odd
+    return length;
+}
+
+void dsp_firdes_lowpass_f(float *output, int length, float cutoff_rate)
+{
+    dsp_firdes_lowpass_window_f(output, length, cutoff_rate, DSP_WINDOW_HAMMING, 0);
+}
+
+/* Kaiser windowed, length from dsp_window_kaiser_length() with the same attenuation (dB) */
+void dsp_firdes_lowpass_kaiser_f(float *output, int length, float cutoff_rate, float attenuation)
+{
+    dsp_firdes_lowpass_window_f(output, length, cutoff_rate, DSP_WINDOW_KAISER, dsp_window_kaiser_beta(attenuation));
+}
+
+/* beta is only used by DSP_WINDOW_KAISER */
+void dsp_firdes_lowpass_window_f(float *output, int length, float cutoff_rate, dsp_window_t window, float beta)
+{   //Generates symmetric windowed sinc FIR filter real taps
+    //  length should be odd
+    //  cutoff_rate is (cutoff frequency/sampling frequency)
+    //Explanation at Chapter 16 of dspguide.com
+    int middle=length/2;
+    output[middle]=2*M_PI*cutoff_rate*dsp_window_kernel(window, 0, beta);
+    for(int i=1; i<=middle; i++) //@@firdes_lowpass_f: calculate taps
+    {
+        output[middle-i]=output[middle+i]=(sin(2*M_PI*cutoff_rate*i)/i)*dsp_window_kernel(window, (float)i/middle, beta);
+        //printf("%g %d %d %d %d | %g\n",output[middle-i],i,middle,middle+i,middle-i,sin(2*PI*cutoff_rate*i));
+    }
+    //Normalize filter kernel
+    float sum=0;
+    for(int i=0;i<length;i++) //@normalize_fir_f: normalize pass 1
+        sum+=output[i];
+    for(int i=0;i<length;i++) //@normalize_fir_f: normalize pass 2
+        output[i]=output[i]/sum;
+}
+
+/* Complex bandpass taps, written as interleaved I/Q pairs into output[2 * length] */
+void dsp_firdes_bandpass_c(float *output, int length, float low_cut, float high_cut, dsp_window_t window, float beta)
+{
+    //To generate a complex filter:
+    //  1. we generate a real lowpass filter with a bandwidth of highcut-lowcut
+    //  2. we shift the filter taps spectrally by multiplying with e^(j*w), so we get complex taps
+    //(tnx HA5FT)
+    float *realtaps = (float *)malloc(length * sizeof(float));
+
+    dsp_firdes_lowpass_window_f(realtaps, length, (high_cut - low_cut) / 2, window, beta);
+    float filter_center = (high_cut + low_cut) / 2;
+
+    float phase=0, sinval, cosval;
+    for(int i=0; i<length; i++) //@@firdes_bandpass_c
+    {
+        cosval = cos(phase);
+        sinval = sin(phase);
+        phase += 2 * M_PI * filter_center;
+        while(phase > (2 * M_PI)) phase -= 2 * M_PI; //@@firdes_bandpass_c
+        while(phase < 0) phase += 2 * M_PI;
+        output[2 * i] = cosval * realtaps[i];
+        output[(2 * i) + 1] = sinval * realtaps[i];
+    }
+
+    free(realtaps);
+}
+
+int dsp_firdes_cic_length(int decimation, int order)
+{
+    return (order * (decimation - 1)) + 1;
+}
+
+/* Impulse response of an order-N CIC decimator, i.e. a length-decimation boxcar convolved with itself N times.
+    Evaluated as a polyphase FIR there are no integrators to overflow or drift in float,
+    and it only has to be computed at the output rate. Normalized to unity DC gain. */
+void dsp_firdes_cic_f(float *output, int decimation, int order)
+{
+    int length = 1;
+    float sum = 0;
+
+    output[0] = 1;
+    for(int n = 0; n < order; n++)
+    {
+        /* In place running sum over the last decimation taps, from the end so inputs are still unmodified */
+        length += decimation - 1;
+        for(int i = length - 1; i >= 0; i--)
+        {
+            float acc = 0;
+            for(int k = 0; k < decimation; k++)
+            {
+                if(i - k >= 0 && i - k < length - (decimation - 1)) acc += output[i - k];
+            }
+            output[i] = acc;
+        }
+    }
+
+    for(int i = 0; i < length; i++) sum += output[i];
+    for(int i = 0; i < length; i++) output[i] /= sum;
+}
@@ -0,0 +1,14 @@
+#ifndef __DSP_FIRDES_H__
+#define __DSP_FIRDES_H__
+
+#include "dsp_window.h"
+
+int dsp_firdes_length(float transition_bw);
+void dsp_firdes_lowpass_f(float *output, int length, float cutoff_rate);
+void dsp_firdes_lowpass_kaiser_f(float *output, int length, float cutoff_rate, float attenuation);
+void dsp_firdes_lowpass_window_f(float *output, int length, float cutoff_rate, dsp_window_t window, float beta);
+void dsp_firdes_bandpass_c(float *output, int length, float low_cut, float high_cut, dsp_window_t window, float beta);
+int dsp_firdes_cic_length(int decimation, int order);
+void dsp_firdes_cic_f(float *output, int decimation, int order);
+
+#endif /* __DSP_FIRDES_H__ */
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "dsp_nco.h"
+
+/* Radians per accumulator unit */
+#define DSP_NCO_PHASE_SCALE (2.0 * M_PI / 4294967296.0)
+
+_Static_assert((DSP_NCO_SEGMENT % DSP_NCO_LANES) == 0, "Error: DSP_NCO_SEGMENT must be a multiple of DSP_NCO_LANES");
+
+void dsp_nco_init(dsp_nco_t *nco, double rate)
+{
+    nco->Phase = 0;
+    dsp_nco_set_rate(nco, rate);
+}
+
+/* rate is in cycles per sample, -0.5 to 0.5. The phase carries on from where it was. */
+void dsp_nco_set_rate(dsp_nco_t *nco, double rate)
+{
+    /* Through int64_t so that negative rates wrap to the right unsigned increment */
+    dsp_nco_set_increment(nco, (uint32_t)(int64_t)llround(rate * 4294967296.0));
+}
+
+/* As dsp_nco_set_rate(), in accumulator units per sample */
+void dsp_nco_set_increment(dsp_nco_t *nco, uint32_t increment)
+{
+    nco->Increment = increment;
+
+    nco->StepCos = cos((uint32_t)(DSP_NCO_LANES * nco->Increment) * DSP_NCO_PHASE_SCALE);
+    nco->StepSin = sin((uint32_t)(DSP_NCO_LANES * nco->Increment) * DSP_NCO_PHASE_SCALE);
+}
+
+/* output = input * e^(j * phase), output may be the same as input */
+void dsp_nco_mix_cc(dsp_nco_t *nco, const buffer_iqsample_t *input, buffer_iqsample_t *output, int length)
+{
+    float lane_cos[DSP_NCO_LANES], lane_sin[DSP_NCO_LANES];
+    float last_cos, last_sin, in_i, in_q;
+    int segment_length, i;
+
+    for(int segment = 0; segment < length; segment += DSP_NCO_SEGMENT)
+    {
+        segment_length = ((length - segment) < DSP_NCO_SEGMENT) ? (length - segment) : DSP_NCO_SEGMENT;
+
+        /* Re-seed lane l at phase + l * increment, straight from the accumulator */
+        for(int l = 0; l < DSP_NCO_LANES; l++)
+        {
+            double angle = (uint32_t)(nco->Phase + (l * nco->Increment)) * DSP_NCO_PHASE_SCALE;
+            lane_cos[l] = cos(angle);
+            lane_sin[l] = sin(angle);
+        }
+
+        /* Lanes are independent, so this vectorises */
+        for(i = 0; i + DSP_NCO_LANES <= segment_length; i += DSP_NCO_LANES)
+        {
+            for(int l = 0; l < DSP_NCO_LANES; l++)
+            {
+                in_i = input[segment + i + l].i;
+                in_q = input[segment + i + l].q;
+                output[segment + i + l].i = (lane_cos[l] * in_i) - (lane_sin[l] * in_q);
+                output[segment + i + l].q = (lane_sin[l] * in_i) + (lane_cos[l] * in_q);
+
+                last_cos = lane_cos[l];
+                last_sin = lane_sin[l];
+                lane_cos[l] = (last_cos * nco->StepCos) - (last_sin * nco->StepSin);
+                lane_sin[l] = (last_sin * nco->StepCos) + (last_cos * nco->StepSin);
+            }
+        }
+
+        /* Tail of the block, the lanes already hold the right phases */
+        for(int l = 0; i < segment_length; i++, l++)
+        {
+            in_i = input[segment + i].i;
+            in_q = input[segment + i].q;
+            output[segment + i].i = (lane_cos[l] * in_i) - (lane_sin[l] * in_q);
+            output[segment + i].q = (lane_sin[l] * in_i) + (lane_cos[l] * in_q);
+        }
+
+        nco->Phase += (uint32_t)segment_length * nco->Increment;
+    }
+}
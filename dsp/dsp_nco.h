@@ -0,0 +1,28 @@
+#ifndef __DSP_NCO_H__
+#define __DSP_NCO_H__
+
+#include "dsp.h"
+
+/* Lanes rotated in parallel, and samples between re-seeding the lanes from the phase accumulator */
+#define DSP_NCO_LANES       4
+#define DSP_NCO_SEGMENT     256
+
+/* Numerically controlled oscillator.
+    The phase is a 32-bit accumulator (2^32 = one cycle), so it is exact and wraps on its own across blocks.
+    Samples are produced by DSP_NCO_LANES recursive rotators that are re-seeded from the accumulator
+    every DSP_NCO_SEGMENT samples, so rounding error can't build up. */
+typedef struct {
+    uint32_t Phase;
+    uint32_t Increment;
+
+    /* Rotation of each lane per step, e^(j * DSP_NCO_LANES * Increment) */
+    float StepCos;
+    float StepSin;
+} dsp_nco_t;
+
+void dsp_nco_init(dsp_nco_t *nco, double rate);
+void dsp_nco_set_rate(dsp_nco_t *nco, double rate);
+void dsp_nco_set_increment(dsp_nco_t *nco, uint32_t increment);
+void dsp_nco_mix_cc(dsp_nco_t *nco, const buffer_iqsample_t *input, buffer_iqsample_t *output, int length);
+
+#endif /* __DSP_NCO_H__ */
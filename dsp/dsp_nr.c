@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "dsp_nr.h"
+#include "dsp_window.h"
+
+#define DSP_NR_HISTORY  (DSP_NR_LMS_TAPS + DSP_NR_LMS_DELAY - 1)
+
+/*
+    Adaptation rate (normalized LMS, 0 to 2) and weight leakage per sample. The notch adapts slower,
+    a carrier is steady and a slow notch leaves speech alone.
+
+    Spectral subtraction, per FFT frame (~30 ms):
+        power smoothing     0.5
+        noise floor         follows the smoothed power down at once, rises 0.1 dB per frame (~3 dB/s)
+        gain                1 - (2 * noise / power), no lower than 0.1 (-20 dB), smoothed by 0.5
+        across bins         impulse response Hann windowed to +-32 samples (DSP_NR_SPECTRAL_SPAN)
+*/
+typedef struct {
+    const char *name;
+    float rate;
+    float leakage;
+} dsp_nr_preset_t;
+
+static const dsp_nr_preset_t dsp_nr_presets[] = {
+    [DSP_NR_OFF] = { "off", 0.0, 0.0 },
+    [DSP_NR_LMS] = { "lms", 0.02, 1e-5 },
+    [DSP_NR_NOTCH] = { "notch", 0.005, 1e-4 },
+    [DSP_NR_SPECTRAL] = { "spectral", 0.0, 0.0 }
+};
+
+#define DSP_NR_PRESETS (int)(sizeof(dsp_nr_presets) / sizeof(dsp_nr_presets[0]))
+
+#define DSP_NR_SPECTRAL_SMOOTH      0.5f
+#define DSP_NR_SPECTRAL_RISE        1.0233f
+#define DSP_NR_SPECTRAL_OVERSUB     2.0f
+#define DSP_NR_SPECTRAL_FLOOR       0.1f
+#define DSP_NR_SPECTRAL_GAIN_SMOOTH 0.5f
+
+const char *dsp_nr_mode_name(dsp_nr_mode_t mode)
+{
+    return ((int)mode < DSP_NR_PRESETS) ? dsp_nr_presets[mode].name : "?";
+}
+
+bool dsp_nr_mode_parse(const char *name, dsp_nr_mode_t *mode)
+{
+    for(int i = 0; i < DSP_NR_PRESETS; i++)
+    {
+        if(strcmp(name, dsp_nr_presets[i].name) == 0)
+        {
+            *mode = (dsp_nr_mode_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* max_length is the longest block for dsp_nr_execute_ff(), bins the spectrum size for dsp_nr_spectral_execute(),
+    over DSP_NR_SPECTRAL_SPAN. forward and inverse are bins point complex plans made out of place on fft_planner_alloc'd buffers.
+    Everything is allocated here, so the mode can be changed between blocks. */
+bool dsp_nr_init(dsp_nr_t *nr, dsp_nr_mode_t mode, int max_length, int bins, fft_planner_plan_t *forward, fft_planner_plan_t *inverse)
+{
+    memset(nr, 0, sizeof(dsp_nr_t));
+    if(bins <= DSP_NR_SPECTRAL_SPAN)
+    {
+        return false;
+    }
+
+    nr->MaxLength = max_length;
+    nr->Bins = bins;
+    nr->Forward = forward;
+    nr->Inverse = inverse;
+    nr->History = (float *)malloc((DSP_NR_HISTORY + max_length) * sizeof(float));
+    nr->Power = (float *)malloc(bins * sizeof(float));
+    nr->Noise = (float *)malloc(bins * sizeof(float));
+    nr->Gain = (float *)malloc(bins * sizeof(float));
+    nr->Response = fft_planner_alloc(bins * sizeof(buffer_iqsample_t));
+    nr->Impulse = fft_planner_alloc(bins * sizeof(buffer_iqsample_t));
+    if(nr->History == NULL || nr->Power == NULL || nr->Noise == NULL || nr->Gain == NULL || nr->Response == NULL || nr->Impulse == NULL)
+    {
+        dsp_nr_free(nr);
+        return false;
+    }
+
+    /* The 1/bins of the inverse FFT is folded in */
+    dsp_window_table_f(nr->Window, DSP_NR_SPECTRAL_SPAN + 1, DSP_WINDOW_HANN, 0.0, false);
+    for(int n = 0; n <= DSP_NR_SPECTRAL_SPAN; n++)
+    {
+        nr->Window[n] /= bins;
+    }
+
+    dsp_nr_set_mode(nr, mode);
+    return true;
+}
+
+/* Starts the new mode afresh */
+void dsp_nr_set_mode(dsp_nr_t *nr, dsp_nr_mode_t mode)
+{
+    if((int)mode >= DSP_NR_PRESETS)
+    {
+        mode = DSP_NR_OFF;
+    }
+
+    nr->Mode = mode;
+    nr->Rate = dsp_nr_presets[mode].rate;
+    nr->Leakage = dsp_nr_presets[mode].leakage;
+
+    memset(nr->Weights, 0, sizeof(nr->Weights));
+    memset(nr->History, 0, DSP_NR_HISTORY * sizeof(float));
+    for(int k = 0; k < nr->Bins; k++)
+    {
+        nr->Power[k] = 0;
+        /* Starts high and falls to the floor within a frame */
+        nr->Noise[k] = INFINITY;
+        nr->Gain[k] = 1.0;
+    }
+}
+
+/* LMS and notch modes, in place, length up to MaxLength. Does nothing in the other modes. */
+void dsp_nr_execute_ff(dsp_nr_t *nr, float *data, int length)
+{
+    float *history = nr->History;
+    float *weights = nr->Weights;
+    const float *x;
+    float prediction, power, error, step;
+    const float leak = 1.0f - nr->Leakage;
+
+    if(nr->Mode != DSP_NR_LMS && nr->Mode != DSP_NR_NOTCH)
+    {
+        return;
+    }
+    if(length > nr->MaxLength)
+    {
+        length = nr->MaxLength;
+    }
+
+    memcpy(&history[DSP_NR_HISTORY], data, length * sizeof(float));
+
+    for(int n = 0; n < length; n++)
+    {
+        /* Taps are x[n - DELAY - TAPS + 1] .. x[n - DELAY], the sample predicted is history[n + DSP_NR_HISTORY] */
+        x = &history[n];
+
+        prediction = 0;
+        power = 0;
+        for(int t = 0; t < DSP_NR_LMS_TAPS; t++)
+        {
+            prediction += weights[t] * x[t];
+            power += x[t] * x[t];
+        }
+
+        error = history[n + DSP_NR_HISTORY] - prediction;
+        step = (nr->Rate * error) / (power + 1e-10f);
+        for(int t = 0; t < DSP_NR_LMS_TAPS; t++)
+        {
+            weights[t] = (weights[t] * leak) + (step * x[t]);
+        }
+
+        data[n] = (nr->Mode == DSP_NR_LMS) ? prediction : error;
+    }
+
+    memmove(history, &history[length], DSP_NR_HISTORY * sizeof(float));
+}
+
+/* Spectral subtraction, scales the Bins bins of spectrum in place. Does nothing in the other modes.
+    The gain is smoothed across frames (musical noise) and held above a floor. It is then smoothed across
+    bins by windowing its impulse response to +-DSP_NR_SPECTRAL_SPAN / 2 samples, so as long as the frame
+    has that much zero padding the spread lands in it, and the overlap-add has no circular wrap. */
+void dsp_nr_spectral_execute(dsp_nr_t *nr, buffer_iqsample_t *spectrum)
+{
+    const int bins = nr->Bins;
+    const int half = DSP_NR_SPECTRAL_SPAN / 2;
+    const float *window = nr->Window;
+    float *power = nr->Power;
+    float *noise = nr->Noise;
+    float *gain = nr->Gain;
+    buffer_iqsample_t *response = nr->Response;
+    buffer_iqsample_t *impulse = nr->Impulse;
+    float p, n, g;
+
+    if(nr->Mode != DSP_NR_SPECTRAL)
+    {
+        return;
+    }
+
+    for(int k = 0; k < bins; k++)
+    {
+        p = (spectrum[k].i * spectrum[k].i) + (spectrum[k].q * spectrum[k].q);
+        p = power[k] + ((p - power[k]) * DSP_NR_SPECTRAL_SMOOTH);
+        power[k] = p;
+
+        n = noise[k] * DSP_NR_SPECTRAL_RISE;
+        n = (p < n) ? p : n;
+        noise[k] = n;
+
+        g = 1.0f - ((DSP_NR_SPECTRAL_OVERSUB * n) / (p + 1e-20f));
+        g = (g > DSP_NR_SPECTRAL_FLOOR) ? g : DSP_NR_SPECTRAL_FLOOR;
+        g = gain[k] + ((g - gain[k]) * DSP_NR_SPECTRAL_GAIN_SMOOTH);
+        gain[k] = g;
+
+        response[k].i = g;
+        response[k].q = 0;
+    }
+
+    /* The gain is real, so its impulse response is Hermitian and stays so under the symmetric window,
+        and the windowed gain comes back real */
+    fft_planner_execute_dft(nr->Inverse, nr->Response, nr->Impulse);
+    impulse[0].i *= window[half];
+    impulse[0].q *= window[half];
+    for(int t = 1; t <= half; t++)
+    {
+        impulse[t].i *= window[half + t];
+        impulse[t].q *= window[half + t];
+        impulse[bins - t].i *= window[half - t];
+        impulse[bins - t].q *= window[half - t];
+    }
+    for(int t = half + 1; t < (bins - half); t++)
+    {
+        impulse[t].i = 0;
+        impulse[t].q = 0;
+    }
+    fft_planner_execute_dft(nr->Forward, nr->Impulse, nr->Response);
+
+    for(int k = 0; k < bins; k++)
+    {
+        spectrum[k].i *= response[k].i;
+        spectrum[k].q *= response[k].i;
+    }
+}
+
+void dsp_nr_free(dsp_nr_t *nr)
+{
+    free(nr->History);
+    free(nr->Power);
+    free(nr->Noise);
+    free(nr->Gain);
+    fft_planner_free(nr->Response);
+    fft_planner_free(nr->Impulse);
+    nr->History = NULL;
+    nr->Power = NULL;
+    nr->Noise = NULL;
+    nr->Gain = NULL;
+    nr->Response = NULL;
+    nr->Impulse = NULL;
+}
@@ -0,0 +1,67 @@
+#ifndef __DSP_NR_H__
+#define __DSP_NR_H__
+
+#include <stdbool.h>
+#include <fftw3.h>
+
+#include "dsp.h"
+#include "../fft_planner.h"
+
+/* Adaptive filter length and decorrelation delay (samples), as the DTTSP/WDSP ANR and ANF */
+#define DSP_NR_LMS_TAPS     64
+#define DSP_NR_LMS_DELAY    16
+
+/* The spectral gain's impulse response is held within +-DSP_NR_SPECTRAL_SPAN / 2 samples, a frame it is
+    applied to needs this much zero padding on top of any filter's, split either side of the input */
+#define DSP_NR_SPECTRAL_SPAN 64
+
+/* DSP_NR_OFF (0) is the default */
+typedef enum {
+    DSP_NR_OFF = 0,
+    /* NLMS noise reduction, keeps what can be predicted (speech, tones) */
+    DSP_NR_LMS,
+    /* NLMS automatic notch, removes what can be predicted (carriers) */
+    DSP_NR_NOTCH,
+    /* Spectral subtraction on the demodulator's FFT frame */
+    DSP_NR_SPECTRAL
+} dsp_nr_mode_t;
+
+/* Noise reduction for real audio (LMS, notch) or a spectrum (spectral subtraction).
+    The LMS modes predict each sample from the DSP_NR_LMS_TAPS samples DSP_NR_LMS_DELAY before it, and adapt
+    the weights by normalized LMS. Noise decorrelates within the delay and can't be predicted, steady
+    tones can. The history is kept linear ahead of the block, so the dot product and update run over
+    contiguous samples and vectorize. */
+typedef struct {
+    dsp_nr_mode_t Mode;
+
+    /* LMS */
+    float Rate;
+    float Leakage;
+    float Weights[DSP_NR_LMS_TAPS];
+    /* DSP_NR_LMS_TAPS + DSP_NR_LMS_DELAY - 1 samples of history, then up to MaxLength of input */
+    float *History;
+    int MaxLength;
+
+    /* Spectral subtraction, per bin */
+    int Bins;
+    float *Power;
+    float *Noise;
+    float *Gain;
+    /* The gain as applied, smoothed across bins by windowing its impulse response, fft_planner_alloc aligned */
+    buffer_iqsample_t *Response;
+    buffer_iqsample_t *Impulse;
+    float Window[DSP_NR_SPECTRAL_SPAN + 1];
+    /* The caller's Bins point complex plans, executed out of place on Response and Impulse */
+    fft_planner_plan_t *Forward;
+    fft_planner_plan_t *Inverse;
+} dsp_nr_t;
+
+const char *dsp_nr_mode_name(dsp_nr_mode_t mode);
+bool dsp_nr_mode_parse(const char *name, dsp_nr_mode_t *mode);
+bool dsp_nr_init(dsp_nr_t *nr, dsp_nr_mode_t mode, int max_length, int bins, fft_planner_plan_t *forward, fft_planner_plan_t *inverse);
+void dsp_nr_set_mode(dsp_nr_t *nr, dsp_nr_mode_t mode);
+void dsp_nr_execute_ff(dsp_nr_t *nr, float *data, int length);
+void dsp_nr_spectral_execute(dsp_nr_t *nr, buffer_iqsample_t *spectrum);
+void dsp_nr_free(dsp_nr_t *nr);
+
+#endif /* __DSP_NR_H__ */
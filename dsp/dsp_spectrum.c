@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "dsp_spectrum.h"
+
+/*
+    log2(x) from the float's exponent and a cubic in its mantissa m (1 <= m < 2), least squares on [1, 2):
+
+        log2(m) ~= t * (C1 + t * (C2 + t * C3)),  t = m - 1
+
+    Within 0.0009 (0.003 dB) everywhere, against a display step of 0.05 dB or more. Every kernel uses
+    the same polynomial and operation order, other than FMA contraction in the AVX2 one.
+*/
+#define DSP_SPECTRUM_LOG2_C1    1.4231016f
+#define DSP_SPECTRUM_LOG2_C2    -0.5845250f
+#define DSP_SPECTRUM_LOG2_C3    0.1620769f
+/* 10 * log10(2), dB per octave of power */
+#define DSP_SPECTRUM_DB_LOG2    3.0103000f
+/* Keeps log2 away from 0 and denormals, -200 dB */
+#define DSP_SPECTRUM_FLOOR      1.0e-20f
+
+bool dsp_spectrum_init(dsp_spectrum_t *spectrum, int size, float smooth, float gain, float offset)
+{
+    spectrum->Size = size;
+    spectrum->Smooth = smooth;
+    spectrum->Gain = gain;
+    spectrum->Offset = offset;
+
+    spectrum->Power = (float *)malloc(size * sizeof(float));
+    spectrum->Staging = (float *)calloc(size, sizeof(float));
+
+    return (spectrum->Power != NULL && spectrum->Staging != NULL);
+}
+
+/* Power (in FFT order, times scale) to display bytes. The shift is folded into the two halves, so each runs over contiguous bins. */
+void dsp_spectrum_ff_u8(dsp_spectrum_t *spectrum, const float *power, float scale, uint8_t *output)
+{
+    int half = spectrum->Size / 2;
+
+    dsp_spectrum_db_u8(&power[half], spectrum->Staging, output, half, scale, spectrum->Smooth, spectrum->Gain, spectrum->Offset);
+    dsp_spectrum_db_u8(power, &spectrum->Staging[half], &output[half], half, scale, spectrum->Smooth, spectrum->Gain, spectrum->Offset);
+}
+
+/* Power already in display order (DC wherever it falls), Size long */
+void dsp_spectrum_display_ff_u8(dsp_spectrum_t *spectrum, const float *power, float scale, uint8_t *output)
+{
+    dsp_spectrum_db_u8(power, spectrum->Staging, output, spectrum->Size, scale, spectrum->Smooth, spectrum->Gain, spectrum->Offset);
+}
+
+/* As above from a complex FFT, scale is applied to |X|^2 (1 / N^2 for 0 dBFS at full scale) */
+void dsp_spectrum_cf_u8(dsp_spectrum_t *spectrum, const buffer_iqsample_t *fft, float scale, uint8_t *output)
+{
+    float *power = spectrum->Power;
+
+    for(int i = 0; i < spectrum->Size; i++)
+    {
+        power[i] = (fft[i].i * fft[i].i) + (fft[i].q * fft[i].q);
+    }
+
+    dsp_spectrum_ff_u8(spectrum, power, scale, output);
+}
+
+bool dsp_spectrum_reduce_parse(const char *name, dsp_spectrum_reduce_t *reduce)
+{
+    if(strcmp(name, "peak") == 0)
+    {
+        *reduce = DSP_SPECTRUM_REDUCE_PEAK;
+        return true;
+    }
+    if(strcmp(name, "mean") == 0)
+    {
+        *reduce = DSP_SPECTRUM_REDUCE_MEAN;
+        return true;
+    }
+    return false;
+}
+
+/* Each output is the peak or mean of factor consecutive inputs, in the linear power domain, so there is
+    one log per pixel rather than per bin. The loop over a group is a plain reduction that vectorizes, which is
+    where the time goes with large factors. Power isn't negative, so the peak is an integer max on the float's
+    bits (as the AGC envelope), fmaxf() doesn't vectorize because of its NaN rules. */
+void dsp_spectrum_reduce_ff(const float *input, float *output, int output_length, int factor, dsp_spectrum_reduce_t reduce)
+{
+    const float *group;
+    uint32_t bits, peak;
+    float sum;
+    const float mean_scale = 1.0f / factor;
+
+    for(int k = 0; k < output_length; k++)
+    {
+        group = &input[k * factor];
+
+        if(reduce == DSP_SPECTRUM_REDUCE_PEAK)
+        {
+            peak = 0;
+            for(int j = 0; j < factor; j++)
+            {
+                memcpy(&bits, &group[j], sizeof(bits));
+                peak = (bits > peak) ? bits : peak;
+            }
+            memcpy(&output[k], &peak, sizeof(peak));
+        }
+        else
+        {
+            sum = 0;
+            for(int j = 0; j < factor; j++)
+            {
+                sum += group[j];
+            }
+            output[k] = sum * mean_scale;
+        }
+    }
+}
+
+/* Reference implementation */
+void dsp_spectrum_db_u8_scalar(const float *power, float *staging, uint8_t *output, int length, float scale, float smooth, float gain, float offset)
+{
+    uint32_t bits;
+    float x, t, db;
+
+    for(int i = 0; i < length; i++)
+    {
+        x = (power[i] * scale) + DSP_SPECTRUM_FLOOR;
+
+        memcpy(&bits, &x, sizeof(bits));
+        db = (float)((int32_t)(bits >> 23) - 127);
+        bits = (bits & 0x007fffff) | 0x3f800000;
+        memcpy(&t, &bits, sizeof(t));
+        t -= 1.0f;
+        db += t * (DSP_SPECTRUM_LOG2_C1 + (t * (DSP_SPECTRUM_LOG2_C2 + (t * DSP_SPECTRUM_LOG2_C3))));
+        db *= DSP_SPECTRUM_DB_LOG2;
+
+        db += smooth * (staging[i] - db);
+        staging[i] = db;
+
+        x = gain * (db + offset);
+        x = (x < 0.0f) ? 0.0f : x;
+        x = (x > 255.0f) ? 255.0f : x;
+        output[i] = (uint8_t)x;
+    }
+}
+
+#if defined(__ARM_NEON)
+
+static inline float32x4_t dsp_spectrum_db_neon(float32x4_t x)
+{
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    int32x4_t bits = vreinterpretq_s32_f32(x);
+    float32x4_t exponent, t, poly;
+
+    exponent = vcvtq_f32_s32(vsubq_s32(vshrq_n_s32(bits, 23), vdupq_n_s32(127)));
+    t = vsubq_f32(vreinterpretq_f32_s32(vorrq_s32(vandq_s32(bits, vdupq_n_s32(0x007fffff)), vdupq_n_s32(0x3f800000))), one);
+
+    poly = vmlaq_f32(vdupq_n_f32(DSP_SPECTRUM_LOG2_C2), t, vdupq_n_f32(DSP_SPECTRUM_LOG2_C3));
+    poly = vmlaq_f32(vdupq_n_f32(DSP_SPECTRUM_LOG2_C1), t, poly);
+
+    return vmulq_f32(vmlaq_f32(exponent, t, poly), vdupq_n_f32(DSP_SPECTRUM_DB_LOG2));
+}
+
+/* 8 bins per iteration, vcvtq_u32_f32 truncates like the scalar cast and vqmovn packs down to bytes */
+void dsp_spectrum_db_u8_neon(const float *power, float *staging, uint8_t *output, int length, float scale, float smooth, float gain, float offset)
+{
+    const float32x4_t v_scale = vdupq_n_f32(scale);
+    const float32x4_t v_floor = vdupq_n_f32(DSP_SPECTRUM_FLOOR);
+    const float32x4_t v_smooth = vdupq_n_f32(smooth);
+    const float32x4_t v_gain = vdupq_n_f32(gain);
+    const float32x4_t v_offset = vdupq_n_f32(offset);
+    const float32x4_t v_zero = vdupq_n_f32(0.0f);
+    const float32x4_t v_max = vdupq_n_f32(255.0f);
+    float32x4_t db[2], x;
+    uint16x4_t packed[2];
+    int i, h;
+
+    for(i = 0; i + 8 <= length; i += 8)
+    {
+        for(h = 0; h < 2; h++)
+        {
+            db[h] = dsp_spectrum_db_neon(vmlaq_f32(v_floor, vld1q_f32(&power[i + (4 * h)]), v_scale));
+            db[h] = vmlaq_f32(db[h], v_smooth, vsubq_f32(vld1q_f32(&staging[i + (4 * h)]), db[h]));
+            vst1q_f32(&staging[i + (4 * h)], db[h]);
+
+            x = vmulq_f32(v_gain, vaddq_f32(db[h], v_offset));
+            x = vminq_f32(vmaxq_f32(x, v_zero), v_max);
+            packed[h] = vqmovn_u32(vcvtq_u32_f32(x));
+        }
+        vst1_u8(&output[i], vqmovn_u16(vcombine_u16(packed[0], packed[1])));
+    }
+
+    dsp_spectrum_db_u8_scalar(&power[i], &staging[i], &output[i], length - i, scale, smooth, gain, offset);
+}
+
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse2")))
+static inline __m128 dsp_spectrum_db_sse(__m128 x)
+{
+    __m128i bits = _mm_castps_si128(x);
+    __m128 exponent, t, poly;
+
+    exponent = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+    t = _mm_sub_ps(_mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)), _mm_set1_epi32(0x3f800000))), _mm_set1_ps(1.0f));
+
+    poly = _mm_add_ps(_mm_set1_ps(DSP_SPECTRUM_LOG2_C2), _mm_mul_ps(t, _mm_set1_ps(DSP_SPECTRUM_LOG2_C3)));
+    poly = _mm_add_ps(_mm_set1_ps(DSP_SPECTRUM_LOG2_C1), _mm_mul_ps(t, poly));
+
+    return _mm_mul_ps(_mm_add_ps(exponent, _mm_mul_ps(t, poly)), _mm_set1_ps(DSP_SPECTRUM_DB_LOG2));
+}
+
+/* 8 bins per iteration, clamped in float so the saturating packs never come into it */
+__attribute__((target("sse2")))
+void dsp_spectrum_db_u8_sse(const float *power, float *staging, uint8_t *output, int length, float scale, float smooth, float gain, float offset)
+{
+    const __m128 v_scale = _mm_set1_ps(scale);
+    const __m128 v_floor = _mm_set1_ps(DSP_SPECTRUM_FLOOR);
+    const __m128 v_smooth = _mm_set1_ps(smooth);
+    const __m128 v_gain = _mm_set1_ps(gain);
+    const __m128 v_offset = _mm_set1_ps(offset);
+    const __m128 v_zero = _mm_setzero_ps();
+    const __m128 v_max = _mm_set1_ps(255.0f);
+    __m128 db, x;
+    __m128i packed[2];
+    int i, h;
+
+    for(i = 0; i + 8 <= length; i += 8)
+    {
+        for(h = 0; h < 2; h++)
+        {
+            db = dsp_spectrum_db_sse(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&power[i + (4 * h)]), v_scale), v_floor));
+            db = _mm_add_ps(db, _mm_mul_ps(v_smooth, _mm_sub_ps(_mm_loadu_ps(&staging[i + (4 * h)]), db)));
+            _mm_storeu_ps(&staging[i + (4 * h)], db);
+
+            x = _mm_mul_ps(v_gain, _mm_add_ps(db, v_offset));
+            x = _mm_min_ps(_mm_max_ps(x, v_zero), v_max);
+            packed[h] = _mm_cvttps_epi32(x);
+        }
+        packed[0] = _mm_packs_epi32(packed[0], packed[1]);
+        _mm_storel_epi64((__m128i *)&output[i], _mm_packus_epi16(packed[0], packed[0]));
+    }
+
+    dsp_spectrum_db_u8_scalar(&power[i], &staging[i], &output[i], length - i, scale, smooth, gain, offset);
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 dsp_spectrum_db_avx2(__m256 x)
+{
+    __m256i bits = _mm256_castps_si256(x);
+    __m256 exponent, t, poly;
+
+    exponent = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+    t = _mm256_sub_ps(_mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)), _mm256_set1_epi32(0x3f800000))), _mm256_set1_ps(1.0f));
+
+    poly = _mm256_fmadd_ps(t, _mm256_set1_ps(DSP_SPECTRUM_LOG2_C3), _mm256_set1_ps(DSP_SPECTRUM_LOG2_C2));
+    poly = _mm256_fmadd_ps(t, poly, _mm256_set1_ps(DSP_SPECTRUM_LOG2_C1));
+
+    return _mm256_mul_ps(_mm256_fmadd_ps(t, poly, exponent), _mm256_set1_ps(DSP_SPECTRUM_DB_LOG2));
+}
+
+/* 16 bins per iteration. The packs work within 128-bit lanes, so the bytes are put back in order with a permute */
+__attribute__((target("avx2,fma")))
+void dsp_spectrum_db_u8_avx2(const float *power, float *staging, uint8_t *output, int length, float scale, float smooth, float gain, float offset)
+{
+    const __m256 v_scale = _mm256_set1_ps(scale);
+    const __m256 v_floor = _mm256_set1_ps(DSP_SPECTRUM_FLOOR);
+    const __m256 v_smooth = _mm256_set1_ps(smooth);
+    const __m256 v_gain = _mm256_set1_ps(gain);
+    const __m256 v_offset = _mm256_set1_ps(offset);
+    const __m256 v_zero = _mm256_setzero_ps();
+    const __m256 v_max = _mm256_set1_ps(255.0f);
+    __m256 db, x;
+    __m256i packed[2];
+    __m128i bytes;
+    int i, h;
+
+    for(i = 0; i + 16 <= length; i += 16)
+    {
+        for(h = 0; h < 2; h++)
+        {
+            db = dsp_spectrum_db_avx2(_mm256_fmadd_ps(_mm256_loadu_ps(&power[i + (8 * h)]), v_scale, v_floor));
+            db = _mm256_fmadd_ps(v_smooth, _mm256_sub_ps(_mm256_loadu_ps(&staging[i + (8 * h)]), db), db);
+            _mm256_storeu_ps(&staging[i + (8 * h)], db);
+
+            x = _mm256_mul_ps(v_gain, _mm256_add_ps(db, v_offset));
+            x = _mm256_min_ps(_mm256_max_ps(x, v_zero), v_max);
+            packed[h] = _mm256_cvttps_epi32(x);
+        }
+        /* 16-bit [a0-3 b0-3 | a4-7 b4-7], the permute puts all of a ahead of b, then down to bytes */
+        packed[0] = _mm256_packs_epi32(packed[0], packed[1]);
+        packed[0] = _mm256_permute4x64_epi64(packed[0], _MM_SHUFFLE(3, 1, 2, 0));
+        bytes = _mm_packus_epi16(_mm256_castsi256_si128(packed[0]), _mm256_extracti128_si256(packed[0], 1));
+        _mm_storeu_si128((__m128i *)&output[i], bytes);
+    }
+
+    dsp_spectrum_db_u8_sse(&power[i], &staging[i], &output[i], length - i, scale, smooth, gain, offset);
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef __DSP_SPECTRUM_H__
+#define __DSP_SPECTRUM_H__
+
+#include "dsp.h"
+
+/* Bins to pixels, by the largest (signals stay visible) or the average (noise floor stays put) of each group */
+typedef enum {
+    DSP_SPECTRUM_REDUCE_PEAK = 0,
+    DSP_SPECTRUM_REDUCE_MEAN
+} dsp_spectrum_reduce_t;
+
+/* FFT output (or summed power) to display bytes: shift to DC in the middle, dB, smoothing in dB, scale, clamp.
+    The display value is Gain * (dB + Offset), clamped to 0 - 255. */
+typedef struct {
+    int Size;
+    /* 0 - 1, weight of the previous frame */
+    float Smooth;
+    float Gain;
+    float Offset;
+
+    /* |X|^2 for dsp_spectrum_cf_u8(), in FFT order */
+    float *Power;
+    /* Smoothed dB, in display order */
+    float *Staging;
+} dsp_spectrum_t;
+
+bool dsp_spectrum_init(dsp_spectrum_t *spectrum, int size, float smooth, float gain, float offset);
+void dsp_spectrum_ff_u8(dsp_spectrum_t *spectrum, const float *power, float scale, uint8_t *output);
+void dsp_spectrum_display_ff_u8(dsp_spectrum_t *spectrum, const float *power, float scale, uint8_t *output);
+void dsp_spectrum_cf_u8(dsp_spectrum_t *spectrum, const buffer_iqsample_t *fft, float scale, uint8_t *output);
+
+bool dsp_spectrum_reduce_parse(const char *name, dsp_spectrum_reduce_t *reduce);
+void dsp_spectrum_reduce_ff(const float *input, float *output, int output_length, int factor, dsp_spectrum_reduce_t reduce);
+
+/* Per instruction set implementations, only for use by dsp_init() */
+void dsp_spectrum_db_u8_scalar(const float *power, float *staging, uint8_t *output, int length, float scale, float smooth, float gain, float offset);
+#if defined(__ARM_NEON)
+void dsp_spectrum_db_u8_neon(const float *power, float *staging, uint8_t *output, int length, float scale, float smooth, float gain, float offset);
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+void dsp_spectrum_db_u8_sse(const float *power, float *staging, uint8_t *output, int length, float scale, float smooth, float gain, float offset);
+void dsp_spectrum_db_u8_avx2(const float *power, float *staging, uint8_t *output, int length, float scale, float smooth, float gain, float offset);
+#endif
+
+#endif /* __DSP_SPECTRUM_H__ */
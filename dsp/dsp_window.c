@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "dsp_window.h"
+
+/*
+    Window functions, shared by the filter designers and the spectrum displays.
+
+    Kernels take rate from -1 to 1 across the window, 0 at the centre (as in csdr's firdes).
+    The cosine-sum windows are a0 - a1 cos(2 pi x) + a2 cos(4 pi x) - ..., x = 0 to 1:
+
+        Hamming         0.54, 0.46                                      -43 dB sidelobes, fastest rolloff
+        Hann            0.5, 0.5                                        -31 dB, sidelobes fall 18 dB/octave
+        Blackman        0.42, 0.5, 0.08                                 -58 dB
+        Blackman-Harris 0.35875, 0.48829, 0.14128, 0.01168              -92 dB, for wide dynamic range displays
+        Flat-top        0.21557895, 0.41663158, 0.277263158,
+                        0.083578947, 0.006947368                        < 0.01 dB scalloping, for reading levels off an FFT
+
+    Kaiser trades main lobe width against sidelobe level through beta, dsp_window_kaiser_beta() gives the beta
+    for a stopband attenuation and dsp_window_kaiser_length() the shortest filter that reaches it (Kaiser's estimates).
+*/
+
+static float window_cosine_sum(const double *a, int terms, float rate)
+{
+    double x = 0.5 + rate / 2;
+    double sum = 0;
+
+    for(int k = 0; k < terms; k++)
+    {
+        sum += ((k % 2) ? -a[k] : a[k]) * cos(2 * M_PI * k * x);
+    }
+    return sum;
+}
+
+/* Zeroth order modified Bessel function of the first kind, power series */
+static double window_bessel_i0(double x)
+{
+    double term = 1.0;
+    double sum = 1.0;
+
+    for(int k = 1; k < 64 && term > (sum * 1e-12); k++)
+    {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+static float window_kernel_kaiser(float rate, float beta)
+{
+    double r = 1.0 - ((double)rate * rate);
+
+    return window_bessel_i0(beta * sqrt((r > 0) ? r : 0)) / window_bessel_i0(beta);
+}
+
+/* beta is only used by DSP_WINDOW_KAISER */
+float dsp_window_kernel(dsp_window_t window, float rate, float beta)
+{
+    static const double hamming[] = { 0.54, 0.46 };
+    static const double hann[] = { 0.5, 0.5 };
+    static const double blackman[] = { 0.42, 0.5, 0.08 };
+    static const double blackman_harris[] = { 0.35875, 0.48829, 0.14128, 0.01168 };
+    static const double flattop[] = { 0.21557895, 0.41663158, 0.277263158, 0.083578947, 0.006947368 };
+
+    switch(window)
+    {
+        case DSP_WINDOW_HANN: return window_cosine_sum(hann, 2, rate);
+        case DSP_WINDOW_BLACKMAN: return window_cosine_sum(blackman, 3, rate);
+        case DSP_WINDOW_BLACKMAN_HARRIS: return window_cosine_sum(blackman_harris, 4, rate);
+        case DSP_WINDOW_KAISER: return window_kernel_kaiser(rate, beta);
+        case DSP_WINDOW_FLATTOP: return window_cosine_sum(flattop, 5, rate);
+        case DSP_WINDOW_BOXCAR: return 1.0;
+        case DSP_WINDOW_HAMMING:
+        default: return window_cosine_sum(hamming, 2, rate);
+    }
+}
+
+/* Fills a table of length values. Periodic windows (length + 1 point symmetric, last point dropped)
+    are the right ones for FFT analysis, symmetric ones for FIR filters. */
+void dsp_window_table_f(float *output, int length, dsp_window_t window, float beta, bool periodic)
+{
+    int span = periodic ? length : (length - 1);
+
+    if(span < 1)
+    {
+        for(int i = 0; i < length; i++) output[i] = 1.0;
+        return;
+    }
+
+    for(int i = 0; i < length; i++)
+    {
+        output[i] = dsp_window_kernel(window, ((2.0 * i) / span) - 1.0, beta);
+    }
+}
+
+/* Kaiser beta for a stopband attenuation in dB */
+float dsp_window_kaiser_beta(float attenuation)
+{
+    if(attenuation > 50)
+    {
+        return 0.1102 * (attenuation - 8.7);
+    }
+    else if(attenuation >= 21)
+    {
+        return (0.5842 * pow(attenuation - 21, 0.4)) + (0.07886 * (attenuation - 21));
+    }
+    return 0.0;
+}
+
+/* Kaiser's order estimate, taps for a transition band (relative to sampling frequency) and stopband attenuation in dB, always odd */
+int dsp_window_kaiser_length(float transition_bw, float attenuation)
+{
+    int length = (int)ceil(((attenuation - 7.95) / (14.36 * transition_bw)) + 1);
+
+    if(length < 3) length = 3;
+    if(length % 2 == 0) length++;
+    return length;
+}
@@ -0,0 +1,21 @@
+#ifndef __DSP_WINDOW_H__
+#define __DSP_WINDOW_H__
+
+#include <stdbool.h>
+
+typedef enum {
+    DSP_WINDOW_HAMMING = 0,
+    DSP_WINDOW_HANN,
+    DSP_WINDOW_BLACKMAN,
+    DSP_WINDOW_BLACKMAN_HARRIS,
+    DSP_WINDOW_KAISER,
+    DSP_WINDOW_FLATTOP,
+    DSP_WINDOW_BOXCAR
+} dsp_window_t;
+
+float dsp_window_kernel(dsp_window_t window, float rate, float beta);
+void dsp_window_table_f(float *output, int length, dsp_window_t window, float beta, bool periodic);
+float dsp_window_kaiser_beta(float attenuation);
+int dsp_window_kaiser_length(float transition_bw, float attenuation);
+
+#endif /* __DSP_WINDOW_H__ */
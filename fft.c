@@ -15,158 +15,327 @@
 #include <fftw3.h>
 
 #include "timing.h"
-#include "lime.h"
+#include "fft_planner.h"
 #include "graphics.h"
-
-/* Input from lime.c */
-extern lime_fft_buffer_t lime_fft_buffer;
-
-#define FFT_SIZE    512 //2048
-//#define FFT_TIME_SMOOTH 0.999f // 0.0 - 1.0
-#define FFT_TIME_SMOOTH 0.96f // 0.0 - 1.0
-
-static float hanning_window_const[FFT_SIZE];
-static float hamming_window_const[FFT_SIZE];
+#include "buffer/buffer_circular.h"
+#include "dsp/dsp_window.h"
+#include "dsp/dsp_spectrum.h"
+
+/* Band FFT points, any power of two in this range */
+#define FFT_SIZE_MIN    512
+#define FFT_SIZE_MAX    65536
+/* Main waterfall pixels, bins are reduced down to these */
+#define FFT_DISPLAY_WIDTH   512
+/* One spectrum per display period of samples (not wall-clock), so the rate doesn't depend on scheduling.
+    Never shorter than a hop, which is 64ms at 65536 points */
+#define FFT_DISPLAY_PERIOD_MS   50
+/* Longest integration, in display periods */
+#define FFT_INTEGRATION_PERIODS_MAX 40
+
+/* Set before main_fft_init() */
+/* FFT points, 1 KHz per bin at 512 */
+int fft_size = 512;
+/* Integration time (ms). Shorter than the display period only analyses that much of each period */
+int fft_integration_ms = 100;
+/* Shows 1 / fft_zoom of the band around the selected frequency, at most one bin per pixel */
+int fft_zoom = 1;
+dsp_spectrum_reduce_t fft_reduce = DSP_SPECTRUM_REDUCE_PEAK;
+
+/* Lime host sample rate */
+extern double bandwidth;
+
+extern int64_t center_frequency;
+extern int64_t selected_center_frequency;
+/* Part of the band on the main waterfall, for the markers and touch tuning */
+extern int64_t display_center_frequency;
+extern int64_t display_span_frequency;
+
+static float *window_const;
 
 static fftwf_complex* fft_in;
 static fftwf_complex* fft_out;
-static fftwf_plan fft_plan;
-
-static float fft_data_staging[FFT_SIZE];
-static float fft_scaled_data[FFT_SIZE];
-static uint8_t fft_data_output[FFT_SIZE];
-
-void main_fft_init(void)
+static fft_planner_plan_t fft_plan;
+
+/* Reads buffer_circular_iq_main alongside the demodulator, without ever holding up the Lime */
+static buffer_circular_reader_t *fft_reader;
+/* Skip ahead to the newest samples when further behind than this, a few Lime blocks (8192) and frames */
+static uint32_t fft_max_backlog;
+
+/* Welch estimate: Hann frames overlapped by half, power averaged over the integration time */
+static int fft_hop;
+
+/* Sample counts derived from fft_integration_ms */
+static uint32_t fft_period_samples;
+static uint32_t fft_period_frames;
+static int fft_integration_periods;
+
+/* Summed power of each display period in the integration, unshifted (fft_size each), and the frames in each */
+static float *fft_period_power;
+static uint32_t fft_period_frame_count[FFT_INTEGRATION_PERIODS_MAX];
+
+/* Bins shown, display order (DC at fft_size / 2), and the bins per pixel */
+static int fft_display_start;
+static int fft_display_span;
+static int fft_display_factor;
+
+/* Display scaling 20 * (dBFS + 65), no smoothing on top of the integration.
+    The offset was 68 for the old estimate, which only had half the power. */
+static dsp_spectrum_t fft_spectrum;
+static float *fft_power;
+static float fft_display_power[FFT_DISPLAY_WIDTH];
+static uint8_t fft_data_output[FFT_DISPLAY_WIDTH];
+
+bool main_fft_init(void)
 {
-    for(int i=0; i<FFT_SIZE; i++)
+    uint32_t integration_samples;
+
+    if(fft_size < FFT_SIZE_MIN || fft_size > FFT_SIZE_MAX || (fft_size & (fft_size - 1)) != 0)
+    {
+        fprintf(stderr, "FFT: Error, size %d is not a power of two from %d to %d\n", fft_size, FFT_SIZE_MIN, FFT_SIZE_MAX);
+        return false;
+    }
+    if(fft_zoom < 1 || (fft_zoom & (fft_zoom - 1)) != 0 || (fft_size / fft_zoom) < FFT_DISPLAY_WIDTH)
     {
-        /* Hanning */
-        hanning_window_const[i] = 0.5 * (1.0 - cos(2*M_PI*(((float)i)/FFT_SIZE)));
+        fprintf(stderr, "FFT: Error, zoom %d is not a power of two from 1 to %d\n", fft_zoom, fft_size / FFT_DISPLAY_WIDTH);
+        return false;
+    }
+    fft_hop = fft_size / 2;
+    fft_display_span = fft_size / fft_zoom;
+    fft_display_factor = fft_display_span / FFT_DISPLAY_WIDTH;
+    fft_display_start = (fft_size - fft_display_span) / 2;
+
+    /* Hann, periodic */
+    window_const = (float *)malloc(fft_size * sizeof(float));
+    if(window_const == NULL)
+    {
+        fprintf(stderr, "FFT: Error allocating buffers\n");
+        return false;
+    }
+    dsp_window_table_f(window_const, fft_size, DSP_WINDOW_HANN, 0, true);
 
-        /* Hamming */
-        hamming_window_const[i] = 0.54 - (0.46 * cos(2*M_PI*(0.5+((2.0*((float)i/(FFT_SIZE-1))+1.0)/2))));
+    if(!dsp_spectrum_init(&fft_spectrum, FFT_DISPLAY_WIDTH, 0.0, 20.0, 65.0))
+    {
+        fprintf(stderr, "FFT: Error allocating spectrum buffers\n");
+        return false;
     }
 
+
     /* Set up FFTW */
-    fft_in = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * FFT_SIZE);
-    fft_out = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * FFT_SIZE);
-    fft_plan = fftwf_plan_dft_1d(FFT_SIZE, fft_in, fft_out, FFTW_FORWARD, FFTW_PATIENT);
-    printf(" "); fftwf_print_plan(fft_plan); printf("\n");
+    fft_in = (fftwf_complex*) fft_planner_alloc(sizeof(fftwf_complex) * fft_size);
+    fft_out = (fftwf_complex*) fft_planner_alloc(sizeof(fftwf_complex) * fft_size);
+    if(fft_in == NULL || fft_out == NULL || !fft_planner_add(&fft_plan, "Main Band FFT", FFT_PLANNER_FORWARD, fft_size, fft_in, fft_out))
+    {
+        return false;
+    }
+
+    fft_max_backlog = (4 * fft_size > 32768) ? (4 * fft_size) : 32768;
+    fft_reader = buffer_circular_readerAdd(&buffer_circular_iq_main, BUFFER_CIRCULAR_READER_LATEST, fft_max_backlog);
+
+    /* Welch parameters, the CPU use is fixed by these: at most fft_period_frames FFTs per display period */
+    if(fft_integration_ms < 1) fft_integration_ms = 1;
+    integration_samples = (bandwidth * fft_integration_ms) / 1000;
+    fft_period_samples = (bandwidth * FFT_DISPLAY_PERIOD_MS) / 1000;
+    if(fft_period_samples < (uint32_t)fft_hop) fft_period_samples = fft_hop;
+    fft_integration_periods = (integration_samples + fft_period_samples - 1) / fft_period_samples;
+    if(fft_integration_periods < 1) fft_integration_periods = 1;
+    if(fft_integration_periods > FFT_INTEGRATION_PERIODS_MAX) fft_integration_periods = FFT_INTEGRATION_PERIODS_MAX;
+    fft_period_frames = ((integration_samples < fft_period_samples) ? integration_samples : fft_period_samples) / fft_hop;
+    if(fft_period_frames < 1) fft_period_frames = 1;
+
+    fft_period_power = (float *)calloc((size_t)fft_integration_periods * fft_size, sizeof(float));
+    fft_power = (float *)malloc(fft_size * sizeof(float));
+    if(fft_period_power == NULL || fft_power == NULL)
+    {
+        fprintf(stderr, "FFT: Error allocating buffers\n");
+        return false;
+    }
+
+    printf("   Welch: %d points, %d frames per %dms, averaged over %d periods\n",
+        fft_size, fft_period_frames, (int)((1000 * fft_period_samples) / bandwidth), fft_integration_periods);
+    printf("   Display: %d bins (%.0f Hz each), %d per pixel (%s)\n", fft_display_span, bandwidth / fft_size, fft_display_factor,
+        (fft_reduce == DSP_SPECTRUM_REDUCE_PEAK) ? "peak" : "mean");
+
+    return true;
 }
 
 static void fft_fftw_close(void)
 {
-    /* De-init fftw */
-    fftwf_free(fft_in);
-    fftwf_free(fft_out);
-    fftwf_destroy_plan(fft_plan);
-    fftwf_forget_wisdom();
+    /* De-init fftw, the plan belongs to the planner */
+    fft_planner_free(fft_in);
+    fft_planner_free(fft_out);
+
+    free(window_const);
+    free(fft_period_power);
+    free(fft_power);
 }
 
-/* FFT Thread */
-void *fft_thread(void *arg)
+/* Moves the zoomed span to the selected frequency when it gets near an edge, so it doesn't slide while tuning.
+    The start stays a whole number of pixels, so a signal keeps to the same pixel and the halves either side of DC
+    split on a pixel boundary. */
+static void fft_display_window(void)
 {
-    bool *exit_requested = (bool *)arg;
+    double bin_frequency = bandwidth / fft_size;
+    int margin = fft_display_span / 8;
+    int selected_bin;
 
-    int i, offset;
-    fftw_complex pt;
-    double pwr, lpwr;
-
-    double pwr_scale = 1.0 / ((float)FFT_SIZE * (float)FFT_SIZE);
+    if(fft_zoom > 1)
+    {
+        selected_bin = (fft_size / 2) + (int)((selected_center_frequency - center_frequency) / bin_frequency);
+        if(selected_bin < (fft_display_start + margin) || selected_bin >= (fft_display_start + fft_display_span - margin))
+        {
+            fft_display_start = (selected_bin - (fft_display_span / 2)) & ~(fft_display_factor - 1);
+            if(fft_display_start < 0) fft_display_start = 0;
+            if(fft_display_start > (fft_size - fft_display_span)) fft_display_start = fft_size - fft_display_span;
+        }
+    }
 
-    struct timespec ts;
+    display_center_frequency = center_frequency + (int64_t)((fft_display_start + (fft_display_span / 2) - (fft_size / 2)) * bin_frequency);
+    display_span_frequency = fft_display_span * bin_frequency;
+}
 
-    uint64_t last_output = monotonic_ms();
+/* Average the power over the integration, shift and reduce the span shown to pixels, convert to dBFS and render */
+static void fft_output(void)
+{
+    int i, p;
+    uint32_t frames = 0;
+    int half = fft_size / 2;
+    int start, end, split;
 
-    /* Set pthread timer on .signal to use monotonic clock */
-    pthread_condattr_t attr;
-    pthread_condattr_init(&attr);
-    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
-    pthread_cond_init (&lime_fft_buffer.signal, &attr);
-    pthread_condattr_destroy(&attr);
+    /* |X|^2 / N^2 is full scale at 0 dBFS (before the window's loss) */
+    float pwr_scale = 1.0 / ((float)fft_size * (float)fft_size);
 
-    while(false == *exit_requested)
+    for(p = 0; p < fft_integration_periods; p++)
+    {
+        frames += fft_period_frame_count[p];
+    }
+    if(frames == 0)
     {
-        /* Lock input buffer */
-        pthread_mutex_lock(&lime_fft_buffer.mutex);
+        return;
+    }
+    pwr_scale /= frames;
 
-        while(lime_fft_buffer.index >= (lime_fft_buffer.size/(FFT_SIZE * sizeof(float) * 2))
-            && false == *exit_requested)
+    memcpy(fft_power, fft_period_power, fft_size * sizeof(float));
+    for(p = 1; p < fft_integration_periods; p++)
+    {
+        for (i = 0; i < fft_size; i++)
         {
-            /* Set timer for 100ms */
-            clock_gettime(CLOCK_MONOTONIC, &ts);
-            ts.tv_nsec += 10 * 1000000;
-
-            pthread_cond_timedwait(&lime_fft_buffer.signal, &lime_fft_buffer.mutex, &ts);
+            fft_power[i] += fft_period_power[((size_t)p * fft_size) + i];
         }
+    }
 
-        if(*exit_requested)
-        {
-            break;
-        }
+    /* Display order is the FFT's second half then its first, the span is reduced from each side of DC in place */
+    fft_display_window();
+    start = fft_display_start;
+    end = fft_display_start + fft_display_span;
+    split = (start < half) ? ((end < half) ? end : half) : start;
+    if(split > start)
+    {
+        dsp_spectrum_reduce_ff(&fft_power[start + half], fft_display_power, (split - start) / fft_display_factor, fft_display_factor, fft_reduce);
+    }
+    if(end > split)
+    {
+        dsp_spectrum_reduce_ff(&fft_power[split - half], &fft_display_power[(split - start) / fft_display_factor],
+            (end - split) / fft_display_factor, fft_display_factor, fft_reduce);
+    }
 
-        offset = lime_fft_buffer.index * FFT_SIZE * 2;
+    /* normalize, convert to dBFS and scale */
+    dsp_spectrum_display_ff_u8(&fft_spectrum, fft_display_power, pwr_scale, fft_data_output);
 
-        /* Copy data out of rf buffer into fft_input buffer */
-        for (i = 0; i < FFT_SIZE; i++)
-        {
-            fft_in[i][0] = (((float*)lime_fft_buffer.data)[offset+(2*i)]+0.00048828125) * hanning_window_const[i];
-            fft_in[i][1] = (((float*)lime_fft_buffer.data)[offset+(2*i)+1]+0.00048828125) * hanning_window_const[i];
-        }
+    //ws_fft_submit((uint8_t *)fft_spectrum.Staging, (FFT_DISPLAY_WIDTH * sizeof(float)));
+
+    waterfall_render_fft(fft_data_output);
+}
+
+/* FFT Thread */
+void *fft_thread(void *arg)
+{
+    bool *exit_requested = (bool *)arg;
 
-        lime_fft_buffer.index++;
+    int i, j, k;
+    uint32_t length;
 
-        /* Unlock input buffer */
-        pthread_mutex_unlock(&lime_fft_buffer.mutex);
+    buffer_circular_span_t spans[2];
+    buffer_iqsample_t *samples;
 
-        /* Run FFT */
-        fftwf_execute(fft_plan);
+    /* Current display period, its summed power, and the samples it has taken from the buffer */
+    int period = 0;
+    float *power = fft_period_power;
+    uint32_t period_samples = 0;
 
-        //float int_max = -9999.0;
-        //float int_min = 9999.0;
+    if(fft_reader == NULL)
+    {
+        fprintf(stderr, "FFT: Error, no reader available on IQ Main buffer\n");
+        return NULL;
+    }
 
-        for (i = 0; i < FFT_SIZE; i++)
+    while(false == *exit_requested)
+    {
+        if(fft_period_frame_count[period] >= fft_period_frames)
         {
-            /* shift, normalize and convert to dBFS */
-            if (i < FFT_SIZE / 2)
+            /* Integration done for this period, pass over the rest of its samples */
+            length = buffer_circular_readerPeek(&buffer_circular_iq_main, fft_reader, fft_period_samples - period_samples, spans);
+            if(length == 0)
             {
-                pt[0] = fft_out[FFT_SIZE / 2 + i][0] / FFT_SIZE;
-                pt[1] = fft_out[FFT_SIZE / 2 + i][1] / FFT_SIZE;
+                sleep_ms(10);
+                continue;
             }
-            else
+            buffer_circular_readerRelease(&buffer_circular_iq_main, fft_reader, length);
+            period_samples += length;
+        }
+        else
+        {
+            /* Peek the whole backlog, so a skip ahead keeps that much rather than just the newest frame */
+            if(buffer_circular_readerPeek(&buffer_circular_iq_main, fft_reader, fft_max_backlog, spans) < (uint32_t)fft_size)
             {
-                pt[0] = fft_out[i - FFT_SIZE / 2][0] / FFT_SIZE;
-                pt[1] = fft_out[i - FFT_SIZE / 2][1] / FFT_SIZE;
+                /* Lime delivers in large blocks, so poll rather than wake on every push */
+                sleep_ms(10);
+                continue;
             }
-            pwr = pwr_scale * (pt[0] * pt[0]) + (pt[1] * pt[1]);
-            lpwr = 10.f * log10(pwr + 1.0e-20);
-            
-            fft_data_staging[i] = (lpwr * (1.f - FFT_TIME_SMOOTH)) + (fft_data_staging[i] * FFT_TIME_SMOOTH);
-
-            //printf("%f\n", fft_data_staging[i]);
 
-            fft_scaled_data[i] = 20 * (fft_data_staging[i] + 68);
+            /* Copy data out of rf buffer into fft_input buffer */
+            i = 0;
+            for (j = 0; j < 2; j++)
+            {
+                samples = (buffer_iqsample_t *)spans[j].Data;
+                for (k = 0; k < (int)spans[j].Length && i < fft_size; k++, i++)
+                {
+                    fft_in[i][0] = (samples[k].i+0.00048828125) * window_const[i];
+                    fft_in[i][1] = (samples[k].q+0.00048828125) * window_const[i];
+                }
+            }
 
-            //if(fft_scaled_data[i] > int_max) int_max = fft_scaled_data[i];
-            //if(fft_scaled_data[i] < int_min) int_min = fft_scaled_data[i];
+            /* Move on by a hop, the second half of this frame starts the next */
+            period_samples += fft_hop;
+            if(!buffer_circular_readerRelease(&buffer_circular_iq_main, fft_reader, fft_hop))
+            {
+                /* Overwritten by the Lime while copying, drop this frame */
+                continue;
+            }
 
-            if(fft_scaled_data[i] < 0) fft_scaled_data[i] = 0;
-            if(fft_scaled_data[i] > 255) fft_scaled_data[i] = 255;
+            /* Run FFT */
+            fft_planner_execute_dft(&fft_plan, fft_in, fft_out);
 
-            fft_data_output[i] = (uint8_t)(fft_scaled_data[i]);
+            for (i = 0; i < fft_size; i++)
+            {
+                power[i] += (fft_out[i][0] * fft_out[i][0]) + (fft_out[i][1] * fft_out[i][1]);
+            }
+            fft_period_frame_count[period]++;
         }
-        //printf("Max: %f, Min %f\n", int_max, int_min);
 
-        //ws_fft_submit((uint8_t *)fft_data_staging, (FFT_SIZE * sizeof(float)));
-
-        if(monotonic_ms() > (last_output + 50))
+        if(period_samples >= fft_period_samples)
         {
-            waterfall_render_fft(fft_data_output);
-            last_output = monotonic_ms();
+            fft_output();
+
+            /* Oldest period drops out of the integration */
+            period = (period + 1) % fft_integration_periods;
+            power = &fft_period_power[(size_t)period * fft_size];
+            memset(power, 0, fft_size * sizeof(float));
+            fft_period_frame_count[period] = 0;
+            period_samples -= fft_period_samples;
         }
     }
 
     fft_fftw_close();
 
     return NULL;
-}
\ No newline at end of file
+}
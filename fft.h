@@ -3,6 +3,13 @@
 
 void *fft_thread(void *arg);
 
-void main_fft_init(void);
+#include "dsp/dsp_spectrum.h"
+
+extern int fft_size;
+extern int fft_integration_ms;
+extern int fft_zoom;
+extern dsp_spectrum_reduce_t fft_reduce;
+
+bool main_fft_init(void);
 
 #endif /* __FFT_H__ */
\ No newline at end of file
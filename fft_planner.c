@@ -0,0 +1,509 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <fftw3.h>
+
+#include "fft_planner.h"
+#include "timing.h"
+
+/*
+    FFTW's planner isn't thread-safe, so every plan, destroy and wisdom call goes through fft_planner_mutex.
+    Executing plans is thread-safe and takes no lock.
+
+    Plans are made straight away from wisdom if there is some for this CPU, otherwise as FFTW_ESTIMATE, so startup
+    doesn't wait for measurements. fft_planner_thread() then measures each ESTIMATE plan to fft_planner_rigor
+    on its own scratch buffers (measuring overwrites them) and swaps the result in. The wisdom is saved after each plan,
+    so the next start with the same sizes on the same CPU gets the measured plans immediately.
+
+    Power of two complex transforms are then timed against the built-in FFT (dsp_fft), best of
+    FFT_PLANNER_BENCHMARK_ROUNDS, and whichever is faster is used from then on. That is redone every start, it is quick.
+*/
+
+/* Timed runs per backend, each of about FFT_PLANNER_BENCHMARK_POINTS points in total */
+#define FFT_PLANNER_BENCHMARK_ROUNDS    5
+#define FFT_PLANNER_BENCHMARK_POINTS    (1 << 18)
+
+unsigned fft_planner_rigor = FFTW_PATIENT;
+fft_planner_backend_t fft_planner_backend = FFT_PLANNER_BACKEND_AUTO;
+
+static pthread_mutex_t fft_planner_mutex = PTHREAD_MUTEX_INITIALIZER;
+static fft_planner_plan_t *fft_planner_plans = NULL;
+
+/* Empty if the wisdom can't be kept */
+static char fft_planner_wisdom_path[512];
+
+static const struct {
+    const char *name;
+    unsigned rigor;
+} fft_planner_rigors[] = {
+    { "measure",    FFTW_MEASURE },
+    { "patient",    FFTW_PATIENT },
+    { "exhaustive", FFTW_EXHAUSTIVE }
+};
+
+static const char *fft_planner_rigor_name(unsigned rigor)
+{
+    for(size_t i = 0; i < sizeof(fft_planner_rigors) / sizeof(fft_planner_rigors[0]); i++)
+    {
+        if(rigor == fft_planner_rigors[i].rigor)
+        {
+            return fft_planner_rigors[i].name;
+        }
+    }
+    return "estimate";
+}
+
+bool fft_planner_backend_parse(const char *name, fft_planner_backend_t *backend)
+{
+    if(strcmp(name, "auto") == 0)
+    {
+        *backend = FFT_PLANNER_BACKEND_AUTO;
+        return true;
+    }
+    if(strcmp(name, "fftw") == 0)
+    {
+        *backend = FFT_PLANNER_BACKEND_FFTW;
+        return true;
+    }
+    if(strcmp(name, "builtin") == 0)
+    {
+        *backend = FFT_PLANNER_BACKEND_BUILTIN;
+        return true;
+    }
+    return false;
+}
+
+bool fft_planner_rigor_parse(const char *name, unsigned *rigor)
+{
+    for(size_t i = 0; i < sizeof(fft_planner_rigors) / sizeof(fft_planner_rigors[0]); i++)
+    {
+        if(strcmp(name, fft_planner_rigors[i].name) == 0)
+        {
+            *rigor = fft_planner_rigors[i].rigor;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Measured plans are only good for the CPU they were measured on, eg. "aarch64-raspberry-pi-4-model-b-rev-1-4" or "x86_64-intel-r-core-tm-i5-8250u-cpu-1-60ghz" */
+static void fft_planner_cpu_key(char *key, size_t key_size)
+{
+    struct utsname system;
+    char line[256], model[128] = "unknown";
+    char *value;
+    FILE *cpuinfo;
+    size_t n = 0;
+    bool separator = false;
+    int rank, model_rank = 0;
+
+    cpuinfo = fopen("/proc/cpuinfo", "r");
+    if(cpuinfo != NULL)
+    {
+        /* Best first: "Model" (the board, ARM), "model name" (x86, and 32-bit ARM with just "ARMv7 Processor rev 3 (v7l)"),
+            "CPU part" (ARM). The ARM kernel puts "Model" last, after every core's lines, so the whole file is read */
+        while(fgets(line, sizeof(line), cpuinfo) != NULL)
+        {
+            value = strchr(line, ':');
+            if(value == NULL)
+            {
+                continue;
+            }
+            if(strncmp(line, "Model", 5) == 0)
+            {
+                rank = 3;
+            }
+            else if(strncmp(line, "model name", 10) == 0)
+            {
+                rank = 2;
+            }
+            else if(strncmp(line, "CPU part", 8) == 0)
+            {
+                rank = 1;
+            }
+            else
+            {
+                continue;
+            }
+            if(rank > model_rank)
+            {
+                snprintf(model, sizeof(model), "%s", value + 1);
+                model_rank = rank;
+            }
+        }
+        fclose(cpuinfo);
+    }
+
+    if(uname(&system) == 0)
+    {
+        n = snprintf(key, key_size, "%s-", system.machine);
+    }
+
+    /* Lowercase alphanumerics, anything else becomes a single '-' */
+    for(value = model; *value != '\0' && n < (key_size - 1); value++)
+    {
+        if(isalnum((unsigned char)*value))
+        {
+            if(separator && n > 0 && key[n - 1] != '-')
+            {
+                key[n++] = '-';
+                if(n >= (key_size - 1)) break;
+            }
+            key[n++] = tolower((unsigned char)*value);
+            separator = false;
+        }
+        else
+        {
+            separator = true;
+        }
+    }
+    key[n] = '\0';
+}
+
+/* $XDG_CACHE_HOME/txrx/ or ~/.cache/txrx/, one wisdom file per CPU */
+static bool fft_planner_wisdom_locate(void)
+{
+    char directory[384], cpu_key[96];
+    const char *base;
+
+    base = getenv("XDG_CACHE_HOME");
+    if(base != NULL && base[0] != '\0')
+    {
+        snprintf(directory, sizeof(directory), "%s", base);
+    }
+    else
+    {
+        base = getenv("HOME");
+        if(base == NULL || base[0] == '\0')
+        {
+            return false;
+        }
+        snprintf(directory, sizeof(directory), "%s/.cache", base);
+        mkdir(directory, 0755);
+    }
+    strncat(directory, "/txrx", sizeof(directory) - strlen(directory) - 1);
+    if(mkdir(directory, 0755) != 0 && access(directory, W_OK) != 0)
+    {
+        return false;
+    }
+
+    fft_planner_cpu_key(cpu_key, sizeof(cpu_key));
+    snprintf(fft_planner_wisdom_path, sizeof(fft_planner_wisdom_path), "%s/fftwf-wisdom-%s", directory, cpu_key);
+    return true;
+}
+
+/* Called with the mutex held. Written to a temporary file first so a crash or a second instance can't leave half a file */
+static void fft_planner_wisdom_save(void)
+{
+    char temporary[sizeof(fft_planner_wisdom_path) + 8];
+
+    if(fft_planner_wisdom_path[0] == '\0')
+    {
+        return;
+    }
+
+    snprintf(temporary, sizeof(temporary), "%s.%d", fft_planner_wisdom_path, (int)getpid());
+    if(fftwf_export_wisdom_to_filename(temporary) == 0 || rename(temporary, fft_planner_wisdom_path) != 0)
+    {
+        fprintf(stderr, "FFT Planner: Error saving wisdom to %s\n", fft_planner_wisdom_path);
+        unlink(temporary);
+    }
+}
+
+void fft_planner_init(void)
+{
+    pthread_mutex_lock(&fft_planner_mutex);
+
+    if(!fft_planner_wisdom_locate())
+    {
+        fft_planner_wisdom_path[0] = '\0';
+        printf("FFT Planner: No cache directory, plans will be measured every start\n");
+    }
+    else if(access(fft_planner_wisdom_path, R_OK) == 0)
+    {
+        if(fftwf_import_wisdom_from_filename(fft_planner_wisdom_path) != 0)
+        {
+            printf("FFT Planner: Wisdom loaded from %s\n", fft_planner_wisdom_path);
+        }
+        else
+        {
+            fprintf(stderr, "FFT Planner: Error reading wisdom from %s, ignoring it\n", fft_planner_wisdom_path);
+        }
+    }
+    else
+    {
+        printf("FFT Planner: No wisdom yet, it will be saved to %s\n", fft_planner_wisdom_path);
+    }
+
+    pthread_mutex_unlock(&fft_planner_mutex);
+}
+
+/* Buffers for any backend, SIMD aligned so FFTW plans never need FFTW_UNALIGNED */
+void *fft_planner_alloc(size_t size)
+{
+    return fftwf_malloc(size);
+}
+
+void fft_planner_free(void *buffer)
+{
+    fftwf_free(buffer);
+}
+
+/* Called with the mutex held */
+static fftwf_plan fft_planner_create(fft_planner_plan_t *plan, void *input, void *output, unsigned flags)
+{
+    if(!plan->aligned)
+    {
+        flags |= FFTW_UNALIGNED;
+    }
+
+    switch(plan->kind)
+    {
+        case FFT_PLANNER_FORWARD:
+            return fftwf_plan_dft_1d(plan->size, (fftwf_complex *)input, (fftwf_complex *)output, FFTW_FORWARD, flags);
+        case FFT_PLANNER_BACKWARD:
+            return fftwf_plan_dft_1d(plan->size, (fftwf_complex *)input, (fftwf_complex *)output, FFTW_BACKWARD, flags);
+        case FFT_PLANNER_C2R:
+            return fftwf_plan_dft_c2r_1d(plan->size, (fftwf_complex *)input, (float *)output, flags);
+    }
+    return NULL;
+}
+
+/* Neither planning with wisdom only nor FFTW_ESTIMATE touches the buffers, so they may be in use. They don't need to stay allocated */
+bool fft_planner_add(fft_planner_plan_t *plan, const char *name, fft_planner_kind_t kind, int size, void *input, void *output)
+{
+    fftwf_plan fftw_plan;
+
+    plan->name = name;
+    plan->kind = kind;
+    plan->size = size;
+    plan->in_place = (input == output);
+    plan->aligned = (fftwf_alignment_of((float *)input) == 0) && (fftwf_alignment_of((float *)output) == 0);
+    plan->retired = NULL;
+    plan->builtin.Reverse = NULL;
+    plan->builtin.Twiddles = NULL;
+    atomic_store(&plan->plan, NULL);
+    atomic_store(&plan->backend, FFT_PLANNER_BACKEND_FFTW);
+    /* Nothing to choose between for real transforms, or other than power of two sizes */
+    plan->benchmarked = (fft_planner_backend == FFT_PLANNER_BACKEND_FFTW) || (kind == FFT_PLANNER_C2R) || ((size & (size - 1)) != 0);
+
+    pthread_mutex_lock(&fft_planner_mutex);
+
+    if(fft_planner_backend == FFT_PLANNER_BACKEND_BUILTIN && !plan->benchmarked
+        && dsp_fft_init(&plan->builtin, size, kind == FFT_PLANNER_BACKWARD))
+    {
+        atomic_store(&plan->backend, FFT_PLANNER_BACKEND_BUILTIN);
+        plan->rigor = fft_planner_rigor;
+        plan->benchmarked = true;
+        plan->next = fft_planner_plans;
+        fft_planner_plans = plan;
+        pthread_mutex_unlock(&fft_planner_mutex);
+
+        printf("   %s: %d points, built-in\n", name, size);
+        return true;
+    }
+
+    plan->rigor = fft_planner_rigor;
+    fftw_plan = fft_planner_create(plan, input, output, fft_planner_rigor | FFTW_WISDOM_ONLY);
+    if(fftw_plan == NULL)
+    {
+        plan->rigor = FFTW_ESTIMATE;
+        fftw_plan = fft_planner_create(plan, input, output, FFTW_ESTIMATE);
+    }
+    if(fftw_plan == NULL)
+    {
+        pthread_mutex_unlock(&fft_planner_mutex);
+        fprintf(stderr, "FFT Planner: Error planning %s (%d points)\n", name, size);
+        return false;
+    }
+    atomic_store_explicit(&plan->plan, fftw_plan, memory_order_release);
+
+    plan->next = fft_planner_plans;
+    fft_planner_plans = plan;
+
+    pthread_mutex_unlock(&fft_planner_mutex);
+
+    printf("   %s: %d points, %s\n", name, size, (plan->rigor == FFTW_ESTIMATE) ? "estimated for now" : "from wisdom");
+    return true;
+}
+
+/* Best time of one transform in ns. The input is refilled every run, so in-place transforms time the same as out-of-place */
+static uint64_t fft_planner_time(fft_planner_plan_t *plan, fft_planner_backend_t backend, const buffer_iqsample_t *pattern, void *input, void *output)
+{
+    const int iterations = 1 + (FFT_PLANNER_BENCHMARK_POINTS / plan->size);
+    fftwf_plan fftw_plan = atomic_load(&plan->plan);
+    uint64_t start_ns, elapsed_ns, best_ns = UINT64_MAX;
+
+    for(int round = 0; round < FFT_PLANNER_BENCHMARK_ROUNDS; round++)
+    {
+        start_ns = monotonic_ns();
+        for(int i = 0; i < iterations; i++)
+        {
+            memcpy(input, pattern, plan->size * sizeof(buffer_iqsample_t));
+            if(backend == FFT_PLANNER_BACKEND_BUILTIN)
+            {
+                dsp_fft_execute(&plan->builtin, (const buffer_iqsample_t *)input, (buffer_iqsample_t *)output);
+            }
+            else
+            {
+                fftwf_execute_dft(fftw_plan, (fftwf_complex *)input, (fftwf_complex *)output);
+            }
+        }
+        elapsed_ns = monotonic_ns() - start_ns;
+        if(elapsed_ns < best_ns)
+        {
+            best_ns = elapsed_ns;
+        }
+    }
+
+    return best_ns / iterations;
+}
+
+/* Called with the mutex held, on the scratch buffers */
+static void fft_planner_benchmark(fft_planner_plan_t *plan, void *input, void *output)
+{
+    buffer_iqsample_t *pattern;
+    uint64_t fftw_ns, builtin_ns;
+
+    plan->benchmarked = true;
+
+    pattern = (buffer_iqsample_t *)malloc(plan->size * sizeof(buffer_iqsample_t));
+    if(pattern == NULL || !dsp_fft_init(&plan->builtin, plan->size, plan->kind == FFT_PLANNER_BACKWARD))
+    {
+        free(pattern);
+        return;
+    }
+    for(int i = 0; i < plan->size; i++)
+    {
+        pattern[i].i = (float)(i % 7) / 7.0f;
+        pattern[i].q = (float)(i % 5) / 5.0f;
+    }
+
+    fftw_ns = fft_planner_time(plan, FFT_PLANNER_BACKEND_FFTW, pattern, input, output);
+    builtin_ns = fft_planner_time(plan, FFT_PLANNER_BACKEND_BUILTIN, pattern, input, output);
+    free(pattern);
+
+    printf("FFT Planner: %s (%d points) FFTW %.2fus, built-in %.2fus, using %s\n", plan->name, plan->size,
+        fftw_ns / 1000.0, builtin_ns / 1000.0, (builtin_ns < fftw_ns) ? "built-in" : "FFTW");
+
+    if(builtin_ns < fftw_ns)
+    {
+        atomic_store_explicit(&plan->backend, FFT_PLANNER_BACKEND_BUILTIN, memory_order_release);
+    }
+    else
+    {
+        dsp_fft_free(&plan->builtin);
+    }
+}
+
+/* Background Planner Thread, finishes once every plan is at fft_planner_rigor and has its backend.
+    Runs at the lowest priority, measurements are done on spare CPU */
+void *fft_planner_thread(void *arg)
+{
+    bool *exit_requested = (bool *)arg;
+    fft_planner_plan_t *plan;
+    fftwf_plan fftw_plan;
+    void *input, *output;
+    uint64_t start_ms;
+
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19);
+
+    while(!(*exit_requested))
+    {
+        pthread_mutex_lock(&fft_planner_mutex);
+
+        /* Most recently added first, so the demodulators before the band FFT */
+        for(plan = fft_planner_plans; plan != NULL; plan = plan->next)
+        {
+            if(plan->rigor == FFTW_ESTIMATE || !plan->benchmarked)
+            {
+                break;
+            }
+        }
+        if(plan == NULL)
+        {
+            pthread_mutex_unlock(&fft_planner_mutex);
+            break;
+        }
+
+        /* Enough for the complex in and out of any kind, c2r included */
+        input = fft_planner_alloc((plan->size + 2) * sizeof(fftwf_complex));
+        output = plan->in_place ? input : fft_planner_alloc((plan->size + 2) * sizeof(fftwf_complex));
+        if(input == NULL || output == NULL)
+        {
+            /* Keep what there is rather than retry forever */
+            plan->rigor = fft_planner_rigor;
+            plan->benchmarked = true;
+        }
+
+        if(plan->rigor == FFTW_ESTIMATE)
+        {
+            start_ms = monotonic_ms();
+            fftw_plan = fft_planner_create(plan, input, output, fft_planner_rigor);
+            if(fftw_plan != NULL)
+            {
+                plan->retired = atomic_exchange_explicit(&plan->plan, fftw_plan, memory_order_acq_rel);
+                fft_planner_wisdom_save();
+                printf("FFT Planner: %s (%d points) now %s, took %.1fs\n", plan->name, plan->size,
+                    fft_planner_rigor_name(fft_planner_rigor), (monotonic_ms() - start_ms) / 1000.0);
+            }
+            else
+            {
+                fprintf(stderr, "FFT Planner: Error planning %s (%d points), keeping the estimated plan\n", plan->name, plan->size);
+            }
+            plan->rigor = fft_planner_rigor;
+        }
+
+        if(!plan->benchmarked)
+        {
+            fft_planner_benchmark(plan, input, output);
+        }
+
+        pthread_mutex_unlock(&fft_planner_mutex);
+
+        if(output != input)
+        {
+            fft_planner_free(output);
+        }
+        fft_planner_free(input);
+    }
+
+    return NULL;
+}
+
+/* Once nothing executes the plans anymore. If the planner thread is still measuring, the process is left to clean up */
+void fft_planner_close(void)
+{
+    fft_planner_plan_t *plan;
+
+    if(pthread_mutex_trylock(&fft_planner_mutex) != 0)
+    {
+        return;
+    }
+
+    for(plan = fft_planner_plans; plan != NULL; plan = plan->next)
+    {
+        if(atomic_load(&plan->plan) != NULL)
+        {
+            fftwf_destroy_plan(atomic_exchange(&plan->plan, NULL));
+        }
+        dsp_fft_free(&plan->builtin);
+        if(plan->retired != NULL)
+        {
+            fftwf_destroy_plan(plan->retired);
+            plan->retired = NULL;
+        }
+    }
+    fft_planner_plans = NULL;
+
+    pthread_mutex_unlock(&fft_planner_mutex);
+}
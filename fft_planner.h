@@ -0,0 +1,83 @@
+#ifndef __FFT_PLANNER_H__
+#define __FFT_PLANNER_H__
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <fftw3.h>
+
+#include "dsp/dsp_fft.h"
+
+typedef enum {
+    FFT_PLANNER_FORWARD = 0,
+    FFT_PLANNER_BACKWARD,
+    /* Complex to real, (size / 2 + 1) bins in and size samples out */
+    FFT_PLANNER_C2R
+} fft_planner_kind_t;
+
+/* FFTW, or dsp_fft_execute() for power of two complex transforms */
+typedef enum {
+    /* Whichever fft_planner_thread() times as faster for each transform */
+    FFT_PLANNER_BACKEND_AUTO = 0,
+    FFT_PLANNER_BACKEND_FFTW,
+    FFT_PLANNER_BACKEND_BUILTIN
+} fft_planner_backend_t;
+
+/* One transform, owned by the planner once added. The plan starts as FFTW_ESTIMATE (or from wisdom)
+    and is swapped for a better one by fft_planner_thread(), so it is always run with the new-array execute functions.
+    The thread then times it against the built-in FFT, and switches backend if that is faster. */
+typedef struct fft_planner_plan_t {
+    const char *name;
+    fft_planner_kind_t kind;
+    int size;
+    /* Properties of the caller's buffers the replacement plan has to keep */
+    bool in_place;
+    bool aligned;
+
+    fftwf_plan _Atomic plan;
+    /* FFTW rigor flag the current plan was made with */
+    unsigned rigor;
+    /* Plan that was swapped out, another thread may still be executing it so it is kept until fft_planner_close() */
+    fftwf_plan retired;
+
+    /* FFT_PLANNER_BACKEND_FFTW or _BUILTIN, builtin is set up before this changes to it */
+    _Atomic fft_planner_backend_t backend;
+    dsp_fft_t builtin;
+    /* Backend choice is final */
+    bool benchmarked;
+
+    struct fft_planner_plan_t *next;
+} fft_planner_plan_t;
+
+/* Rigor the background planner works to, FFTW_PATIENT by default */
+extern unsigned fft_planner_rigor;
+/* FFT_PLANNER_BACKEND_AUTO by default, the others force a backend where it can do the transform */
+extern fft_planner_backend_t fft_planner_backend;
+
+bool fft_planner_rigor_parse(const char *name, unsigned *rigor);
+bool fft_planner_backend_parse(const char *name, fft_planner_backend_t *backend);
+void fft_planner_init(void);
+void *fft_planner_alloc(size_t size);
+void fft_planner_free(void *buffer);
+bool fft_planner_add(fft_planner_plan_t *plan, const char *name, fft_planner_kind_t kind, int size, void *input, void *output);
+void *fft_planner_thread(void *arg);
+void fft_planner_close(void);
+
+/* Safe from any thread, input and output must have the same alignment and in-place-ness as the buffers given to fft_planner_add() */
+static inline void fft_planner_execute_dft(fft_planner_plan_t *plan, void *input, void *output)
+{
+    if(atomic_load_explicit(&plan->backend, memory_order_acquire) == FFT_PLANNER_BACKEND_BUILTIN)
+    {
+        dsp_fft_execute(&plan->builtin, (const buffer_iqsample_t *)input, (buffer_iqsample_t *)output);
+        return;
+    }
+    fftwf_execute_dft(atomic_load_explicit(&plan->plan, memory_order_acquire), (fftwf_complex *)input, (fftwf_complex *)output);
+}
+
+/* Always FFTW, the built-in FFT has no real transforms */
+static inline void fft_planner_execute_c2r(fft_planner_plan_t *plan, void *input, float *output)
+{
+    fftwf_execute_dft_c2r(atomic_load_explicit(&plan->plan, memory_order_acquire), (fftwf_complex *)input, output);
+}
+
+#endif /* __FFT_PLANNER_H__ */
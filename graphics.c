@@ -18,6 +18,10 @@ int64_t center_frequency = 10489750000;
 int64_t span_frequency = 512000;
 
 int64_t selected_span_frequency = 10240;
+
+/* Part of the band on the main waterfall, narrower than span_frequency when zoomed. Set by fft.c */
+int64_t display_center_frequency = 10489750000;
+int64_t display_span_frequency = 512000;
 int64_t selected_center_frequency = 10489499950;
 
 /** Main Waterfall Display **/
@@ -245,29 +249,36 @@ static void spectrum_generate(uint8_t *fft_data)
   /* Draw selected band markers */
   int32_t start_marker = 
       (((selected_center_frequency - (selected_span_frequency / 2))
-       - (center_frequency - (span_frequency/2))) * MAIN_SPECTRUM_WIDTH) / span_frequency;
+       - (display_center_frequency - (display_span_frequency/2))) * MAIN_SPECTRUM_WIDTH) / display_span_frequency;
 
   int32_t end_marker = 
       (((selected_center_frequency + (selected_span_frequency / 2))
-       - (center_frequency - (span_frequency/2))) * MAIN_SPECTRUM_WIDTH) / span_frequency;
+       - (display_center_frequency - (display_span_frequency/2))) * MAIN_SPECTRUM_WIDTH) / display_span_frequency;
 
-  uint32_t start_selected = start_marker > 0 ? start_marker : 0;
-  uint32_t end_selected = end_marker < (int32_t)(MAIN_SPECTRUM_WIDTH - 1) ? (uint32_t)end_marker : (MAIN_SPECTRUM_WIDTH - 1);
+  /* Columns between the markers, clamped to the view. Empty when the selection is entirely off either side */
+  int32_t start_selected = start_marker + 1;
+  int32_t end_selected = end_marker;
+  if(start_selected < 0) start_selected = 0;
+  if(end_selected < 0) end_selected = 0;
+  if(end_selected > (int32_t)MAIN_SPECTRUM_WIDTH) end_selected = MAIN_SPECTRUM_WIDTH;
 
   for(i = 0; i < MAIN_SPECTRUM_HEIGHT; i++)
   {
-    /* Start Marker, if in view */
-    if(start_marker >= 0)
+    /* Start Marker, if in view (zoomed in, either can be off either side) */
+    if(start_marker >= 0 && start_marker < (int32_t)MAIN_SPECTRUM_WIDTH)
     {
       memcpy(&(main_spectrum_buffer[i][start_marker]), &selected_marker_pixel, sizeof(screen_pixel_t));
     }
     /* Highlighted section */
-    for(j = start_selected+1; j<end_selected; j++)
+    if(start_selected < end_selected)
     {
-      memcpy(&(main_spectrum_buffer[i][j]), &selected_band_pixel, sizeof(screen_pixel_t));
+      for(j = start_selected; j < (uint32_t)end_selected; j++)
+      {
+        memcpy(&(main_spectrum_buffer[i][j]), &selected_band_pixel, sizeof(screen_pixel_t));
+      }
     }
     /* End Marker, if in view */
-    if(end_marker < (int32_t)MAIN_SPECTRUM_WIDTH)
+    if(end_marker >= 0 && end_marker < (int32_t)MAIN_SPECTRUM_WIDTH)
     {
       memcpy(&(main_spectrum_buffer[i][end_marker]), &selected_marker_pixel, sizeof(screen_pixel_t));
     }
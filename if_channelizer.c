@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <math.h>
+#include <inttypes.h>
+
+#include "if_channelizer.h"
+#include "audio.h"
+#include "buffer/buffer_circular.h"
+#include "dsp/dsp.h"
+#include "dsp/dsp_channelizer.h"
+#include "dsp/dsp_decimator.h"
+
+extern int64_t center_frequency;
+
+/*
+    Receives several fixed frequencies at once, next to the selected one from if_subsample.c.
+
+    iq_main (512 KHz) -> polyphase channelizer, 50 channels 10.24 KHz apart at 20.48 KHz
+        -> per monitor: shift the remaining offset (at most 5.12 KHz) to 0, decimate by 2 -> 10.24 KHz -> if_demod
+
+    The channelizer cost is the same however many monitors there are, each monitor only adds work at 20.48 KHz.
+*/
+
+#define IF_CHANNELIZER_RATE         512000
+#define IF_CHANNELIZER_CHANNELS     50
+#define IF_CHANNELIZER_SPACING      (IF_CHANNELIZER_RATE / IF_CHANNELIZER_CHANNELS)
+/* Channel output samples per block, 16000 input samples */
+#define IF_CHANNELIZER_STEPS        640
+
+/* Alias-free to 4.096 KHz either side of the monitored frequency, wherever it falls within its channel */
+#define IF_CHANNELIZER_PASSBAND     ((IF_CHANNELIZER_SPACING / 2) + 4096)
+#define IF_CHANNELIZER_STOPBAND     ((2 * IF_CHANNELIZER_SPACING) - IF_CHANNELIZER_PASSBAND)
+/* Rejection of everything else in the band, dB */
+#define IF_CHANNELIZER_ATTENUATION  60
+/* Input (in windows) the channelizer may fall behind by before it skips ahead to the newest, so monitoring never holds up the Lime */
+#define IF_CHANNELIZER_BACKLOG      4
+
+if_channelizer_monitor_t if_channelizer_monitors[IF_CHANNELIZER_MAX_MONITORS];
+int if_channelizer_monitor_count = 0;
+
+static dsp_channelizer_t channelizer;
+static buffer_circular_reader_t *channelizer_reader;
+
+/* Called while parsing options, before if_channelizer_init() */
+bool if_channelizer_add(int64_t frequency)
+{
+    if(if_channelizer_monitor_count >= IF_CHANNELIZER_MAX_MONITORS)
+    {
+        fprintf(stderr, "IF Channelizer: Error: At most %d monitors can be set\n", IF_CHANNELIZER_MAX_MONITORS);
+        return false;
+    }
+
+    if(llabs(frequency - center_frequency) > ((IF_CHANNELIZER_RATE / 2) - 4096))
+    {
+        fprintf(stderr, "IF Channelizer: Error: Monitor frequency %"PRId64" is outside the received band\n", frequency);
+        return false;
+    }
+
+    if_channelizer_monitors[if_channelizer_monitor_count].frequency = frequency;
+    if_channelizer_monitor_count++;
+
+    return true;
+}
+
+/* Sets up the filterbank and the monitors' buffers, must be called before the Lime thread starts */
+bool if_channelizer_init(bool *exit_requested)
+{
+    static const int monitor_decimation[] = { 2 };
+    if_channelizer_monitor_t *monitor;
+    int64_t offset;
+    int channel;
+
+    if(if_channelizer_monitor_count == 0)
+    {
+        return true;
+    }
+
+    if(!dsp_channelizer_init(&channelizer, IF_CHANNELIZER_CHANNELS,
+        (float)IF_CHANNELIZER_PASSBAND / IF_CHANNELIZER_RATE, (float)IF_CHANNELIZER_STOPBAND / IF_CHANNELIZER_RATE, IF_CHANNELIZER_ATTENUATION))
+    {
+        fprintf(stderr, "IF Channelizer: Error: Failed to set up filterbank\n");
+        return false;
+    }
+
+    channelizer_reader = buffer_circular_readerAdd(&buffer_circular_iq_main, BUFFER_CIRCULAR_READER_LATEST,
+        IF_CHANNELIZER_BACKLOG * dsp_channelizer_window(&channelizer, IF_CHANNELIZER_STEPS));
+    if(channelizer_reader == NULL)
+    {
+        fprintf(stderr, "IF Channelizer: Error: No reader left on IQ Main buffer\n");
+        return false;
+    }
+
+    for(int i = 0; i < if_channelizer_monitor_count; i++)
+    {
+        monitor = &if_channelizer_monitors[i];
+
+        offset = monitor->frequency - center_frequency;
+        channel = (int)llround((double)offset / IF_CHANNELIZER_SPACING);
+
+        monitor->channel = (channel + IF_CHANNELIZER_CHANNELS) % IF_CHANNELIZER_CHANNELS;
+        monitor->offset = offset - ((int64_t)channel * IF_CHANNELIZER_SPACING);
+        dsp_nco_init(&monitor->nco, -(double)monitor->offset / (2 * IF_CHANNELIZER_SPACING));
+
+        if(!dsp_decimator_init(&monitor->decimator, monitor_decimation, 1, 0.2, IF_CHANNELIZER_ATTENUATION, 0, IF_CHANNELIZER_STEPS)
+            || !buffer_circular_init(&monitor->iq, sizeof(buffer_iqsample_t), 64*1024)
+            || !buffer_circular_init(&monitor->audio, sizeof(int16_t), 2*1024))
+        {
+            fprintf(stderr, "IF Channelizer: Error: Failed to allocate buffers for monitor %d\n", i);
+            return false;
+        }
+
+        monitor->demod.name = "Monitor";
+        monitor->demod.exit_requested = exit_requested;
+        monitor->demod.input = &monitor->iq;
+        monitor->demod.output = &monitor->audio;
+
+        audio_mix_add(&monitor->audio);
+
+        printf("IF Channelizer: Monitor %"PRId64" Hz in channel %d (offset %"PRId32" Hz)\n",
+            monitor->frequency, monitor->channel, monitor->offset);
+    }
+
+    return true;
+}
+
+/* IF Channelizer Thread */
+void *if_channelizer_thread(void *arg)
+{
+    bool *exit_requested = (bool *)arg;
+
+    if_channelizer_monitor_t *monitor;
+    buffer_circular_span_t input_spans[2];
+    uint32_t window_length = dsp_channelizer_window(&channelizer, IF_CHANNELIZER_STEPS);
+    uint32_t tail_expected = atomic_load_explicit(&channelizer_reader->Tail, memory_order_relaxed);
+
+    int channels[IF_CHANNELIZER_MAX_MONITORS];
+    buffer_iqsample_t *outputs[IF_CHANNELIZER_MAX_MONITORS];
+
+    buffer_iqsample_t *buffer_out = (buffer_iqsample_t *)malloc(if_channelizer_monitors[0].decimator.MaxOutput * sizeof(buffer_iqsample_t));
+    if(buffer_out == NULL)
+    {
+        fprintf(stderr, "Error: Failed to allocated buffers for if_channelizer, aborting.\n");
+        return NULL;
+    }
+
+    for(int i = 0; i < if_channelizer_monitor_count; i++)
+    {
+        channels[i] = if_channelizer_monitors[i].channel;
+    }
+
+    while(!*exit_requested)
+    {
+        /* Wait for incoming data, the window includes the history kept from the last block */
+        if(buffer_circular_readerWaitThresholdPeek(&buffer_circular_iq_main, channelizer_reader, window_length, window_length, input_spans) != window_length)
+        {
+            /* Closed, check for exit */
+            continue;
+        }
+
+        /* Skipped ahead after falling behind, the window no longer follows on from the last one */
+        if(atomic_load_explicit(&channelizer_reader->Tail, memory_order_relaxed) != tail_expected)
+        {
+            tail_expected = atomic_load_explicit(&channelizer_reader->Tail, memory_order_relaxed);
+            dsp_channelizer_reset(&channelizer);
+        }
+
+        /* Channelize straight into each monitor's decimator */
+        for(int i = 0; i < if_channelizer_monitor_count; i++)
+        {
+            outputs[i] = dsp_decimator_input(&if_channelizer_monitors[i].decimator, IF_CHANNELIZER_STEPS);
+        }
+
+        /* iq_main is mirrored, so the first span covers the whole window */
+        dsp_channelizer_execute(&channelizer, input_spans[0].Data, IF_CHANNELIZER_STEPS, channels, if_channelizer_monitor_count, outputs);
+        tail_expected += IF_CHANNELIZER_STEPS * channelizer.Decimation;
+        if(!buffer_circular_readerRelease(&buffer_circular_iq_main, channelizer_reader, IF_CHANNELIZER_STEPS * channelizer.Decimation))
+        {
+            /* Overwritten by the Lime while channelizing. The decimators' input isn't committed, so this block is dropped */
+            dsp_channelizer_reset(&channelizer);
+            continue;
+        }
+
+        for(int i = 0; i < if_channelizer_monitor_count; i++)
+        {
+            monitor = &if_channelizer_monitors[i];
+
+            /* Fine tune within the channel, in place */
+            dsp_nco_mix_cc(&monitor->nco, outputs[i], outputs[i], IF_CHANNELIZER_STEPS);
+
+            int output_samples = dsp_decimator_execute(&monitor->decimator, IF_CHANNELIZER_STEPS, buffer_out);
+
+            uint32_t samples_transferred = output_samples;
+            buffer_circular_push(&monitor->iq, buffer_out, &samples_transferred);
+            if(samples_transferred > 0)
+            {
+                fprintf(stderr, "IF Channelizer: WARNING push to monitor %d demod buffer was lossy (%d / %d returned)\n",
+                    i, samples_transferred, output_samples);
+            }
+        }
+    }
+
+    free(buffer_out);
+
+    return NULL;
+}
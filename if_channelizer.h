@@ -0,0 +1,38 @@
+#ifndef __IF_CHANNELIZER_H__
+#define __IF_CHANNELIZER_H__
+
+#include <pthread.h>
+
+#include "buffer/buffer_circular.h"
+#include "dsp/dsp_decimator.h"
+#include "dsp/dsp_nco.h"
+#include "if_demod.h"
+
+#define IF_CHANNELIZER_MAX_MONITORS 4
+
+/* A fixed frequency received alongside the selected one, with its own demodulator */
+typedef struct {
+    int64_t frequency;
+
+    /* Channelizer channel, and the remaining offset from its centre */
+    int channel;
+    int32_t offset;
+    dsp_nco_t nco;
+
+    dsp_decimator_t decimator;
+
+    buffer_circular_t iq;
+    buffer_circular_t audio;
+
+    if_demod_t demod;
+    pthread_t demod_thread_obj;
+} if_channelizer_monitor_t;
+
+extern if_channelizer_monitor_t if_channelizer_monitors[IF_CHANNELIZER_MAX_MONITORS];
+extern int if_channelizer_monitor_count;
+
+bool if_channelizer_add(int64_t frequency);
+bool if_channelizer_init(bool *exit_requested);
+void *if_channelizer_thread(void *arg);
+
+#endif /* __IF_CHANNELIZER_H__ */
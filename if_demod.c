@@ -23,13 +23,21 @@
 #include <stdbool.h>
 #include <string.h>
 #include <pthread.h>
+#include <time.h>
 #include <math.h>
 #include <limits.h>
+#include <inttypes.h>
 #include <fftw3.h>
 
 #include "timing.h"
+#include "fft_planner.h"
 #include "if_demod.h"
 #include "buffer/buffer_circular.h"
+#include "dsp/dsp_firdes.h"
+#include "dsp/dsp.h"
+#include "dsp/dsp_agc.h"
+#include "dsp/dsp_convert.h"
+#include "dsp/dsp_nr.h"
 
 extern int64_t center_frequency;
 extern int64_t selected_center_frequency;
@@ -38,357 +46,934 @@ extern int64_t selected_center_frequency;
 float low_cut = 0.02; // ~100Hz
 float high_cut = 0.3;
 float transition_bw = 0.1; // 0.05
+dsp_window_t filter_window = DSP_WINDOW_HAMMING;
 
 
 /* Demod Internal Vars */
 static int fft_size;
 static int input_size;
 static int overlap_length;
+/* Zeros ahead of the input in each frame, the spectral NR's spread before it */
+static int input_offset;
 
-static fftwf_plan demod_plan_taps;
-static buffer_iqsample_t* taps_fft;
+#define IF_DEMOD_SAMPLE_RATE 10240
 
-static buffer_iqsample_t* input;
-static fftwf_plan demod_plan_forward;
-static buffer_iqsample_t* input_fourier;
+/* Blocks taken from the IF buffer per wake-up when the demodulator has fallen behind */
+#define IF_DEMOD_MAX_BLOCKS 4
 
-static buffer_iqsample_t* output_fourier;
-static fftwf_plan demod_plan_inverse_1;
-static buffer_iqsample_t* output_1;
-static fftwf_plan demod_plan_inverse_2;
-static buffer_iqsample_t* output_2;
+/*
+    Filters are designed and FFT'd by if_demod_filter_thread(), off the demodulator threads, and kept in a cache
+    keyed by their parameters, so returning to a previous passband is immediate. A demodulator picks up a new
+    filter at the start of its next block, the overlap from the old filter is added in as usual so there's no gap.
+    Entries are never freed, a demodulator may still be using any of them.
+*/
+struct if_demod_filter_t {
+    float low_cut;
+    float high_cut;
+    float transition_bw;
+    dsp_window_t window;
+    buffer_iqsample_t *taps_fft;
+    struct if_demod_filter_t *next;
+};
+
+/* Stopband (dB) for DSP_WINDOW_KAISER filters */
+#define IF_DEMOD_KAISER_ATTENUATION 60
+
+#define IF_DEMOD_FILTER_CACHE_MAX   64
+#define IF_DEMOD_FILTER_QUEUE_SIZE  8
+
+typedef struct {
+    if_demod_t *demod;
+    if_demod_filter_t key;
+    /* Switched to along with the filter, IF_DEMOD_MODES to keep the current one */
+    if_demod_mode_t mode;
+} if_demod_filter_request_t;
+
+static pthread_mutex_t filter_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t filter_signal;
+static if_demod_filter_t *filter_cache = NULL;
+static int filter_cache_count = 0;
+static if_demod_filter_request_t filter_queue[IF_DEMOD_FILTER_QUEUE_SIZE];
+static int filter_queue_count = 0;
+
+/* Request being designed, outside filter_mutex, and whether a newer one for its demodulator has come in since */
+static if_demod_t *filter_designing = NULL;
+static if_demod_mode_t filter_designing_mode = IF_DEMOD_MODES;
+static bool filter_designing_superseded = false;
+
+/* Designed from the configuration vars at init, used by any demodulator without its own */
+static if_demod_filter_t *filter_default;
+
+/* Filter taps are zero-padded to this, the longest the FFT size allows for */
+static int taps_length_max;
+
+/* Plans are shared by all demodulator instances, each executes them on its own (out-of-place, fft_planner_alloc'd) buffers */
+static fft_planner_plan_t demod_plan_forward;
+static fft_planner_plan_t demod_plan_inverse;
+static fft_planner_plan_t demod_plan_inverse_real;
 
 /* Sanity check that these types are interchangeable */
 _Static_assert(sizeof(buffer_iqsample_t) == sizeof(fftwf_complex), "Error: sizeof(buffer_iqsample_t) == sizeof(fftwf_complex) failed!");
 
-static float window_kernel_hamming(float rate)
+// csdr bandpass_fir_fft_cc 0 0.1 0.05
+
+/* Designs the filter into taps_fft, using taps (fft_size complex, interleaved i, q and FFTW aligned) as scratch */
+static void if_demod_filter_design(if_demod_filter_t *filter, float *taps)
 {
-    //Explanation at Chapter 16 of dspguide.com, page 2
-    //Hamming window has worse stopband attentuation and passband ripple than Blackman, but it has faster rolloff.
-    rate=0.5+rate/2;
-    return 0.54-0.46*cos(2*M_PI*rate);
-}
+    int taps_length;
+    float beta = 0;
 
-static void firdes_lowpass_f(float *output, int length, float cutoff_rate)
-{   //Generates symmetric windowed sinc FIR filter real taps
-    //  length should be odd
-    //  cutoff_rate is (cutoff frequency/sampling frequency)
-    //Explanation at Chapter 16 of dspguide.com
-    int middle=length/2;
-    output[middle]=2*M_PI*cutoff_rate*window_kernel_hamming(0);
-    for(int i=1; i<=middle; i++) //@@firdes_lowpass_f: calculate taps
-    {
-        output[middle-i]=output[middle+i]=(sin(2*M_PI*cutoff_rate*i)/i)*window_kernel_hamming((float)i/middle);
-        //printf("%g %d %d %d %d | %g\n",output[middle-i],i,middle,middle+i,middle-i,sin(2*PI*cutoff_rate*i));
-    }
-    //Normalize filter kernel
-    float sum=0;
-    for(int i=0;i<length;i++) //@normalize_fir_f: normalize pass 1
-        sum+=output[i];
-    for(int i=0;i<length;i++) //@normalize_fir_f: normalize pass 2
-        output[i]=output[i]/sum;
+    if(filter->window == DSP_WINDOW_KAISER)
+    {
+        /* Shortest filter that meets the stopband, rather than a fixed length for the transition band */
+        taps_length = dsp_window_kaiser_length(filter->transition_bw, IF_DEMOD_KAISER_ATTENUATION);
+        beta = dsp_window_kaiser_beta(IF_DEMOD_KAISER_ATTENUATION);
+    }
+    else
+    {
+        taps_length = dsp_firdes_length(filter->transition_bw);
+    }
+    if(taps_length > taps_length_max) taps_length = taps_length_max;
+
+    memset(taps, 0, fft_size * sizeof(buffer_iqsample_t));
+    dsp_firdes_bandpass_c(taps, taps_length, filter->low_cut, filter->high_cut, filter->window, beta);
+
+    /* Fold in the 1/fft_size of the inverse FFT and the 1/2 of the real part fold, so the demodulators don't need a pass to normalize */
+    for(int i = 0; i < 2 * taps_length; i++)
+    {
+        taps[i] /= 2 * fft_size;
+    }
+
+    fft_planner_execute_dft(&demod_plan_forward, taps, filter->taps_fft);
 }
 
-static float agc_ff(float* input, float* output, int input_size, float reference, float attack_rate, float decay_rate, float max_gain, short hang_time, short attack_wait_time, float gain_filter_alpha, float last_gain)
+/* Call with filter_mutex held */
+static if_demod_filter_t *if_demod_filter_lookup(const if_demod_filter_t *key)
 {
-    /*
-        Notes on parameters (with some default values):
-            attack_rate = 0.01
-            decay_rate = 0.001
-            hang_time = (hang_time_ms / 1000) * sample_rate
-                hang_time is given in samples, and should be about 4ms.
-                hang_time can be switched off by setting it to zero (not recommended).
-            max_gain = pow(2, adc_bits)
-                max_gain should be no more than the dynamic range of your A/D converter.
-            gain_filter_alpha = 1 / ((fs/(2*PI*fc))+1)
-            >>> 1 / ((48000./(2*3.141592654*100))+1)
-            0.012920836043344543
-            >>> 1 / ((48000./(2*3.141592654*10))+1)
-            0.0013072857061786625
-        Literature:
-            ww.qsl.net/va3iul/Files/Automatic_Gain_Control.pdf
-            page 7 of http://www.arrl.org/files/file/Technology/tis/info/pdf/021112qex027.pdf
-        Examples:
-            http://svn.tapr.org/repos_sdr_hpsdr/trunk/W5WC/PowerSDR_HPSDR_mRX_PS/Source/wdsp/wcpAGC.c
-            GNU Radio's agc,agc2,agc3 have quite good ideas about this.
-    */
-    register short hang_counter=0;
-    register short attack_wait_counter=0;
-    float gain=last_gain;
-    float last_peak=reference/last_gain; //approx.
-    float input_abs;
-    float error, dgain;
-    output[0]=last_gain*input[0]; //we skip this one sample, because it is easier this way
-    for(int i=1;i<input_size;i++) //@agc_ff
-    {
-        //printf("[%d] %f, ", i, input[i]);
-        //The error is the difference between the required gain at the actual sample, and the previous gain value.
-        //We actually use an envelope detector.
-        input_abs=fabs(input[i]);
-        error=reference/input_abs-gain;
-
-        if(input[i]!=0) //We skip samples containing 0, as the gain would be infinity for those to keep up with the reference.
+    for(if_demod_filter_t *filter = filter_cache; filter != NULL; filter = filter->next)
+    {
+        if(filter->low_cut == key->low_cut && filter->high_cut == key->high_cut
+            && filter->transition_bw == key->transition_bw && filter->window == key->window)
         {
-            //An AGC is something nonlinear that's easier to implement in software:
-            //if the amplitude decreases, we increase the gain by minimizing the gain error by attack_rate.
-            //We also have a decay_rate that comes into consideration when the amplitude increases.
-            //The higher these rates are, the faster is the response of the AGC to amplitude changes.
-            //However, attack_rate should be higher than the decay_rate as we want to avoid clipping signals.
-            //that had a sudden increase in their amplitude.
-            //It's also important to note that this algorithm has an exponential gain ramp.
-
-            if(error<0) //INCREASE IN SIGNAL LEVEL
-            {
-                if(last_peak<input_abs)
-                {
-
-                    attack_wait_counter=attack_wait_time;
-                    last_peak=input_abs;
-                }
-                if(attack_wait_counter>0)
-                {
-                    attack_wait_counter--;
-                    //fprintf(stderr,"A");
-                    dgain=0;
-                }
-                else
-                {
-                    //If the signal level increases, we decrease the gain quite fast.
-                    dgain=error*attack_rate;
-                    //Before starting to increase the gain next time, we will be waiting until hang_time for sure.
-                    hang_counter=hang_time;
-
-                }
-            }
-            else //DECREASE IN SIGNAL LEVEL
-            {
-                if(hang_counter>0) //Before starting to increase the gain, we will be waiting until hang_time.
-                {
-                    hang_counter--;
-                    dgain=0; //..until then, AGC is inactive and gain doesn't change.
-                }
-                else dgain=error*decay_rate; //If the signal level decreases, we increase the gain quite slowly.
-            }
-            gain=gain+dgain;
-            //fprintf(stderr,"g=%f dg=%f\n",gain,dgain);
+            return filter;
         }
-        if(gain>max_gain) gain=max_gain; //We also have to limit our gain, it can't be infinity.
-        if(gain<0) gain=0;
-        //output[i]=gain*input[i]; //Here we do the actual scaling of the samples.
-        //Here we do the actual scaling of the samples, but we run an IIR filter on the gain values:
-        output[i]=(gain=gain+last_gain-gain_filter_alpha*last_gain)*input[i]; //dc-pass-filter: freqz([1 -1],[1 -0.99]) y[i]=x[i]+y[i-1]-alpha*x[i-1]
-        //output[i]=input[i]*(last_gain+gain_filter_alpha*(gain-last_gain)); //LPF
-
-        last_gain=gain;
     }
-    return gain; //this will be the last_gain next time
+    return NULL;
 }
 
-// csdr bandpass_fir_fft_cc 0 0.1 0.05
+/* Returns NULL if out of memory */
+static if_demod_filter_t *if_demod_filter_new(const if_demod_filter_t *key)
+{
+    if_demod_filter_t *filter = (if_demod_filter_t *)malloc(sizeof(if_demod_filter_t));
+    if(filter == NULL)
+    {
+        return NULL;
+    }
+    *filter = *key;
+    filter->taps_fft = fft_planner_alloc(fft_size * sizeof(buffer_iqsample_t));
+    if(filter->taps_fft == NULL)
+    {
+        free(filter);
+        return NULL;
+    }
+    filter->next = NULL;
+    return filter;
+}
 
-void if_demod_init(void)
+bool if_demod_init(void)
 {
-    /* Calculate FFT filter length (number of non-zero taps) */
-    int taps_length = 4.0 / transition_bw;
-    if(taps_length % 2 == 0) taps_length++; //number of symmetric FIR filter taps should be odd
+    /* Calculate FFT filter length (number of non-zero taps), sized for the narrowest filter that can be requested */
+    taps_length_max = dsp_firdes_length((transition_bw < IF_DEMOD_TRANSITION_MIN) ? transition_bw : IF_DEMOD_TRANSITION_MIN);
 
     //int fft_size;
     for(int i = 0; i < 31; i++)
     {
-        if(taps_length < (fft_size = 1 << i)) break;
+        if(taps_length_max < (fft_size = 1 << i)) break;
     }
     //the number of padding zeros is the number of output samples we will be able to take away after every processing step, and it looks sane to check if it is large enough.
-    if((fft_size - taps_length) < 200) fft_size <<= 1;
+    //spectral NR can be switched on at any time, and spreads the frame by DSP_NR_SPECTRAL_SPAN / 2 either side, so the padding always has room for it
+    if((fft_size - taps_length_max - DSP_NR_SPECTRAL_SPAN) < 200) fft_size <<= 1;
 
-    input_size = fft_size - taps_length + 1;
-    overlap_length = taps_length - 1;
-    //printf("IF Demod: (fft_size = %d) = (taps_length = %d) + (input_size = %d) - 1 (overlap_length = %d) = taps_length - 1\n", fft_size, taps_length, input_size, overlap_length );
+    input_size = fft_size - taps_length_max + 1 - DSP_NR_SPECTRAL_SPAN;
+    input_offset = DSP_NR_SPECTRAL_SPAN / 2;
+    overlap_length = fft_size - input_size;
+    //printf("IF Demod: (fft_size = %d) = (taps_length = %d) + (input_size = %d) - 1 + NR span (overlap_length = %d)\n", fft_size, taps_length_max, input_size, overlap_length );
     if(fft_size <= 2)
     {
-        fprintf(stderr,"IF Demod: FFT size error. (fft_size <= 2)");
-        return;
+        fprintf(stderr,"IF Demod: FFT size error. (fft_size <= 2)\n");
+        return false;
     }
 
-    //prepare making the filter and doing FFT on it
-    buffer_iqsample_t* taps = (buffer_iqsample_t*)calloc(sizeof(buffer_iqsample_t), fft_size); //calloc initializes to zero
-    taps_fft = (buffer_iqsample_t*)malloc(sizeof(buffer_iqsample_t) * fft_size);
+    //make FFT plans for continously processing the input, on template buffers with the same alignment as the instances' own
+    float *plan_input = fft_planner_alloc(fft_size*sizeof(buffer_iqsample_t));
+    float *plan_output = fft_planner_alloc(fft_size*sizeof(buffer_iqsample_t));
+    if(plan_input == NULL || plan_output == NULL)
+    {
+        fprintf(stderr, "IF Demod: Error allocating FFT buffers\n");
+        fft_planner_free(plan_input);
+        fft_planner_free(plan_output);
+        return false;
+    }
 
-    demod_plan_taps = fftwf_plan_dft_1d(fft_size, (fftwf_complex*)taps, (fftwf_complex*)taps_fft, FFTW_FORWARD, FFTW_PATIENT);
-    printf(" "); fftwf_print_plan(demod_plan_taps); printf("\n");
+    //SSB and CW only use the real part of the filtered signal, so they have a complex-to-real inverse on half the spectrum as well
+    if(!fft_planner_add(&demod_plan_forward, "IF Demod Forward", FFT_PLANNER_FORWARD, fft_size, plan_input, plan_output)
+        || !fft_planner_add(&demod_plan_inverse, "IF Demod Inverse", FFT_PLANNER_BACKWARD, fft_size, plan_input, plan_output)
+        || !fft_planner_add(&demod_plan_inverse_real, "IF Demod Inverse Real", FFT_PLANNER_C2R, fft_size, plan_input, plan_output))
+    {
+        fprintf(stderr, "IF Demod: Error making FFT plans\n");
+        fft_planner_free(plan_input);
+        fft_planner_free(plan_output);
+        return false;
+    }
 
-    //make FFT plans for continously processing the input
-    input = fftwf_malloc(fft_size*sizeof(buffer_iqsample_t));
-    input_fourier = fftwf_malloc(fft_size*sizeof(buffer_iqsample_t));
-    demod_plan_forward = fftwf_plan_dft_1d(fft_size, (fftwf_complex*)input, (fftwf_complex*)input_fourier, FFTW_FORWARD, FFTW_PATIENT);
-    printf(" "); fftwf_print_plan(demod_plan_forward); printf("\n");
+    /** make the default filter, later changes go through if_demod_set_passband() **/
+    //printf("IF Demod: filter initialising, low_cut = %g, high_cut = %g\n", low_cut, high_cut);
+    if_demod_filter_t key = { .low_cut = low_cut, .high_cut = high_cut, .transition_bw = transition_bw, .window = filter_window };
+    filter_default = if_demod_filter_new(&key);
+    if(filter_default == NULL)
+    {
+        fprintf(stderr, "IF Demod: Error allocating the default filter\n");
+        fft_planner_free(plan_input);
+        fft_planner_free(plan_output);
+        return false;
+    }
+    if_demod_filter_design(filter_default, plan_input);
+    filter_cache = filter_default;
+    filter_cache_count = 1;
 
-    output_fourier = fftwf_malloc(fft_size*sizeof(buffer_iqsample_t));
-    output_1 = fftwf_malloc(fft_size*sizeof(buffer_iqsample_t));
-    output_2 = fftwf_malloc(fft_size*sizeof(buffer_iqsample_t));
-    //we create 2x output buffers so that one will preserve the previous overlap:
-    demod_plan_inverse_1 = fftwf_plan_dft_1d(fft_size, (fftwf_complex*)output_fourier, (fftwf_complex*)output_1, FFTW_BACKWARD, FFTW_PATIENT);
-    demod_plan_inverse_2 = fftwf_plan_dft_1d(fft_size, (fftwf_complex*)output_fourier, (fftwf_complex*)output_2, FFTW_BACKWARD, FFTW_PATIENT);
-    printf(" "); fftwf_print_plan(demod_plan_inverse_2); printf("\n");
+    fft_planner_free(plan_input);
+    fft_planner_free(plan_output);
 
-    //we initialize the second output buffer to 0 as it will be taken as the overlap source for the first time:
-    for(int i = 0; i < fft_size; i++) output_2[i].i = output_2[i].q = 0;
+    /* Set pthread timer on filter_signal to use monotonic clock */
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&filter_signal, &attr);
+    pthread_condattr_destroy(&attr);
 
-    //we pre-pad the input buffer with zeros
-    for(int i = input_size; i < fft_size; i++) input[i].i = input[i].q = 0;
+    return true;
+}
 
-    /** make the filter (from here down needs to be re-run if low_cut or high_cut is changed) **/
-    //printf("IF Demod: filter initialising, low_cut = %g, high_cut = %g\n", low_cut, high_cut);
+/* Swaps in the filter for key and, unless it is IF_DEMOD_MODES, the mode with it, without blocking.
+    A cached filter goes in straight away, otherwise both are queued for if_demod_filter_thread().
+    A mode switch still pending is carried over to a newer passband, so it isn't lost.
+    Returns false, with nothing changed, if the filter can't be made. */
+static bool if_demod_select(if_demod_t *demod, const if_demod_filter_t *key, if_demod_mode_t mode)
+{
+    if_demod_filter_t *filter;
+    int i;
 
-    /* firdes_bandpass_c() */
-    //To generate a complex filter:
-    //  1. we generate a real lowpass filter with a bandwidth of highcut-lowcut
-    //  2. we shift the filter taps spectrally by multiplying with e^(j*w), so we get complex taps
-    //(tnx HA5FT)
-    float* realtaps = (float*)malloc(taps_length * sizeof(float));
+    if(key->transition_bw < (float)IF_DEMOD_TRANSITION_MIN || key->low_cut >= key->high_cut || key->low_cut < -0.5 || key->high_cut > 0.5)
+    {
+        return false;
+    }
+
+    pthread_mutex_lock(&filter_mutex);
+
+    for(i = 0; i < filter_queue_count && filter_queue[i].demod != demod; i++);
+    if(mode == IF_DEMOD_MODES)
+    {
+        if(i < filter_queue_count)
+        {
+            mode = filter_queue[i].mode;
+        }
+        else if(filter_designing == demod)
+        {
+            mode = filter_designing_mode;
+        }
+    }
+
+    filter = if_demod_filter_lookup(key);
+    if(filter == NULL)
+    {
+        if(filter_cache_count >= IF_DEMOD_FILTER_CACHE_MAX)
+        {
+            pthread_mutex_unlock(&filter_mutex);
+            fprintf(stderr, "IF Demod (%s): WARNING filter cache full, passband not changed\n", demod->name);
+            return false;
+        }
+        /* Only the latest request per demodulator is worth designing, e.g. while a passband edge is being dragged */
+        if(i == filter_queue_count && filter_queue_count == IF_DEMOD_FILTER_QUEUE_SIZE)
+        {
+            pthread_mutex_unlock(&filter_mutex);
+            fprintf(stderr, "IF Demod (%s): WARNING filter queue full, passband not changed\n", demod->name);
+            return false;
+        }
+    }
+
+    if(filter_designing == demod)
+    {
+        filter_designing_superseded = true;
+    }
+
+    if(filter != NULL)
+    {
+        /* The demodulator reads both under filter_mutex, so it never runs one mode's stages on another's filter */
+        atomic_store_explicit(&demod->filter, filter, memory_order_release);
+        if(mode != IF_DEMOD_MODES)
+        {
+            atomic_store_explicit(&demod->mode, mode, memory_order_relaxed);
+        }
+
+        /* Drop any design still queued for this demodulator, it would replace this one */
+        if(i < filter_queue_count)
+        {
+            memmove(&filter_queue[i], &filter_queue[i + 1], (filter_queue_count - i - 1) * sizeof(if_demod_filter_request_t));
+            filter_queue_count--;
+        }
 
-    firdes_lowpass_f(realtaps, taps_length, (high_cut - low_cut) / 2);
-    float filter_center = (high_cut + low_cut) / 2;
+        pthread_mutex_unlock(&filter_mutex);
+        return true;
+    }
 
-    float phase=0, sinval, cosval;
-    for(int i=0; i<taps_length; i++) //@@firdes_bandpass_c
+    if(i == filter_queue_count)
     {
-        cosval = cos(phase);
-        sinval = sin(phase);
-        phase += 2 * M_PI * filter_center;
-        while(phase > (2 * M_PI)) phase -= 2 * M_PI; //@@firdes_bandpass_c
-        while(phase < 0) phase += 2 * M_PI;
-        taps[i].i = cosval * realtaps[i];
-        taps[i].q = sinval * realtaps[i];
+        filter_queue_count++;
     }
+    filter_queue[i].demod = demod;
+    filter_queue[i].key = *key;
+    filter_queue[i].mode = mode;
+
+    pthread_cond_signal(&filter_signal);
+    pthread_mutex_unlock(&filter_mutex);
 
-    fftwf_execute(demod_plan_taps);
+    return true;
 }
 
-/* IF Demodulator Thread */
-void *if_demod_thread(void *arg)
+/* Changes the demodulator's passband (relative to 10.24 KHz, may be negative for LSB), without blocking.
+    A cached filter is swapped in straight away, otherwise it is queued for if_demod_filter_thread().
+    Returns false if the filter can't be made. */
+bool if_demod_set_passband(if_demod_t *demod, float low_cut, float high_cut, float transition_bw, dsp_window_t window)
+{
+    if_demod_filter_t key = { .low_cut = low_cut, .high_cut = high_cut, .transition_bw = transition_bw, .window = window };
+
+    return if_demod_select(demod, &key, IF_DEMOD_MODES);
+}
+
+/* Changes the demodulator's AGC preset, picked up at the next block */
+void if_demod_set_agc(if_demod_t *demod, dsp_agc_mode_t mode)
+{
+    atomic_store_explicit(&demod->agc_mode, mode, memory_order_relaxed);
+}
+
+/* Changes the demodulator's noise reduction, picked up at the next block where the new mode starts afresh */
+void if_demod_set_nr(if_demod_t *demod, dsp_nr_mode_t mode)
+{
+    atomic_store_explicit(&demod->nr_mode, mode, memory_order_relaxed);
+}
+
+/* IF Demodulator Filter Designer Thread, shared by all instances */
+void *if_demod_filter_thread(void *arg)
 {
     bool *exit_requested = (bool *)arg;
+    if_demod_filter_request_t request;
+    if_demod_filter_t *filter;
+    struct timespec ts;
 
-    uint32_t length_returned;
+    float *taps = fft_planner_alloc(fft_size * sizeof(buffer_iqsample_t));
 
-    /* FIR FFT */
-    bool odd = false;
-    int i;
-    buffer_iqsample_t* last_overlap;
-    buffer_iqsample_t* result;
+    while(false == *exit_requested)
+    {
+        pthread_mutex_lock(&filter_mutex);
+
+        while(filter_queue_count == 0 && false == *exit_requested)
+        {
+            /* Set timer for 100ms */
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            ts.tv_nsec += 100 * 1000000;
+            if(ts.tv_nsec >= 1000000000)
+            {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
 
-    /* agc_ff */
-    short hang_time=200;
-    float reference=0.2;
-    float attack_rate=0.01;
-    float decay_rate=0.0001;
-    float max_gain=65536;
-    short attack_wait=0;
-    float filter_alpha=0.999;
+            pthread_cond_timedwait(&filter_signal, &filter_mutex, &ts);
+        }
 
-    float last_gain=1.0;
+        if(*exit_requested)
+        {
+            pthread_mutex_unlock(&filter_mutex);
+            break;
+        }
 
+        request = filter_queue[0];
+        filter_queue_count--;
+        memmove(&filter_queue[0], &filter_queue[1], filter_queue_count * sizeof(if_demod_filter_request_t));
 
-    float *realpart_buffer = (float *)malloc(input_size * sizeof(float));
-    float *agc_buffer = (float *)malloc(input_size * sizeof(float));
-    int16_t *s16_buffer = (int16_t *)malloc(input_size * sizeof(int16_t));
+        /* May have been made for another demodulator since it was queued */
+        filter = if_demod_filter_lookup(&request.key);
+        filter_designing = request.demod;
+        filter_designing_mode = request.mode;
+        filter_designing_superseded = false;
+        pthread_mutex_unlock(&filter_mutex);
 
+        if(filter == NULL)
+        {
+            filter = if_demod_filter_new(&request.key);
+            if(filter == NULL)
+            {
+                fprintf(stderr, "IF Demod (%s): WARNING out of memory for filter, passband not changed\n", request.demod->name);
+                pthread_mutex_lock(&filter_mutex);
+                filter_designing = NULL;
+                filter_designing_mode = IF_DEMOD_MODES;
+                pthread_mutex_unlock(&filter_mutex);
+                continue;
+            }
+            if_demod_filter_design(filter, taps);
 
-#if 0
-    bool monotonic_started = false;
-    uint64_t samples_total = 0;
-    uint64_t start_monotonic = 0;
-#endif
+            pthread_mutex_lock(&filter_mutex);
+            filter->next = filter_cache;
+            filter_cache = filter;
+            filter_cache_count++;
+            pthread_mutex_unlock(&filter_mutex);
+        }
 
-    while(!*exit_requested)
+        /* Only applied if nothing newer has been asked for while it was being designed, taps_fft is complete before the demodulator can see it */
+        pthread_mutex_lock(&filter_mutex);
+        if(!filter_designing_superseded)
+        {
+            atomic_store_explicit(&request.demod->filter, filter, memory_order_release);
+            if(request.mode != IF_DEMOD_MODES)
+            {
+                atomic_store_explicit(&request.demod->mode, request.mode, memory_order_relaxed);
+            }
+        }
+        filter_designing = NULL;
+        filter_designing_mode = IF_DEMOD_MODES;
+        pthread_mutex_unlock(&filter_mutex);
+    }
+
+    fft_planner_free(taps);
+
+    return NULL;
+}
+
+/*
+    Demodulator stages. A mode is a list of these, run in order on one block at a time. They share
+    the instance's buffers, all allocated up front for every mode, so modes can be switched between blocks.
+
+        fft             input -> input_fourier
+        nr_spectral     spectral subtraction on input_fourier, if enabled
+        filter_real     bandpass, real part only (c2r) -> audio             SSB / CW
+        filter_complex  bandpass, complex (c2c) -> baseband                 AM / FM
+        am              envelope of baseband, carrier removed -> audio
+        fm              phase difference of baseband -> audio
+        agc             audio, in place
+        nr              LMS noise reduction or notch on audio, in place, if enabled
+        output          audio -> S16 in the output buffer
+*/
+typedef struct {
+    if_demod_t *demod;
+
+    /* FFT buffers */
+    buffer_iqsample_t *input;
+    buffer_iqsample_t *input_fourier;
+    buffer_iqsample_t *output_fourier;
+    buffer_iqsample_t *taps_fft;
+
+    /* Inverse FFT outputs, alternately the result and the overlap source */
+    float *output_real[2];
+    buffer_iqsample_t *output_complex[2];
+    bool odd;
+
+    /* Filtered complex baseband for AM and FM, input_size long */
+    buffer_iqsample_t *baseband;
+    /* Audio, input_size long */
+    float *audio;
+
+    float am_carrier;
+    buffer_iqsample_t fm_last;
+
+    dsp_agc_t agc;
+    dsp_nr_t nr;
+    dsp_dither_t dither;
+} if_demod_state_t;
+
+typedef void (*if_demod_stage_t)(if_demod_state_t *state);
+typedef bool (*if_demod_stage_enabled_t)(const if_demod_state_t *state);
+
+typedef enum {
+    IF_DEMOD_STAGE_FFT = 0,
+    IF_DEMOD_STAGE_NR_SPECTRAL,
+    IF_DEMOD_STAGE_FILTER_REAL,
+    IF_DEMOD_STAGE_FILTER_COMPLEX,
+    IF_DEMOD_STAGE_AM,
+    IF_DEMOD_STAGE_FM,
+    IF_DEMOD_STAGE_AGC,
+    IF_DEMOD_STAGE_NR,
+    IF_DEMOD_STAGE_OUTPUT,
+    IF_DEMOD_STAGES,
+    /* Ends a mode's stage list */
+    IF_DEMOD_STAGE_END = -1
+} if_demod_stage_id_t;
+
+_Static_assert(IF_DEMOD_STAGES <= IF_DEMOD_STAGES_MAX, "Error: IF_DEMOD_STAGES_MAX is too small");
+
+/* Mode registry, with the filter each mode starts with (relative to 10.24 KHz) */
+typedef struct {
+    const char *name;
+    float low_cut;
+    float high_cut;
+    float transition_bw;
+    dsp_window_t window;
+    if_demod_stage_id_t stages[IF_DEMOD_STAGES_MAX];
+} if_demod_mode_info_t;
+
+static const if_demod_mode_info_t if_demod_modes[IF_DEMOD_MODES] = {
+    [IF_DEMOD_MODE_USB] = { "usb", 0.02, 0.3, 0.1, DSP_WINDOW_HAMMING,
+        { IF_DEMOD_STAGE_FFT, IF_DEMOD_STAGE_NR_SPECTRAL, IF_DEMOD_STAGE_FILTER_REAL, IF_DEMOD_STAGE_AGC, IF_DEMOD_STAGE_NR,
+          IF_DEMOD_STAGE_OUTPUT, IF_DEMOD_STAGE_END } },
+    [IF_DEMOD_MODE_LSB] = { "lsb", -0.3, -0.02, 0.1, DSP_WINDOW_HAMMING,
+        { IF_DEMOD_STAGE_FFT, IF_DEMOD_STAGE_NR_SPECTRAL, IF_DEMOD_STAGE_FILTER_REAL, IF_DEMOD_STAGE_AGC, IF_DEMOD_STAGE_NR,
+          IF_DEMOD_STAGE_OUTPUT, IF_DEMOD_STAGE_END } },
+    /* 400 Hz around a 700 Hz tone */
+    [IF_DEMOD_MODE_CW] = { "cw", 500.0 / IF_DEMOD_SAMPLE_RATE, 900.0 / IF_DEMOD_SAMPLE_RATE, IF_DEMOD_TRANSITION_MIN, DSP_WINDOW_KAISER,
+        { IF_DEMOD_STAGE_FFT, IF_DEMOD_STAGE_NR_SPECTRAL, IF_DEMOD_STAGE_FILTER_REAL, IF_DEMOD_STAGE_AGC, IF_DEMOD_STAGE_NR,
+          IF_DEMOD_STAGE_OUTPUT, IF_DEMOD_STAGE_END } },
+    [IF_DEMOD_MODE_AM] = { "am", -0.3, 0.3, 0.1, DSP_WINDOW_HAMMING,
+        { IF_DEMOD_STAGE_FFT, IF_DEMOD_STAGE_NR_SPECTRAL, IF_DEMOD_STAGE_FILTER_COMPLEX, IF_DEMOD_STAGE_AM, IF_DEMOD_STAGE_AGC,
+          IF_DEMOD_STAGE_NR, IF_DEMOD_STAGE_OUTPUT, IF_DEMOD_STAGE_END } },
+    /* The discriminator output is already scaled (+-1.0 at +-5.12 KHz deviation), no AGC.
+        No spectral subtraction either, it would take the discriminator's limiting away. */
+    [IF_DEMOD_MODE_FM] = { "fm", -0.4, 0.4, 0.1, DSP_WINDOW_HAMMING,
+        { IF_DEMOD_STAGE_FFT, IF_DEMOD_STAGE_FILTER_COMPLEX, IF_DEMOD_STAGE_FM, IF_DEMOD_STAGE_NR, IF_DEMOD_STAGE_OUTPUT,
+          IF_DEMOD_STAGE_END } },
+};
+
+/* Switches the demodulator to a mode and its default filter, together once the filter is ready.
+    Returns false, staying in the current mode, if the filter can't be made. */
+bool if_demod_set_mode(if_demod_t *demod, if_demod_mode_t mode)
+{
+    const if_demod_mode_info_t *info;
+    if_demod_filter_t key;
+
+    if(mode >= IF_DEMOD_MODES)
     {
-        /* Wait for incoming data */
-        length_returned = 0;
-        buffer_circular_waitThresholdPop(&buffer_circular_iq_if, input_size, input_size, input, &length_returned);
-        if(length_returned != (uint32_t)input_size)
+        return false;
+    }
+    info = &if_demod_modes[mode];
+
+    key = (if_demod_filter_t){ .low_cut = info->low_cut, .high_cut = info->high_cut, .transition_bw = info->transition_bw, .window = info->window };
+
+    return if_demod_select(demod, &key, mode);
+}
+
+bool if_demod_mode_parse(const char *name, if_demod_mode_t *mode)
+{
+    for(int i = 0; i < IF_DEMOD_MODES; i++)
+    {
+        if(strcmp(name, if_demod_modes[i].name) == 0)
         {
-            fprintf(stderr, "demod error: input buffer_circular returned wrong length\n");
-            continue;
+            *mode = (if_demod_mode_t)i;
+            return true;
         }
+    }
+    return false;
+}
 
-#if 0
-        if(!monotonic_started)
+static void if_demod_stage_fft(if_demod_state_t *state)
+{
+    fft_planner_execute_dft(&demod_plan_forward, state->input, state->input_fourier);
+}
+
+/* Ahead of the filter, the gain is per bin so it doesn't matter which side of it this is, and
+    for SSB the bins kept map straight onto the audio spectrum */
+static void if_demod_stage_nr_spectral(if_demod_state_t *state)
+{
+    dsp_nr_spectral_execute(&state->nr, state->input_fourier);
+}
+
+static bool if_demod_stage_nr_spectral_enabled(const if_demod_state_t *state)
+{
+    return state->nr.Mode == DSP_NR_SPECTRAL;
+}
+
+/** use the overlap & add method for filtering **/
+static void if_demod_stage_filter_real(if_demod_state_t *state)
+{
+    const buffer_iqsample_t *input_fourier = state->input_fourier;
+    const buffer_iqsample_t *taps_fft = state->taps_fft;
+    buffer_iqsample_t *output_fourier = state->output_fourier;
+    float *result = state->output_real[state->odd ? 1 : 0];
+    const float *last_overlap = state->output_real[state->odd ? 0 : 1] + input_size; //+ fft_size - overlap_length;
+    float *audio = state->audio;
+    buffer_iqsample_t y_k, y_nk;
+    int overlap_in_block = (overlap_length < input_size) ? overlap_length : input_size;
+    int nan_found = 0;
+    float re;
+    int i, k;
+
+    /*
+        Multiply the filter and the input, and fold the product into the half spectrum of its real part:
+
+            Re(y)[n] <=> Z[k] = (Y[k] + conj(Y[N-k])) / 2,  k = 0 .. N/2
+
+        Z is Hermitian, so a complex-to-real inverse FFT of N/2+1 bins gives Re(y) directly, this is where
+        the demodulator drops Q. That's half the inverse FFT work and half the output, the /2 is in the taps.
+    */
+    for(k = 0; k <= (fft_size / 2); k++) //@apply_fir_fft_cc: multiplication
+    {
+        i = (fft_size - k) & (fft_size - 1);
+        y_k.i = (input_fourier[k].i * taps_fft[k].i) - (input_fourier[k].q * taps_fft[k].q);
+        y_k.q = (input_fourier[k].i * taps_fft[k].q) + (input_fourier[k].q * taps_fft[k].i);
+        y_nk.i = (input_fourier[i].i * taps_fft[i].i) - (input_fourier[i].q * taps_fft[i].q);
+        y_nk.q = (input_fourier[i].i * taps_fft[i].q) + (input_fourier[i].q * taps_fft[i].i);
+        output_fourier[k].i = y_k.i + y_nk.i;
+        output_fourier[k].q = y_k.q - y_nk.q;
+    }
+
+    //calculate inverse FFT on multiplied buffer (output_fourier is overwritten)
+    fft_planner_execute_c2r(&demod_plan_inverse_real, output_fourier, result);
+    state->odd = !state->odd;
+
+    /*
+        Add the overlap of the previous segment in one pass, already normalized by the taps and real (csdr realpart_cf).
+        Only the output is written, result is left as the overlap source.
+        NaNs are only flagged here (x != x), so the loop has no dependency between samples and vectorizes.
+    */
+    for(i = 0; i < overlap_in_block; i++) //@apply_fir_fft_cc: add overlap
+    {
+        re = result[i] + last_overlap[i];
+        nan_found += (re != re);
+        audio[i] = re;
+    }
+    for(; i < input_size; i++)
+    {
+        re = result[i];
+        nan_found += (re != re);
+        audio[i] = re;
+    }
+
+    //overlap longer than the block, the rest carries on into the next one
+    for(i = input_size; i < overlap_length; i++)
+    {
+        result[i] += last_overlap[i];
+    }
+
+    //copy previous converted result if isnan() (avoids clicks)
+    if(nan_found)
+    {
+        for(i = 0; i < input_size; i++)
         {
-            start_monotonic = monotonic_ms();
-            monotonic_started = true;
+            if(isnan(audio[i])) audio[i] = (i > 0 ? audio[i-1] : 0.0);
         }
-#endif
+    }
+}
 
-        last_overlap = (buffer_iqsample_t*)((odd) ? output_1 : output_2) + input_size; //+ fft_size - overlap_length;
+/* As filter_real, keeping the complex result. The taps carry the real path's /2, the AM and FM stages don't depend on the level. */
+static void if_demod_stage_filter_complex(if_demod_state_t *state)
+{
+    const buffer_iqsample_t *input_fourier = state->input_fourier;
+    const buffer_iqsample_t *taps_fft = state->taps_fft;
+    buffer_iqsample_t *output_fourier = state->output_fourier;
+    buffer_iqsample_t *result = state->output_complex[state->odd ? 1 : 0];
+    const buffer_iqsample_t *last_overlap = state->output_complex[state->odd ? 0 : 1] + input_size;
+    buffer_iqsample_t *baseband = state->baseband;
+    int overlap_in_block = (overlap_length < input_size) ? overlap_length : input_size;
+    int nan_found = 0;
+    int i;
 
-        /** use the overlap & add method for filtering **/
+    for(i = 0; i < fft_size; i++) //@apply_fir_fft_cc: multiplication
+    {
+        output_fourier[i].i = (input_fourier[i].i * taps_fft[i].i) - (input_fourier[i].q * taps_fft[i].q);
+        output_fourier[i].q = (input_fourier[i].i * taps_fft[i].q) + (input_fourier[i].q * taps_fft[i].i);
+    }
 
-        //calculate FFT on input buffer
-        fftwf_execute(demod_plan_forward);
+    fft_planner_execute_dft(&demod_plan_inverse, output_fourier, result);
+    state->odd = !state->odd;
 
-        //multiply the filter and the input
-        for(i = 0; i < fft_size; i++) //@apply_fir_fft_cc: multiplication
+    for(i = 0; i < overlap_in_block; i++) //@apply_fir_fft_cc: add overlap
+    {
+        baseband[i].i = result[i].i + last_overlap[i].i;
+        baseband[i].q = result[i].q + last_overlap[i].q;
+        nan_found += (baseband[i].i != baseband[i].i) + (baseband[i].q != baseband[i].q);
+    }
+    for(; i < input_size; i++)
+    {
+        baseband[i] = result[i];
+        nan_found += (baseband[i].i != baseband[i].i) + (baseband[i].q != baseband[i].q);
+    }
+
+    for(i = input_size; i < overlap_length; i++)
+    {
+        result[i].i += last_overlap[i].i;
+        result[i].q += last_overlap[i].q;
+    }
+
+    if(nan_found)
+    {
+        for(i = 0; i < input_size; i++)
         {
-            output_fourier[i].i = (input_fourier[i].i * taps_fft[i].i) - (input_fourier[i].q * taps_fft[i].q);
-            output_fourier[i].q = (input_fourier[i].i * taps_fft[i].q) + (input_fourier[i].q * taps_fft[i].i);
+            if(isnan(baseband[i].i) || isnan(baseband[i].q))
+            {
+                baseband[i] = (i > 0) ? baseband[i-1] : (buffer_iqsample_t){ 0, 0 };
+            }
         }
+    }
+}
+
+/* Envelope detector, the carrier level (block average) is tracked slowly and subtracted, ramped across the block */
+static void if_demod_stage_am(if_demod_state_t *state)
+{
+    const buffer_iqsample_t *baseband = state->baseband;
+    float *audio = state->audio;
+    float sum = 0;
+    float carrier, carrier_step;
+
+    for(int i = 0; i < input_size; i++)
+    {
+        audio[i] = sqrtf((baseband[i].i * baseband[i].i) + (baseband[i].q * baseband[i].q));
+        sum += audio[i];
+    }
+
+    carrier = state->am_carrier + (((sum / input_size) - state->am_carrier) * 0.1f);
+    carrier_step = (carrier - state->am_carrier) / input_size;
+    for(int i = 0; i < input_size; i++)
+    {
+        audio[i] -= state->am_carrier + (carrier_step * (i + 1));
+    }
+    state->am_carrier = carrier;
+}
+
+/* Quadrature discriminator, arg(x[n] conj(x[n-1])) / pi */
+static void if_demod_stage_fm(if_demod_state_t *state)
+{
+    const buffer_iqsample_t *baseband = state->baseband;
+    float *audio = state->audio;
+    buffer_iqsample_t last = state->fm_last;
+
+    for(int i = 0; i < input_size; i++)
+    {
+        audio[i] = atan2f((baseband[i].q * last.i) - (baseband[i].i * last.q), (baseband[i].i * last.i) + (baseband[i].q * last.q)) * (float)M_1_PI;
+        last = baseband[i];
+    }
+    state->fm_last = last;
+}
+
+/* block AGC, replaces csdr agc_ff */
+static void if_demod_stage_agc(if_demod_state_t *state)
+{
+    dsp_agc_mode_t agc_mode = atomic_load_explicit(&state->demod->agc_mode, memory_order_relaxed);
+
+    if(agc_mode != state->agc.Mode)
+    {
+        dsp_agc_set_mode(&state->agc, agc_mode, IF_DEMOD_SAMPLE_RATE);
+    }
+    dsp_agc_execute_ff(&state->agc, state->audio, state->audio, input_size);
+}
+
+static void if_demod_stage_nr(if_demod_state_t *state)
+{
+    dsp_nr_execute_ff(&state->nr, state->audio, input_size);
+}
 
-        //calculate inverse FFT on multiplied buffer
-        fftwf_execute((odd)?demod_plan_inverse_2:demod_plan_inverse_1);
+static bool if_demod_stage_nr_enabled(const if_demod_state_t *state)
+{
+    return state->nr.Mode == DSP_NR_LMS || state->nr.Mode == DSP_NR_NOTCH;
+}
 
-        //add the overlap of the previous segment
-        result = (odd) ? output_2 : output_1;
+/* csdr limit_ff and convert_f_s16 in one saturating SIMD pass, written straight into the audio buffer */
+static void if_demod_stage_output(if_demod_state_t *state)
+{
+    if_demod_t *demod = state->demod;
+    buffer_circular_span_t output_spans[2];
+    uint32_t output_length;
 
-        for(i = 0; i < fft_size; i++) //@apply_fir_fft_cc: normalize by fft_size
+    if(demod->dither)
+    {
+        dsp_dither_tpdf_ff(&state->dither, state->audio, input_size);
+    }
+    output_length = buffer_circular_reserve(demod->output, input_size, output_spans);
+    dsp_convert_ff_s16(state->audio, (int16_t *)output_spans[0].Data, output_spans[0].Length);
+    dsp_convert_ff_s16(&state->audio[output_spans[0].Length], (int16_t *)output_spans[1].Data, output_spans[1].Length);
+    buffer_circular_commit(demod->output, output_length);
+    if(output_length < (uint32_t)input_size)
+    {
+        fprintf(stderr, "IQ Demod (%s): WARNING push to audio buffer was lossy (%d / %d returned)\n",
+            demod->name, input_size - output_length, input_size);
+    }
+}
+
+static const struct {
+    const char *name;
+    if_demod_stage_t execute;
+    /* NULL if always run */
+    if_demod_stage_enabled_t enabled;
+} if_demod_stages[IF_DEMOD_STAGES] = {
+    [IF_DEMOD_STAGE_FFT] = { "FFT", if_demod_stage_fft, NULL },
+    [IF_DEMOD_STAGE_NR_SPECTRAL] = { "NR (spectral)", if_demod_stage_nr_spectral, if_demod_stage_nr_spectral_enabled },
+    [IF_DEMOD_STAGE_FILTER_REAL] = { "Filter (real)", if_demod_stage_filter_real, NULL },
+    [IF_DEMOD_STAGE_FILTER_COMPLEX] = { "Filter (complex)", if_demod_stage_filter_complex, NULL },
+    [IF_DEMOD_STAGE_AM] = { "AM", if_demod_stage_am, NULL },
+    [IF_DEMOD_STAGE_FM] = { "FM", if_demod_stage_fm, NULL },
+    [IF_DEMOD_STAGE_AGC] = { "AGC", if_demod_stage_agc, NULL },
+    [IF_DEMOD_STAGE_NR] = { "NR (LMS)", if_demod_stage_nr, if_demod_stage_nr_enabled },
+    [IF_DEMOD_STAGE_OUTPUT] = { "Output", if_demod_stage_output, NULL },
+};
+
+/* Average time per block of each stage that has run, and of the whole chain against the block's duration
+    (the real-time budget), call once the thread has exited */
+void if_demod_metricsPrint(const if_demod_t *demod)
+{
+    uint64_t total_ns = 0;
+    double budget_us = (1e6 * input_size) / IF_DEMOD_SAMPLE_RATE;
+    double total_us;
+
+    printf("IF Demod (%s) stages:\n", demod->name);
+    for(int s = 0; s < IF_DEMOD_STAGES; s++)
+    {
+        if(demod->metrics.stage_blocks[s] > 0)
         {
-            result[i].i /= fft_size;
-            result[i].q /= fft_size;
+            printf("  %-18s %8.2f us/block (%"PRIu64" blocks)\n", if_demod_stages[s].name,
+                (double)demod->metrics.stage_ns[s] / (1000.0 * demod->metrics.stage_blocks[s]), demod->metrics.stage_blocks[s]);
+            total_ns += demod->metrics.stage_ns[s];
         }
+    }
+
+    /* Every mode starts with the FFT, so it has run once per block */
+    if(demod->metrics.stage_blocks[IF_DEMOD_STAGE_FFT] > 0)
+    {
+        total_us = (double)total_ns / (1000.0 * demod->metrics.stage_blocks[IF_DEMOD_STAGE_FFT]);
+        printf("  %-18s %8.2f us/block, %.1f%% of the %.0f us budget\n", "Total", total_us, (100.0 * total_us) / budget_us, budget_us);
+    }
+}
+
+/* IF Demodulator Thread, one per if_demod_t instance */
+void *if_demod_thread(void *arg)
+{
+    if_demod_t *demod = (if_demod_t *)arg;
+    bool *exit_requested = demod->exit_requested;
+    if_demod_state_t state = { .demod = demod, .odd = false };
+
+    /* FFT buffers */
+    state.input = fft_planner_alloc(fft_size * sizeof(buffer_iqsample_t));
+    state.input_fourier = fft_planner_alloc(fft_size * sizeof(buffer_iqsample_t));
+    state.output_fourier = fft_planner_alloc(fft_size * sizeof(buffer_iqsample_t));
+    for(int b = 0; b < 2; b++)
+    {
+        state.output_real[b] = fft_planner_alloc(fft_size * sizeof(float));
+        state.output_complex[b] = fft_planner_alloc(fft_size * sizeof(buffer_iqsample_t));
+    }
+    state.baseband = (buffer_iqsample_t *)malloc(input_size * sizeof(buffer_iqsample_t));
+    state.audio = (float *)malloc(input_size * sizeof(float));
+
+    /* Input blocks popped together, then fed through the stages one at a time */
+    buffer_iqsample_t *input_blocks;
+    uint32_t blocks_pending = 0;
+    uint32_t blocks_next = 0;
+
+    int i;
+    if_demod_filter_t *filter;
+    if_demod_mode_t mode = IF_DEMOD_MODES;
+    if_demod_mode_t mode_next;
+    dsp_nr_mode_t nr_mode;
+    const if_demod_stage_id_t *stages = NULL;
+    uint64_t stage_start, stage_end;
+
+    /* AGC, the mode can be changed while running with if_demod_set_agc() */
+    dsp_agc_init(&state.agc, atomic_load_explicit(&demod->agc_mode, memory_order_relaxed), IF_DEMOD_SAMPLE_RATE);
+    /* Noise reduction, set with if_demod_set_nr(). Spectral subtraction works on the whole forward FFT */
+    if(!dsp_nr_init(&state.nr, atomic_load_explicit(&demod->nr_mode, memory_order_relaxed), input_size, fft_size, &demod_plan_forward, &demod_plan_inverse))
+    {
+        fprintf(stderr, "IF Demod (%s): Error allocating noise reduction\n", demod->name);
+        return NULL;
+    }
+    dsp_dither_init(&state.dither, (uint32_t)(uintptr_t)demod);
+
+    input_blocks = (buffer_iqsample_t *)malloc(IF_DEMOD_MAX_BLOCKS * input_size * sizeof(buffer_iqsample_t));
+
+    if(state.input == NULL || state.input_fourier == NULL || state.output_fourier == NULL
+        || state.output_real[0] == NULL || state.output_real[1] == NULL || state.output_complex[0] == NULL || state.output_complex[1] == NULL
+        || state.baseband == NULL || state.audio == NULL || input_blocks == NULL)
+    {
+        fprintf(stderr, "IF Demod (%s): Error allocating buffers\n", demod->name);
+        return NULL;
+    }
+
+    //we pre-pad the input buffer with zeros, either side of input_offset .. input_offset + input_size
+    for(i = 0; i < fft_size; i++) state.input[i].i = state.input[i].q = 0;
 
-        for(i = 0; i < overlap_length; i++) //@apply_fir_fft_cc: add overlap
+#if 0
+    bool monotonic_started = false;
+    uint64_t samples_total = 0;
+    uint64_t start_monotonic = 0;
+#endif
+
+    while(!*exit_requested)
+    {
+        /* Wait for incoming data, taking every whole block available when behind */
+        if(blocks_pending == 0)
         {
-            result[i].i += last_overlap[i].i;
-            result[i].q += last_overlap[i].q;
+            blocks_pending = buffer_circular_waitBlocksPop(demod->input, input_size, IF_DEMOD_MAX_BLOCKS, input_blocks, 100);
+            blocks_next = 0;
+            if(blocks_pending == 0)
+            {
+                /* Timed out or closed, check for exit */
+                continue;
+            }
         }
-        odd = !odd;
+        memcpy(&state.input[input_offset], &input_blocks[blocks_next * input_size], input_size * sizeof(buffer_iqsample_t));
+        blocks_next++;
+        blocks_pending--;
 
 #if 0
-        printf("Demod finished: %d samples\n", input_size);
-        for(i = 0; i < input_size; i++)
+        if(!monotonic_started)
         {
-            printf("%f,%f,", result[i].i, result[i].q);
+            start_monotonic = monotonic_ms();
+            monotonic_started = true;
         }
-        printf("\n");
 #endif
 
-        // csdr realpart_cf
-        // also check for NaN and copy previous converted result if isnan() (avoids clicks)
-        for(i = 0; i < input_size; i++)
+        //pick up any new mode and filter at the block boundary, as a pair. Only the first block waits for filter_mutex,
+        //after that if another thread holds it they're picked up a block later
+        mode_next = mode;
+        if((stages == NULL) ? (pthread_mutex_lock(&filter_mutex) == 0) : (pthread_mutex_trylock(&filter_mutex) == 0))
         {
-            realpart_buffer[i] = isnan(result[i].i) ? (i > 0 ? realpart_buffer[i-1] : 0.0) : result[i].i;
+            mode_next = atomic_load_explicit(&demod->mode, memory_order_relaxed);
+            filter = atomic_load_explicit(&demod->filter, memory_order_acquire);
+            pthread_mutex_unlock(&filter_mutex);
+            state.taps_fft = (filter != NULL) ? filter->taps_fft : filter_default->taps_fft;
         }
+        if(mode_next != mode && mode_next < IF_DEMOD_MODES)
+        {
+            /* Start from silence, the overlap may be from the other filter path */
+            for(int b = 0; b < 2; b++)
+            {
+                memset(state.output_real[b], 0, fft_size * sizeof(float));
+                memset(state.output_complex[b], 0, fft_size * sizeof(buffer_iqsample_t));
+            }
+            state.am_carrier = 0;
+            state.fm_last = (buffer_iqsample_t){ 0, 0 };
 
-        // csdr agc_ff
-        last_gain = agc_ff(realpart_buffer, agc_buffer, input_size, reference, attack_rate, decay_rate, max_gain, hang_time, attack_wait, filter_alpha, last_gain);
-
-        // csdr limit_ff (done in place)
-        for (i = 0; i < input_size; i++)
+            mode = mode_next;
+            stages = if_demod_modes[mode].stages;
+        }
+        nr_mode = atomic_load_explicit(&demod->nr_mode, memory_order_relaxed);
+        if(nr_mode != state.nr.Mode)
         {
-            agc_buffer[i] = (1.0 < agc_buffer[i]) ? 1.0 : agc_buffer[i];
-            agc_buffer[i] = (-1.0 > agc_buffer[i] ) ? -1.0 : agc_buffer[i];
+            dsp_nr_set_mode(&state.nr, nr_mode);
         }
 
-        // csdr convert_f_s16
-        for(i = 0; i < input_size; i++)
+        stage_start = monotonic_ns();
+        for(int s = 0; s < IF_DEMOD_STAGES_MAX && stages[s] != IF_DEMOD_STAGE_END; s++)
         {
-            s16_buffer[i] = agc_buffer[i] * SHRT_MAX; //@convert_f_s16
+            if(if_demod_stages[stages[s]].enabled != NULL && !if_demod_stages[stages[s]].enabled(&state))
+            {
+                continue;
+            }
+            if_demod_stages[stages[s]].execute(&state);
+
+            stage_end = monotonic_ns();
+            demod->metrics.stage_ns[stages[s]] += stage_end - stage_start;
+            demod->metrics.stage_blocks[stages[s]]++;
+            stage_start = stage_end;
         }
 
 #if 0
         printf("Demod finished: %d samples\n", input_size);
         for(i = 0; i < input_size; i++)
         {
-            printf("%d,", s16_buffer[i]);
+            printf("%f,", state.audio[i]);
         }
         printf("\n");
 #endif
@@ -401,23 +986,27 @@ void *if_demod_thread(void *arg)
         // Samplerate appears to be approximately 10550Hz
 
 
-        /* Copy out for audio playback */
-        uint32_t samples_rx_transferred = input_size;
-        buffer_circular_push(&buffer_circular_audio, s16_buffer, &samples_rx_transferred);
-        if(samples_rx_transferred > 0)
-        {
-            fprintf(stderr, "IQ Demod: WARNING push to audio buffer was lossy (%d / %d returned)\n",
-                samples_rx_transferred, input_size);
-        }
-
 #if 0
         uint32_t head, tail, capacity, occupied;
-        buffer_circular_stats(&buffer_circular_audio, &head, &tail, &capacity, &occupied);
+        buffer_circular_stats(demod->output, &head, &tail, &capacity, &occupied);
         printf("Audio Buffer: Head: %d, Tail: %d, Capacity: %d, Occupied: %d\n",
             head, tail, capacity, occupied);
 #endif
 
     }
 
+    free(input_blocks);
+    dsp_nr_free(&state.nr);
+    free(state.baseband);
+    free(state.audio);
+    fft_planner_free(state.input);
+    fft_planner_free(state.input_fourier);
+    fft_planner_free(state.output_fourier);
+    for(int b = 0; b < 2; b++)
+    {
+        fft_planner_free(state.output_real[b]);
+        fft_planner_free(state.output_complex[b]);
+    }
+
     return NULL;
-}
\ No newline at end of file
+}
@@ -1,7 +1,64 @@
 #ifndef __IF_DEMOD_H__
 #define __IF_DEMOD_H__
 
-void if_demod_init(void);
+#include "buffer/buffer_circular.h"
+#include "dsp/dsp_firdes.h"
+#include "dsp/dsp_agc.h"
+#include "dsp/dsp_nr.h"
+
+/* Narrowest transition band (relative to 10.24 KHz) a filter can be designed with, this sets the FFT size */
+#define IF_DEMOD_TRANSITION_MIN 0.02
+
+/* Most stages in any mode, and kinds of stage */
+#define IF_DEMOD_STAGES_MAX 12
+
+/* Demodulator modes, each with its own stage list and default filter. USB (0) is the default */
+typedef enum {
+    IF_DEMOD_MODE_USB = 0,
+    IF_DEMOD_MODE_LSB,
+    IF_DEMOD_MODE_CW,
+    IF_DEMOD_MODE_AM,
+    IF_DEMOD_MODE_FM,
+    IF_DEMOD_MODES
+} if_demod_mode_t;
+
+/* Designed and FFT'd filter, owned by the filter cache */
+typedef struct if_demod_filter_t if_demod_filter_t;
+
+/* Time spent in each kind of stage, written by the demodulator thread */
+typedef struct {
+    uint64_t stage_ns[IF_DEMOD_STAGES_MAX];
+    uint64_t stage_blocks[IF_DEMOD_STAGES_MAX];
+} if_demod_metrics_t;
+
+/* One demodulator chain, IQ at 10.24 KHz in, S16 audio out */
+typedef struct {
+    const char *name;
+    bool *exit_requested;
+    buffer_circular_t *input;
+    buffer_circular_t *output;
+    /* Swapped in by if_demod_set_passband(), picked up at the next block. NULL for the default filter */
+    if_demod_filter_t *_Atomic filter;
+    /* Set with if_demod_set_mode() along with its filter, both under the filter lock, picked up at the next block */
+    _Atomic if_demod_mode_t mode;
+    /* Set with if_demod_set_agc(), DSP_AGC_SLOW (0) by default */
+    _Atomic dsp_agc_mode_t agc_mode;
+    /* Set with if_demod_set_nr(), DSP_NR_OFF (0) by default */
+    _Atomic dsp_nr_mode_t nr_mode;
+    /* TPDF dither ahead of the conversion to S16 */
+    bool dither;
+
+    if_demod_metrics_t metrics;
+} if_demod_t;
+
+bool if_demod_init(void);
+bool if_demod_set_passband(if_demod_t *demod, float low_cut, float high_cut, float transition_bw, dsp_window_t window);
+bool if_demod_set_mode(if_demod_t *demod, if_demod_mode_t mode);
+bool if_demod_mode_parse(const char *name, if_demod_mode_t *mode);
+void if_demod_set_agc(if_demod_t *demod, dsp_agc_mode_t mode);
+void if_demod_set_nr(if_demod_t *demod, dsp_nr_mode_t mode);
+void if_demod_metricsPrint(const if_demod_t *demod);
+void *if_demod_filter_thread(void *arg);
 void *if_demod_thread(void *arg);
 
 #endif /* __IF_DEMOD_H__ */
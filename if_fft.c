@@ -15,8 +15,11 @@
 #include <fftw3.h>
 
 #include "timing.h"
+#include "fft_planner.h"
 #include "if_subsample.h"
 #include "graphics.h"
+#include "dsp/dsp_window.h"
+#include "dsp/dsp_spectrum.h"
 
 /* Input from if_subsample.c */
 extern if_fft_buffer_t if_fft_buffer;
@@ -25,42 +28,39 @@ extern if_fft_buffer_t if_fft_buffer;
 //#define FFT_TIME_SMOOTH 0.999f // 0.0 - 1.0
 #define FFT_TIME_SMOOTH 0.4f // 0.0 - 1.0
 
-static float hanning_window_const[FFT_SIZE];
-static float hamming_window_const[FFT_SIZE];
+static float window_const[FFT_SIZE];
 
 static fftwf_complex* fft_in;
 static fftwf_complex* fft_out;
-static fftwf_plan fft_plan;
+static fft_planner_plan_t fft_plan;
 
-static float fft_data_staging[FFT_SIZE];
-static float fft_scaled_data[FFT_SIZE];
+/* Display scaling 15 * (dBFS + 76). The offset was 79 when the power was only half there (pwr_scale * re^2 + im^2). */
+static dsp_spectrum_t fft_spectrum;
 static uint8_t fft_data_output[FFT_SIZE];
 
-void if_fft_init(void)
+bool if_fft_init(void)
 {
-    for(int i=0; i<FFT_SIZE; i++)
-    {
-        /* Hanning */
-        hanning_window_const[i] = 0.5 * (1.0 - cos(2*M_PI*(((float)i)/FFT_SIZE)));
+    /* Hamming, symmetric */
+    dsp_window_table_f(window_const, FFT_SIZE, DSP_WINDOW_HAMMING, 0, false);
 
-        /* Hamming */
-        hamming_window_const[i] = 0.54 - (0.46 * cos(2*M_PI*(0.5+((2.0*((float)i/(FFT_SIZE-1))+1.0)/2))));
+    if(!dsp_spectrum_init(&fft_spectrum, FFT_SIZE, FFT_TIME_SMOOTH, 15.0, 76.0))
+    {
+        fprintf(stderr, "IF FFT: Error allocating spectrum buffers\n");
+        return false;
     }
 
+
     /* Set up FFTW */
-    fft_in = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * FFT_SIZE);
-    fft_out = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * FFT_SIZE);
-    fft_plan = fftwf_plan_dft_1d(FFT_SIZE, fft_in, fft_out, FFTW_FORWARD, FFTW_PATIENT);
-    printf(" "); fftwf_print_plan(fft_plan); printf("\n");
+    fft_in = (fftwf_complex*) fft_planner_alloc(sizeof(fftwf_complex) * FFT_SIZE);
+    fft_out = (fftwf_complex*) fft_planner_alloc(sizeof(fftwf_complex) * FFT_SIZE);
+    return fft_in != NULL && fft_out != NULL && fft_planner_add(&fft_plan, "IF Band FFT", FFT_PLANNER_FORWARD, FFT_SIZE, fft_in, fft_out);
 }
 
 static void fft_fftw_close(void)
 {
-    /* De-init fftw */
-    fftwf_free(fft_in);
-    fftwf_free(fft_out);
-    fftwf_destroy_plan(fft_plan);
-    fftwf_forget_wisdom();
+    /* De-init fftw, the plan belongs to the planner */
+    fft_planner_free(fft_in);
+    fft_planner_free(fft_out);
 }
 
 /* IF_FFT Thread */
@@ -69,10 +69,9 @@ void *if_fft_thread(void *arg)
     bool *exit_requested = (bool *)arg;
 
     int i, offset;
-    fftw_complex pt;
-    double pwr, lpwr;
 
-    double pwr_scale = 1.0 / ((float)FFT_SIZE * (float)FFT_SIZE);
+    /* |X|^2 / N^2 is full scale at 0 dBFS */
+    float pwr_scale = 1.0 / ((float)FFT_SIZE * (float)FFT_SIZE);
 
     struct timespec ts;
 
@@ -110,8 +109,8 @@ void *if_fft_thread(void *arg)
         /* Copy data out of rf buffer into fft_input buffer */
         for (i = 0; i < FFT_SIZE; i++)
         {
-            fft_in[i][0] = (((float*)if_fft_buffer.data)[offset+(2*i)]) * hamming_window_const[i];
-            fft_in[i][1] = (((float*)if_fft_buffer.data)[offset+(2*i)+1]) * hamming_window_const[i];
+            fft_in[i][0] = (((float*)if_fft_buffer.data)[offset+(2*i)]) * window_const[i];
+            fft_in[i][1] = (((float*)if_fft_buffer.data)[offset+(2*i)+1]) * window_const[i];
             //printf("D in: %.4f, %.4f\n",
             //    ((float*)if_fft_buffer.data)[offset+(2*i)],
             //    ((float*)if_fft_buffer.data)[offset+(2*i)+1]);
@@ -123,44 +122,12 @@ void *if_fft_thread(void *arg)
         pthread_mutex_unlock(&if_fft_buffer.mutex);
 
         /* Run FFT */
-        fftwf_execute(fft_plan);
-
-        float int_max = -9999.0;
-        float int_min = 9999.0;
+        fft_planner_execute_dft(&fft_plan, fft_in, fft_out);
 
-        for (i = 0; i < FFT_SIZE; i++)
-        {
-            /* shift, normalize and convert to dBFS */
-            if (i < FFT_SIZE / 2)
-            {
-                pt[0] = fft_out[FFT_SIZE / 2 + i][0] / FFT_SIZE;
-                pt[1] = fft_out[FFT_SIZE / 2 + i][1] / FFT_SIZE;
-            }
-            else
-            {
-                pt[0] = fft_out[i - FFT_SIZE / 2][0] / FFT_SIZE;
-                pt[1] = fft_out[i - FFT_SIZE / 2][1] / FFT_SIZE;
-            }
-            pwr = pwr_scale * (pt[0] * pt[0]) + (pt[1] * pt[1]);
-            lpwr = 10.f * log10(pwr + 1.0e-20);
-            
-            fft_data_staging[i] = (lpwr * (1.f - FFT_TIME_SMOOTH)) + (fft_data_staging[i] * FFT_TIME_SMOOTH);
-
-            //printf("%f\n", fft_data_staging[i]);
-
-            fft_scaled_data[i] = 15 * (fft_data_staging[i] + 79);
-
-            if(fft_scaled_data[i] > int_max) int_max = fft_scaled_data[i];
-            if(fft_scaled_data[i] < int_min) int_min = fft_scaled_data[i];
-
-            if(fft_scaled_data[i] < 0) fft_scaled_data[i] = 0;
-            if(fft_scaled_data[i] > 255) fft_scaled_data[i] = 255;
-
-            fft_data_output[i] = (uint8_t)(fft_scaled_data[i]);
-        }
-        //printf("Max: %f, Min %f\n", int_max, int_min);
+        /* shift, normalize, convert to dBFS, smooth and scale */
+        dsp_spectrum_cf_u8(&fft_spectrum, (buffer_iqsample_t *)fft_out, pwr_scale, fft_data_output);
 
-        //ws_fft_submit((uint8_t *)fft_data_staging, (FFT_SIZE * sizeof(float)));
+        //ws_fft_submit((uint8_t *)fft_spectrum.Staging, (FFT_SIZE * sizeof(float)));
 
         if(monotonic_ms() > (last_output + 30))
         {
@@ -1,7 +1,7 @@
 #ifndef __IF_FFT_H__
 #define __IF_FFT_H__
 
-void if_fft_init(void);
+bool if_fft_init(void);
 void *if_fft_thread(void *arg);
 
 #endif /* __FFT_H__ */
\ No newline at end of file
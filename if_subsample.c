@@ -28,6 +28,9 @@
 #include "timing.h"
 #include "if_subsample.h"
 #include "buffer/buffer_circular.h"
+#include "dsp/dsp.h"
+#include "dsp/dsp_decimator.h"
+#include "dsp/dsp_fastconv.h"
 
 if_fft_buffer_t if_fft_buffer;
 
@@ -38,118 +41,55 @@ extern int64_t selected_center_frequency;
 
 #define DECIMATION_FACTOR   50 // 512 KHz / 50 = 10.240 KHz
 
-void shift_addition_cc(buffer_iqsample_t *input, buffer_iqsample_t* output, float rate, float *starting_phase)
-{
-    //The original idea was taken from wdsp:
-    //http://svn.tapr.org/repos_sdr_hpsdr/trunk/W5WC/PowerSDR_HPSDR_mRX_PS/Source/wdsp/shift.c
+/* 512 KHz -> 102.4 KHz -> 20.48 KHz -> 10.24 KHz */
+static const int decimation_stages[] = { 5, 5, 2 };
+#define DECIMATION_CIC_ORDER    3
+/* Alias-free up to 4.096 KHz either side of the selected frequency */
+#define DECIMATION_PASSBAND     (0.4 / DECIMATION_FACTOR)
+/* Stopband, dB */
+#define DECIMATION_ATTENUATION  60
 
-    //However, this method introduces noise (from floating point rounding errors), which increases until the end of the buffer.
-    //fprintf(stderr, "cosd=%g sind=%g\n", d.cosdelta, d.sindelta);
+/* Fast convolution alternative, a much sharper filter (4.8 - 5.2 KHz transition, 4641 taps) for about the same cost per sample */
+#define FASTCONV_FFT_SIZE       25600
+#define FASTCONV_PASSBAND       (4800.0 / 512000)
+#define FASTCONV_STOPBAND       (5200.0 / 512000)
+#define FASTCONV_ATTENUATION    60
 
-    float sindelta = sin(2 * rate * M_PI);
-    float cosdelta = cos(2 * rate * M_PI);
+/* Selected by --fastconv */
+bool if_subsample_fastconv = false;
 
-    float cosphi = cos(*starting_phase);
-    float sinphi = sin(*starting_phase);
-    float cosphi_last, sinphi_last;
+static dsp_decimator_t decimator;
+static dsp_fastconv_t fastconv;
 
-    for(int i = 0; i < INPUT_SIZE; i++) //@shift_addition_cc: work
-    {
-        output[i].i = (cosphi * input[i].i) - (sinphi * input[i].q);
-        output[i].q = (sinphi * input[i].i) + (cosphi * input[i].q);
-        //using the trigonometric addition formulas
-        //cos(phi+delta)=cos(phi)cos(delta)-sin(phi)*sin(delta)
-        cosphi_last = cosphi;
-        sinphi_last = sinphi;
-        cosphi = (cosphi_last * cosdelta) - (sinphi_last * sindelta);
-        sinphi = (sinphi_last * cosdelta) + (cosphi_last * sindelta);
-    }
-
-    *starting_phase += rate * M_PI * INPUT_SIZE;
-    while(*starting_phase > M_PI) *starting_phase -= 2 * M_PI; //@shift_addition_cc: normalize starting_phase
-    while(*starting_phase < -M_PI) *starting_phase += 2 * M_PI;
-}
+/* Minimum and maximum input window per iteration, and the output it can give */
+static uint32_t window_min, window_max, output_max;
 
-int fir_decimate_cc(buffer_iqsample_t *input, buffer_iqsample_t *output, int buffer_size, int decimation, float *taps, int taps_length)
+/* Sets up the decimation engine, including its FFTW plans */
+bool if_subsample_init(void)
 {
-    //Theory: http://www.dspguru.com/dsp/faqs/multirate/decimation
-    //It uses real taps. It returns the number of output samples actually written.
-    //It needs overlapping input based on its returned value:
-    //number of processed input samples = returned value * decimation factor
-    //The output buffer should be at least input_length / 3.
-    // i: input index | ti: tap index | oi: output index
-    int oi=0;
-    for(int i=0; i<buffer_size; i+=decimation) //@fir_decimate_cc: outer loop
+    if(if_subsample_fastconv)
     {
-        if(i+taps_length>buffer_size) break;
-        register float* pinput=(float*)&(input[i]);
-        register float* ptaps=taps;
-        register float* ptaps_end=taps+taps_length;
-        float quad_acciq [8];
-
-/*
-q0, q1: input signal I sample and Q sample
-q2:     taps
-q4, q5: accumulator for I branch and Q branch (will be the output)
-*/
-
-        asm volatile(
-            "       veor q4, q4\n\t"
-            "       veor q5, q5\n\t"
-            "for_fdccasm%=: vld2.32   {q0-q1}, [%[pinput]]!\n\t" //load q0 and q1 directly from the memory address stored in pinput, with interleaving (so that we get the I samples in q0 and the Q samples in q1), also increment the memory address in pinput (hence the "!" mark) //http://community.arm.com/groups/processors/blog/2010/03/17/coding-for-neon--part-1-load-and-stores
-            "       vld1.32 {q2}, [%[ptaps]]!\n\t"
-            "       vmla.f32 q4, q0, q2\n\t" //quad_acc_i += quad_input_i * quad_taps_1 //http://stackoverflow.com/questions/3240440/how-to-use-the-multiply-and-accumulate-intrinsics-in-arm-cortex-a8 //http://infocenter.arm.com/help/index.jsp?topic=/com.arm.doc.dui0489e/CIHEJBIE.html
-            "       vmla.f32 q5, q1, q2\n\t" //quad_acc_q += quad_input_q * quad_taps_1
-            "       cmp %[ptaps], %[ptaps_end]\n\t" //if(ptaps != ptaps_end)
-            "       bcc for_fdccasm%=\n\t"            //  then goto for_fdcasm
-            "       vst1.32 {q4}, [%[quad_acci]]\n\t" //if the loop is finished, store the two accumulators in memory
-            "       vst1.32 {q5}, [%[quad_accq]]\n\t"
-        :
-            [pinput]"+r"(pinput), [ptaps]"+r"(ptaps) //output operand list
-        :
-            [ptaps_end]"r"(ptaps_end), [quad_acci]"r"(quad_acciq), [quad_accq]"r"(quad_acciq+4) //input operand list
-        :
-            "memory", "q0", "q1", "q2", "q4", "q5", "cc" //clobber list
-        );
-        //original for loops for reference:
-        //for(int ti=0; ti<taps_length; ti++) acci += (iof(input,i+ti)) * taps[ti]; //@fir_decimate_cc: i loop
-        //for(int ti=0; ti<taps_length; ti++) accq += (qof(input,i+ti)) * taps[ti]; //@fir_decimate_cc: q loop
-
-        //for(int n=0;n<8;n++) fprintf(stderr, "\n>> [%d] %g \n", n, quad_acciq[n]);
-        output[oi].i = quad_acciq[0] + quad_acciq[1] + quad_acciq[2] + quad_acciq[3]; //we're still not ready, as we have to add up the contents of a quad accumulator register to get a single accumulated value
-        output[oi].q = quad_acciq[4] + quad_acciq[5] + quad_acciq[6] + quad_acciq[7];
-        oi++;
+        if(!dsp_fastconv_init(&fastconv, DECIMATION_FACTOR, FASTCONV_FFT_SIZE, FASTCONV_PASSBAND, FASTCONV_STOPBAND, FASTCONV_ATTENUATION))
+        {
+            return false;
+        }
+        window_min = FASTCONV_FFT_SIZE;
+        window_max = FASTCONV_FFT_SIZE;
+        output_max = fastconv.MaxOutput;
     }
-
-    return oi;
-}
-
-static float window_kernel_hamming(float rate)
-{
-    //Explanation at Chapter 16 of dspguide.com, page 2
-    //Hamming window has worse stopband attentuation and passband ripple than Blackman, but it has faster rolloff.
-    rate=0.5+rate/2;
-    return 0.54-0.46*cos(2*M_PI*rate);
-}
-
-static void firdes_lowpass_f(float *output, int length, float cutoff_rate)
-{   //Generates symmetric windowed sinc FIR filter real taps
-    //  length should be odd
-    //  cutoff_rate is (cutoff frequency/sampling frequency)
-    //Explanation at Chapter 16 of dspguide.com
-    int middle=length/2;
-    output[middle]=2*M_PI*cutoff_rate*window_kernel_hamming(0);
-    for(int i=1; i<=middle; i++) //@@firdes_lowpass_f: calculate taps
+    else
     {
-        output[middle-i]=output[middle+i]=(sin(2*M_PI*cutoff_rate*i)/i)*window_kernel_hamming((float)i/middle);
-        //printf("%g %d %d %d %d | %g\n",output[middle-i],i,middle,middle+i,middle-i,sin(2*PI*cutoff_rate*i));
+        if(!dsp_decimator_init(&decimator, decimation_stages, sizeof(decimation_stages) / sizeof(decimation_stages[0]),
+            DECIMATION_PASSBAND, DECIMATION_ATTENUATION, DECIMATION_CIC_ORDER, INPUT_SIZE))
+        {
+            return false;
+        }
+        window_min = INPUT_SIZE;
+        window_max = decimator.MaxWindow;
+        output_max = decimator.MaxOutput;
     }
-    //Normalize filter kernel
-    float sum=0;
-    for(int i=0;i<length;i++) //@normalize_fir_f: normalize pass 1
-        sum+=output[i];
-    for(int i=0;i<length;i++) //@normalize_fir_f: normalize pass 2
-        output[i]=output[i]/sum;
+
+    return true;
 }
 
 /* IF Subsample Thread */
@@ -157,43 +97,19 @@ void *if_subsample_thread(void *arg)
 {
     bool *exit_requested = (bool *)arg;
 
-    /** Shift Addition Prep **/
-
-    float shift_addition_cc_rate;
-    float shift_addition_cc_phase = 0.0;
-
-    /** decimation Prep **/
-    float transition_bw = 0.05;
-
-    int taps_length = 4.0 / transition_bw;
-    if(taps_length % 2 == 0) taps_length++; //number of symmetric FIR filter taps should be odd
-
-
-    #define NEON_ALIGNMENT (4*4*2)
-
-    int padded_taps_length = taps_length + (NEON_ALIGNMENT / 4) - 1 - ((taps_length + (NEON_ALIGNMENT / 4) - 1) % (NEON_ALIGNMENT / 4));
-    //printf("if_subsample: padded_taps_length = %d (from %d)\n", padded_taps_length, taps_length);
-    
-    float *taps;
-    taps = (float*)malloc((padded_taps_length + NEON_ALIGNMENT) * sizeof(float));
-    //fprintf(stderr,"taps = %p\n", (void *)taps);
-    taps =  (float*)((((unsigned)taps) + NEON_ALIGNMENT - 1) & ~(NEON_ALIGNMENT - 1));
-    //fprintf(stderr,"NEON aligned taps = %p\n", (void *)taps);
-    for(int i = 0; i < (padded_taps_length - taps_length); i++) taps[taps_length + i] = 0;
-
-    /* Hardcoded for Hamming window */
-    firdes_lowpass_f(taps, taps_length, 0.5 / (float)DECIMATION_FACTOR);
+    /** decimation Prep, the frequency shift is done by the decimation engine **/
+    uint32_t input_length, consumed;
+    double shift_rate;
 
     /** Buffers! **/
 
-    buffer_iqsample_t *buffer_1 = (buffer_iqsample_t *)malloc(sizeof(buffer_iqsample_t) * (INPUT_SIZE + padded_taps_length));
-    buffer_iqsample_t *buffer_2 = (buffer_iqsample_t *)malloc(sizeof(buffer_iqsample_t) * INPUT_SIZE);
-    buffer_iqsample_t *buffer_3 = (buffer_iqsample_t *)malloc(sizeof(buffer_iqsample_t) * (INPUT_SIZE / DECIMATION_FACTOR));
+    /* Input is read in place from buffer_circular_iq_main */
+    buffer_circular_span_t input_spans[2];
 
-    if(buffer_1 == NULL || buffer_2 == NULL || buffer_3 == NULL)
+    buffer_iqsample_t *buffer_3 = (buffer_iqsample_t *)malloc(sizeof(buffer_iqsample_t) * output_max);
+    if(buffer_3 == NULL)
     {
         fprintf(stderr, "Error: Failed to allocated buffers for if_subsample, aborting.\n");
-        /* TODO, Free allocated buffers here */
         return NULL;
     }
 
@@ -203,18 +119,15 @@ void *if_subsample_thread(void *arg)
     uint64_t start_monotonic = 0;
 #endif
 
-    uint32_t buffer_length_returned;
-
     int subsample_output_samples = 0;
-    int overlap = 0;
     while(!*exit_requested)
     {
-        /* Wait for incoming data */
-        buffer_length_returned = 0;
-        buffer_circular_waitThresholdPop(&buffer_circular_iq_main, INPUT_SIZE, INPUT_SIZE, buffer_1, &buffer_length_returned);
-        if(buffer_length_returned != INPUT_SIZE)
+        /* Wait for incoming data, the window includes the overlap left from the last iteration.
+            buffer_circular_iq_main is mirrored so the first span always covers all of it */
+        input_length = buffer_circular_timedWaitThresholdPeek(&buffer_circular_iq_main, window_min, window_max, input_spans, 100);
+        if(input_length < window_min)
         {
-            fprintf(stderr, "Subsample Error: subsample input buffer returned incorrect length\n");
+            /* Timed out or closed, check for exit */
             continue;
         }
 
@@ -227,20 +140,25 @@ void *if_subsample_thread(void *arg)
 #endif
 
         /* Prepare current frequency values */
-        shift_addition_cc_rate = (float)(center_frequency - selected_center_frequency) / 512000.0;
+        shift_rate = (double)(center_frequency - selected_center_frequency) / 512000.0;
 
-        /* Shift it */
-        shift_addition_cc(buffer_1, &buffer_2[overlap], shift_addition_cc_rate, &shift_addition_cc_phase);
-    
-        /* Subsample it */
-        subsample_output_samples = fir_decimate_cc(buffer_2, buffer_3, INPUT_SIZE + overlap, DECIMATION_FACTOR, taps, padded_taps_length);
-        //printf("SUB: returned %d samples / 16384 (overlap: %d, ptapslength: %d)\n", subsample_output_samples, overlap, padded_taps_length);
-        /* Shift over for overlap in next iteration */
-        overlap = (INPUT_SIZE + overlap) - (subsample_output_samples * DECIMATION_FACTOR);
+        /* Shift and subsample it in one pass straight out of the input buffer, the overlap stays there for the next iteration */
+        if(if_subsample_fastconv)
+        {
+            dsp_fastconv_set_shift(&fastconv, shift_rate);
+            subsample_output_samples = dsp_fastconv_process(&fastconv, input_spans[0].Data, input_length, buffer_3, &consumed);
+        }
+        else
+        {
+            dsp_decimator_set_shift(&decimator, shift_rate);
+            subsample_output_samples = dsp_decimator_process(&decimator, input_spans[0].Data, input_length, buffer_3, &consumed);
+        }
+        buffer_circular_release(&buffer_circular_iq_main, consumed);
+        //printf("SUB: returned %d samples\n", subsample_output_samples);
 
 #if 0
         /**** DEBUG ****/
-        samples_total += INPUT_SIZE;
+        samples_total += consumed;
         decimated_samples_total += subsample_output_samples;
         printf("Subsample samplerate: %.3f (total: %lld) -> %.3f\n",
             (float)(samples_total * 1000) / (monotonic_ms() - start_monotonic), samples_total,
@@ -271,8 +189,6 @@ void *if_subsample_thread(void *arg)
         }
     }
 
-    free(buffer_1);
-    free(buffer_2);
     free(buffer_3);
 
     return NULL;
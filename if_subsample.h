@@ -11,6 +11,9 @@ typedef struct {
     pthread_cond_t signal;
 } if_fft_buffer_t;
 
+extern bool if_subsample_fastconv;
+
+bool if_subsample_init(void);
 void *if_subsample_thread(void *arg);
 
 #endif /* __IF_SUBSAMPLE_H__ */
@@ -18,8 +18,6 @@
 #include "timing.h"
 #include "buffer/buffer_circular.h"
 
-lime_fft_buffer_t lime_fft_buffer;
-
 double frequency_tx =  1200000e3;
 double frequency_rx = 10489750e3;
 double frequency_downconversion = 9750e6;
@@ -420,7 +418,12 @@ void *lime_thread(void *arg)
     //Initialize data buffers
     const int buffersize = 8 * 1024; // 8192 I+Q samples
     float *buffer;
-    buffer = malloc(buffersize * 2 * sizeof(float)); //buffer to hold complex values (2*samples))
+    buffer = malloc(buffersize * 2 * sizeof(float)); //overflow buffer to hold complex values (2*samples)) when the IF subsample buffer is full
+
+    /* Samples are received straight into the IF subsample buffer */
+    buffer_circular_span_t rx_spans[2];
+    float *rx_buffer;
+    int rx_buffersize;
 
     //Start streaming
     LMS_StartStream(&rx_stream);
@@ -447,15 +450,33 @@ void *lime_thread(void *arg)
     uint64_t start_monotonic = 0;
 #endif
 
-    uint32_t samples_rx_transferred = samplesRead / 2.0;
     while(false == *exit_requested)
     {
+        /* Reserve space for the next block in the IF subsample buffer */
+        buffer_circular_reserve(&buffer_circular_iq_main, buffersize, rx_spans);
+        if(rx_spans[0].Length > 0)
+        {
+            /* Only the first span, any remainder past the wraparound is received on the next iteration */
+            rx_buffer = (float *)rx_spans[0].Data;
+            rx_buffersize = rx_spans[0].Length;
+        }
+        else
+        {
+            /* IF subsample buffer is full, keep the Lime FIFO draining but the block will be dropped */
+            rx_buffer = buffer;
+            rx_buffersize = buffersize;
+        }
+
         //Receive samples
-        samplesRead = LMS_RecvStream(&rx_stream, buffer, buffersize, &rx_metadata, 1000);
+        samplesRead = LMS_RecvStream(&rx_stream, rx_buffer, rx_buffersize, &rx_metadata, 1000);
         if(*exit_requested)
         {
             break;
         }
+        if(samplesRead <= 0)
+        {
+            continue;
+        }
 
 #if 0
         if(!monotonic_started)
@@ -465,31 +486,16 @@ void *lime_thread(void *arg)
         }
 #endif
 
-        /* Copy out for Band FFT */
-        pthread_mutex_lock(&lime_fft_buffer.mutex);
-        /* Reset index so FFT knows it's new data */
-        lime_fft_buffer.index = 0;
-        memcpy(
-            lime_fft_buffer.data,
-            buffer,
-            (samplesRead * 2 * sizeof(float))
-        );
-        lime_fft_buffer.size = (samplesRead * sizeof(float));
-        pthread_cond_signal(&lime_fft_buffer.signal);
-        pthread_mutex_unlock(&lime_fft_buffer.mutex);
-
-        if(*exit_requested)
+        /* Hand over to demod and band FFT */
+        if(rx_buffer != buffer)
         {
-            break;
+            buffer_circular_commit(&buffer_circular_iq_main, samplesRead);
         }
-
-        /* Copy out for demod */
-        samples_rx_transferred = samplesRead;
-        buffer_circular_push(&buffer_circular_iq_main, (buffer_iqsample_t *)buffer, &samples_rx_transferred);
-        if(samples_rx_transferred > 0)
+        else
         {
-            fprintf(stderr, "Lime: WARNING push to IF subsample buffer was lossy (%d / %d returned)\n",
-                samples_rx_transferred, samplesRead);
+            buffer_circular_drop(&buffer_circular_iq_main, samplesRead);
+            fprintf(stderr, "Lime: WARNING push to IF subsample buffer was lossy (%d samples dropped)\n",
+                samplesRead);
         }
 
 #if 0
@@ -6,7 +6,6 @@
 #include <string.h>
 #include <signal.h>
 #include <pthread.h>
-#include <fftw3.h>
 #include <getopt.h>
 
 #include "screen.h"
@@ -16,10 +15,13 @@
 
 #include "lime.h"
 #include "fft.h"
+#include "fft_planner.h"
 #include "buffer/buffer_circular.h"
+#include "dsp/dsp.h"
 #include "if_subsample.h"
 #include "if_fft.h"
 #include "if_demod.h"
+#include "if_channelizer.h"
 #include "audio.h"
 #include "touch.h"
 
@@ -40,6 +42,18 @@ void _print_usage(void)
         "Usage: txrx [options]\n"
         "\n"
         "  -d, --downconversion <number>  Set the RX LO  Default: 9750000\n"
+        "  -m, --monitor <frequency>      Also receive this frequency (Hz), can be given up to 4 times\n"
+        "  -f, --fastconv                 Use the FFT (overlap-save) IF decimator, with a sharper filter\n"
+        "  -a, --agc <mode>               AGC: slow, fast, hang or off  Default: slow\n"
+        "  -D, --dither                   Add TPDF dither to the demodulated audio\n"
+        "  -n, --nr <mode>                Noise reduction: off, lms, notch or spectral  Default: off\n"
+        "  -i, --integration <ms>         Band spectrum averaging time  Default: 100\n"
+        "  -s, --fft-size <points>        Band FFT size, power of two from 512 to 65536  Default: 512\n"
+        "  -z, --zoom <factor>            Show 1/factor of the band around the selected frequency  Default: 1\n"
+        "  -r, --reduce <peak|mean>       Combining of FFT bins into waterfall pixels  Default: peak\n"
+        "  -M, --mode <mode>              Demodulator: usb, lsb, cw, am or fm  Default: usb\n"
+        "  -p, --planner <rigor>          FFT planning in the background: measure, patient or exhaustive  Default: patient\n"
+        "  -b, --fft-backend <backend>    FFT backend: auto (fastest per size), fftw or builtin  Default: auto\n"
         "\n"
     );
 }
@@ -50,9 +64,19 @@ static pthread_t mouse_thread_obj;
 static pthread_t if_subsample_thread_obj;
 static pthread_t if_fft_thread_obj;
 static pthread_t if_demod_thread_obj;
+static pthread_t if_demod_filter_thread_obj;
+static pthread_t if_channelizer_thread_obj;
 static pthread_t audio_rx_thread_obj;
 static pthread_t lime_thread_obj;
 static pthread_t fft_thread_obj;
+static pthread_t fft_planner_thread_obj;
+
+static if_demod_t if_demod_main = {
+    .name = "Main",
+    .exit_requested = &app_exit,
+    .input = &buffer_circular_iq_if,
+    .output = &buffer_circular_audio,
+};
 
 int main(int argc, char* argv[])
 {
@@ -64,11 +88,26 @@ int main(int argc, char* argv[])
 
   static const struct option long_options[] = {
         { "downconversion",    required_argument, 0, 'd' },
+        { "monitor",           required_argument, 0, 'm' },
+        { "fastconv",          no_argument,       0, 'f' },
+        { "agc",               required_argument, 0, 'a' },
+        { "dither",            no_argument,       0, 'D' },
+        { "mode",              required_argument, 0, 'M' },
+        { "nr",                required_argument, 0, 'n' },
+        { "integration",       required_argument, 0, 'i' },
+        { "fft-size",          required_argument, 0, 's' },
+        { "zoom",              required_argument, 0, 'z' },
+        { "reduce",            required_argument, 0, 'r' },
+        { "planner",           required_argument, 0, 'p' },
+        { "fft-backend",       required_argument, 0, 'b' },
         { 0,                   0,                 0,  0  }
     };
     
     int c, opt;
-    while((c = getopt_long(argc, argv, "d:", long_options, &opt)) != -1)
+    dsp_agc_mode_t agc_mode;
+    dsp_nr_mode_t nr_mode;
+    if_demod_mode_t demod_mode = IF_DEMOD_MODE_USB;
+    while((c = getopt_long(argc, argv, "d:m:fa:DM:n:i:s:z:r:p:b:", long_options, &opt)) != -1)
     {
         switch(c)
         {        
@@ -76,6 +115,89 @@ int main(int argc, char* argv[])
             frequency_downconversion = atof(optarg);
             break;
 
+        case 'm': /* --monitor <frequency> */
+            if(!if_channelizer_add(atoll(optarg)))
+            {
+                return 1;
+            }
+            break;
+
+        case 'f': /* --fastconv */
+            if_subsample_fastconv = true;
+            break;
+
+        case 'a': /* --agc <mode> */
+            if(!dsp_agc_mode_parse(optarg, &agc_mode))
+            {
+                fprintf(stderr, "Error: Unknown AGC mode '%s'\n", optarg);
+                _print_usage();
+                return 1;
+            }
+            if_demod_set_agc(&if_demod_main, agc_mode);
+            break;
+
+        case 'D': /* --dither */
+            if_demod_main.dither = true;
+            break;
+
+        case 'M': /* --mode <mode> */
+            if(!if_demod_mode_parse(optarg, &demod_mode))
+            {
+                fprintf(stderr, "Error: Unknown demodulator mode '%s'\n", optarg);
+                _print_usage();
+                return 1;
+            }
+            break;
+
+        case 'n': /* --nr <mode> */
+            if(!dsp_nr_mode_parse(optarg, &nr_mode))
+            {
+                fprintf(stderr, "Error: Unknown noise reduction mode '%s'\n", optarg);
+                _print_usage();
+                return 1;
+            }
+            if_demod_set_nr(&if_demod_main, nr_mode);
+            break;
+
+        case 'i': /* --integration <ms> */
+            fft_integration_ms = atoi(optarg);
+            break;
+
+        case 's': /* --fft-size <points> */
+            fft_size = atoi(optarg);
+            break;
+
+        case 'z': /* --zoom <factor> */
+            fft_zoom = atoi(optarg);
+            break;
+
+        case 'r': /* --reduce <peak|mean> */
+            if(!dsp_spectrum_reduce_parse(optarg, &fft_reduce))
+            {
+                fprintf(stderr, "Error: Unknown bin reduction '%s'\n", optarg);
+                _print_usage();
+                return 1;
+            }
+            break;
+
+        case 'p': /* --planner <rigor> */
+            if(!fft_planner_rigor_parse(optarg, &fft_planner_rigor))
+            {
+                fprintf(stderr, "Error: Unknown FFT planner rigor '%s'\n", optarg);
+                _print_usage();
+                return 1;
+            }
+            break;
+
+        case 'b': /* --fft-backend <backend> */
+            if(!fft_planner_backend_parse(optarg, &fft_planner_backend))
+            {
+                fprintf(stderr, "Error: Unknown FFT backend '%s'\n", optarg);
+                _print_usage();
+                return 1;
+            }
+            break;
+
         case '?':
             _print_usage();
             return(0);
@@ -90,15 +212,59 @@ int main(int argc, char* argv[])
     return 1;
   }
 
-  printf("Profiling FFTs..\n");
-  fftwf_import_wisdom_from_filename(".fftwf_wisdom");
+  /* Setting up buffers, before the FFTs as those add their readers */
+  if(!buffer_circular_initMirrored(&buffer_circular_iq_main, sizeof(buffer_iqsample_t), 4096*1024))
+  {
+      fprintf(stderr, "Error creating %s buffer\n", "IQ Main");
+      return 1;
+  }
+  buffer_circular_init(&buffer_circular_iq_if, sizeof(buffer_iqsample_t), 64*1024);
+  buffer_circular_init(&buffer_circular_audio, sizeof(int16_t), 2*1024);
+
+  /* Select SIMD kernels for this CPU */
+  dsp_init();
+
+  /* Plans come from wisdom or are estimated, fft_planner_thread measures the rest once everything is running */
+  printf("Planning FFTs..\n");
+  fft_planner_init();
   printf(" - Main Band FFT\n");
-  main_fft_init();
+  if(!main_fft_init())
+  {
+    fprintf(stderr, "Error setting up Main Band FFT\n");
+    return 1;
+  }
+  printf(" - IF Subsample\n");
+  if(!if_subsample_init())
+  {
+    fprintf(stderr, "Error setting up IF Subsample\n");
+    return 1;
+  }
   printf(" - IF Band FFT\n");
-  if_fft_init();
+  if(!if_fft_init())
+  {
+    fprintf(stderr, "Error setting up IF Band FFT\n");
+    return 1;
+  }
   printf(" - IF Demodulator FFTs\n");
-  if_demod_init();
-  fftwf_export_wisdom_to_filename(".fftwf_wisdom");
+  if(!if_demod_init())
+  {
+    fprintf(stderr, "Error setting up IF Demodulator\n");
+    return 1;
+  }
+  /* Needs the filter cache, the filter is designed once the designer thread has started */
+  if(demod_mode != IF_DEMOD_MODE_USB && !if_demod_set_mode(&if_demod_main, demod_mode))
+  {
+    fprintf(stderr, "Error setting up the demodulator mode filter\n");
+    return 1;
+  }
+  if(if_channelizer_monitor_count > 0)
+  {
+    printf(" - IF Channelizer FFT\n");
+    if(!if_channelizer_init(&app_exit))
+    {
+      return 1;
+    }
+  }
   printf("FFTs Done.\n");
 
   /* Touchscreen Thread */
@@ -117,11 +283,6 @@ int main(int argc, char* argv[])
   }
   pthread_setname_np(mouse_thread_obj, "Mouse");
 
-  /* Setting up buffers */
-  buffer_circular_init(&buffer_circular_iq_main, sizeof(buffer_iqsample_t), 4096*1024);
-  buffer_circular_init(&buffer_circular_iq_if, sizeof(buffer_iqsample_t), 64*1024);
-  buffer_circular_init(&buffer_circular_audio, sizeof(int16_t), 2*1024);
-
   /* IF Subsample Thread */
   if(pthread_create(&if_subsample_thread_obj, NULL, if_subsample_thread, &app_exit))
   {
@@ -138,14 +299,43 @@ int main(int argc, char* argv[])
   }
   pthread_setname_np(if_fft_thread_obj, "IF FFT");
 
+  /* IF Demodulator Filter Designer Thread */
+  if(pthread_create(&if_demod_filter_thread_obj, NULL, if_demod_filter_thread, &app_exit))
+  {
+      fprintf(stderr, "Error creating %s pthread\n", "IF Demod Filter");
+      return 1;
+  }
+  pthread_setname_np(if_demod_filter_thread_obj, "IF Demod Filter");
+
   /* IF Demodulator Thread */
-  if(pthread_create(&if_demod_thread_obj, NULL, if_demod_thread, &app_exit))
+  if(pthread_create(&if_demod_thread_obj, NULL, if_demod_thread, &if_demod_main))
   {
       fprintf(stderr, "Error creating %s pthread\n", "IF Demod");
       return 1;
   }
   pthread_setname_np(if_demod_thread_obj, "IF Demod");
 
+  /* IF Channelizer and Monitor Demodulator Threads */
+  if(if_channelizer_monitor_count > 0)
+  {
+    if(pthread_create(&if_channelizer_thread_obj, NULL, if_channelizer_thread, &app_exit))
+    {
+        fprintf(stderr, "Error creating %s pthread\n", "IF Channelizer");
+        return 1;
+    }
+    pthread_setname_np(if_channelizer_thread_obj, "IF Channelizer");
+
+    for(int i = 0; i < if_channelizer_monitor_count; i++)
+    {
+      if(pthread_create(&if_channelizer_monitors[i].demod_thread_obj, NULL, if_demod_thread, &if_channelizer_monitors[i].demod))
+      {
+          fprintf(stderr, "Error creating %s pthread\n", "Monitor Demod");
+          return 1;
+      }
+      pthread_setname_np(if_channelizer_monitors[i].demod_thread_obj, "Monitor Demod");
+    }
+  }
+
   /* Audio RX Thread */
   if(pthread_create(&audio_rx_thread_obj, NULL, audio_playback_thread, &app_exit))
   {
@@ -178,6 +368,15 @@ int main(int argc, char* argv[])
   }
   pthread_setname_np(screen_thread_obj, "Screen");
 
+  /* FFT Planner Thread, last so it only gets the CPU that is left over. Not joined, it may be mid-measurement at exit */
+  if(pthread_create(&fft_planner_thread_obj, NULL, fft_planner_thread, &app_exit))
+  {
+      fprintf(stderr, "Error creating %s pthread\n", "FFT Planner");
+      return 1;
+  }
+  pthread_setname_np(fft_planner_thread_obj, "FFT Planner");
+  pthread_detach(fft_planner_thread_obj);
+
   while(!app_exit)
   {
     sleep_ms(10);
@@ -186,10 +385,35 @@ int main(int argc, char* argv[])
   printf("Got SIGTERM/INT..\n");
   app_exit = true;
 
-  /* TODO: Add validity flag and appropriate bomb-out logic for buffer-consumer threads so we don't segfault on exit half the time */
-
+  /* Stop the pipeline from the source, closing each buffer once its producer has gone so the consumers can't block on it */
   printf("Waiting for Lime Thread to exit..\n");
   pthread_join(lime_thread_obj, NULL);
+  buffer_circular_close(&buffer_circular_iq_main);
+  printf("Waiting for IF Subsample Thread to exit..\n");
+  pthread_join(if_subsample_thread_obj, NULL);
+  buffer_circular_close(&buffer_circular_iq_if);
+  if(if_channelizer_monitor_count > 0)
+  {
+    printf("Waiting for IF Channelizer Thread to exit..\n");
+    pthread_join(if_channelizer_thread_obj, NULL);
+    for(int i = 0; i < if_channelizer_monitor_count; i++)
+    {
+      buffer_circular_close(&if_channelizer_monitors[i].iq);
+    }
+  }
+  printf("Waiting for IF Demod Thread to exit..\n");
+  pthread_join(if_demod_thread_obj, NULL);
+  for(int i = 0; i < if_channelizer_monitor_count; i++)
+  {
+    pthread_join(if_channelizer_monitors[i].demod_thread_obj, NULL);
+    buffer_circular_close(&if_channelizer_monitors[i].audio);
+  }
+  pthread_join(if_demod_filter_thread_obj, NULL);
+  buffer_circular_close(&buffer_circular_audio);
+  printf("Waiting for RX Audio Thread to exit..\n");
+  pthread_join(audio_rx_thread_obj, NULL);
+  printf("Waiting for IF FFT Thread to exit..\n");
+  pthread_join(if_fft_thread_obj, NULL);
   printf("Waiting for FFT Thread to exit..\n");
   pthread_join(fft_thread_obj, NULL);
   //pthread_join(mouse_thread_obj, NULL);
@@ -197,4 +421,21 @@ int main(int argc, char* argv[])
   pthread_join(screen_thread_obj, NULL);
 
   printf("All threads caught, exiting..\n");
+
+  fft_planner_close();
+
+  buffer_circular_metrics_t metrics;
+  printf("Buffer metrics:\n");
+  buffer_circular_metrics(&buffer_circular_iq_main, &metrics);
+  buffer_circular_metricsPrint("IQ Main", &metrics);
+  buffer_circular_metrics(&buffer_circular_iq_if, &metrics);
+  buffer_circular_metricsPrint("IQ IF", &metrics);
+  buffer_circular_metrics(&buffer_circular_audio, &metrics);
+  buffer_circular_metricsPrint("Audio", &metrics);
+
+  if_demod_metricsPrint(&if_demod_main);
+  for(int i = 0; i < if_channelizer_monitor_count; i++)
+  {
+    if_demod_metricsPrint(&if_channelizer_monitors[i].demod);
+  }
 }
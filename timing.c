@@ -15,6 +15,18 @@ uint64_t monotonic_ms(void)
     return (uint64_t) tp.tv_sec * 1000 + tp.tv_nsec / 1000000;
 }
 
+uint64_t monotonic_ns(void)
+{
+    struct timespec tp;
+
+    if(clock_gettime(CLOCK_MONOTONIC, &tp) != 0)
+    {
+        return 0;
+    }
+
+    return (uint64_t) tp.tv_sec * 1000000000 + tp.tv_nsec;
+}
+
 uint64_t timestamp_ms(void)
 {
     struct timespec tp;
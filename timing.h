@@ -5,6 +5,8 @@
 
 uint64_t monotonic_ms(void);
 
+uint64_t monotonic_ns(void);
+
 uint64_t timestamp_ms(void);
 
 void sleep_ms(uint32_t _duration);
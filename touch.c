@@ -196,6 +196,9 @@ extern int64_t span_frequency;
 extern int64_t selected_center_frequency;
 extern int64_t selected_span_frequency;
 
+extern int64_t display_center_frequency;
+extern int64_t display_span_frequency;
+
 static bool main_drag_ongoing = false;
 static int main_drag_last_pos_x = 0;
 
@@ -235,7 +238,7 @@ static void touch_process(int touch_type, int touch_x, int touch_y)
         && areaTouched(MAIN_WF_AX, MAIN_WF_AW, MAIN_WF_AY, MAIN_WF_AH))
         {
             main_drag_ongoing = true;
-            selected_center_frequency = (center_frequency - (span_frequency / 2)) + ((((touch_x - MAIN_WF_AX) * span_frequency) / MAIN_WF_AW));
+            selected_center_frequency = (display_center_frequency - (display_span_frequency / 2)) + ((((touch_x - MAIN_WF_AX) * display_span_frequency) / MAIN_WF_AW));
             graphics_frequency_newdata();
             main_drag_last_pos_x = touch_x;
         }
@@ -262,8 +265,8 @@ static void touch_process(int touch_type, int touch_x, int touch_y)
         if(main_drag_ongoing
         && xTouched(MAIN_WF_AX, MAIN_WF_AW))
         {
-            //printf(" - Freq += %lld.\n", (main_drag_last_pos_x - touch_x) * (span_frequency / MAIN_WF_AW));
-            selected_center_frequency += (touch_x - main_drag_last_pos_x) * (span_frequency / MAIN_WF_AW);
+            //printf(" - Freq += %lld.\n", (main_drag_last_pos_x - touch_x) * (display_span_frequency / MAIN_WF_AW));
+            selected_center_frequency += (touch_x - main_drag_last_pos_x) * (display_span_frequency / MAIN_WF_AW);
             graphics_frequency_newdata();
             main_drag_last_pos_x = touch_x;
         }